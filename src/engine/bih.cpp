@@ -1,6 +1,11 @@
 #include "engine.h"
 
-extern vec hitsurface;
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BIHSSE
+#endif
+
+extern thread_local vec hitsurface;
 
 bool BIH::triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode)
 {
@@ -41,6 +46,105 @@ bool BIH::triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray,
     return true;
 }
 
+// finds the leaf's triangles the ray may hit, mirroring the arithmetic of triintersect so
+// that only candidates need the exact test with its alpha and facing checks
+static inline int leafhits(const BIH::mesh &m, const BIH::leaf &l, const vec &mo, const vec &mray, float maxdist, int mode)
+{
+#ifdef BIHSSE
+    if(!l.numtris) return 0;
+    // gather the vertices into columns, padding short leaves with their first triangle
+    float pos[9][BIH::LEAFTRIS];
+    loopi(BIH::LEAFTRIS)
+    {
+        const BIH::tri &t = m.tris[l.tris[i < l.numtris ? i : 0]];
+        loopj(3)
+        {
+            vec v = m.getpos(t.vert[j]);
+            pos[3*j][i] = v.x;
+            pos[3*j+1][i] = v.y;
+            pos[3*j+2][i] = v.z;
+        }
+    }
+    __m128 ax = _mm_loadu_ps(pos[0]), ay = _mm_loadu_ps(pos[1]), az = _mm_loadu_ps(pos[2]),
+           bx = _mm_sub_ps(_mm_loadu_ps(pos[3]), ax), by = _mm_sub_ps(_mm_loadu_ps(pos[4]), ay), bz = _mm_sub_ps(_mm_loadu_ps(pos[5]), az),
+           cx = _mm_sub_ps(_mm_loadu_ps(pos[6]), ax), cy = _mm_sub_ps(_mm_loadu_ps(pos[7]), ay), cz = _mm_sub_ps(_mm_loadu_ps(pos[8]), az),
+           nx = _mm_sub_ps(_mm_mul_ps(by, cz), _mm_mul_ps(bz, cy)),
+           ny = _mm_sub_ps(_mm_mul_ps(bz, cx), _mm_mul_ps(bx, cz)),
+           nz = _mm_sub_ps(_mm_mul_ps(bx, cy), _mm_mul_ps(by, cx)),
+           dx = _mm_set1_ps(mray.x), dy = _mm_set1_ps(mray.y), dz = _mm_set1_ps(mray.z),
+           rx = _mm_sub_ps(ax, _mm_set1_ps(mo.x)),
+           ry = _mm_sub_ps(ay, _mm_set1_ps(mo.y)),
+           rz = _mm_sub_ps(az, _mm_set1_ps(mo.z)),
+           ex = _mm_sub_ps(_mm_mul_ps(ry, dz), _mm_mul_ps(rz, dy)),
+           ey = _mm_sub_ps(_mm_mul_ps(rz, dx), _mm_mul_ps(rx, dz)),
+           ez = _mm_sub_ps(_mm_mul_ps(rx, dy), _mm_mul_ps(ry, dx)),
+           det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, nx), _mm_mul_ps(dy, ny)), _mm_mul_ps(dz, nz)),
+           v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, cx), _mm_mul_ps(ey, cy)), _mm_mul_ps(ez, cz)),
+           w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, bx), _mm_mul_ps(ey, by)), _mm_mul_ps(ez, bz)),
+           f = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, nx), _mm_mul_ps(ry, ny)), _mm_mul_ps(rz, nz)), _mm_set1_ps(m.scale)),
+           sign = _mm_and_ps(det, _mm_set1_ps(-0.0f)), zero = _mm_setzero_ps();
+    // flipping everything by the sign of det folds the front and back facing cases together
+    __m128 adet = _mm_xor_ps(det, sign);
+    v = _mm_xor_ps(v, sign);
+    w = _mm_xor_ps(w, _mm_xor_ps(sign, _mm_set1_ps(-0.0f)));
+    f = _mm_xor_ps(f, sign);
+    __m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(v, zero), _mm_cmple_ps(v, adet)),
+                            _mm_and_ps(_mm_cmpge_ps(w, zero), _mm_cmple_ps(_mm_add_ps(v, w), adet)));
+    hit = _mm_and_ps(hit, _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(f, zero), _mm_cmple_ps(f, _mm_mul_ps(adet, _mm_set1_ps(maxdist)))), _mm_cmpgt_ps(adet, zero)));
+    if(!(mode&RAY_SHADOW) && m.flags&BIH::MESH_CULLFACE) hit = _mm_and_ps(hit, _mm_cmplt_ps(det, zero));
+    return _mm_movemask_ps(hit) & ((1<<l.numtris)-1);
+#else
+    return (1<<l.numtris)-1;
+#endif
+}
+
+bool BIH::leafintersect(const mesh &m, int lidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode)
+{
+    const leaf &l = m.leaves[lidx];
+    int hits = leafhits(m, l, mo, mray, maxdist, mode);
+    if(!hits) return false;
+    // keep shrinking the range so the closest candidate is the last one accepted
+    bool found = false;
+    loopi(l.numtris) if(hits&(1<<i) && triintersect(m, l.tris[i], mo, mray, maxdist, dist, mode))
+    {
+        maxdist = dist;
+        found = true;
+    }
+    return found;
+}
+
+// finds the leaf's triangles whose bounds overlap the box
+static inline int leafoverlaps(const BIH::mesh &m, const BIH::leaf &l, const ivec &bo, const ivec &br)
+{
+#ifdef BIHSSE
+    if(!l.numtris) return 0;
+    // gather the bounds into columns, padding short leaves with their first triangle
+    float bb[6][BIH::LEAFTRIS];
+    loopi(BIH::LEAFTRIS)
+    {
+        const BIH::tribb &t = m.tribbs[l.tris[i < l.numtris ? i : 0]];
+        bb[0][i] = t.center.x;
+        bb[1][i] = t.center.y;
+        bb[2][i] = t.center.z;
+        bb[3][i] = t.radius.x;
+        bb[4][i] = t.radius.y;
+        bb[5][i] = t.radius.z;
+    }
+    __m128 absmask = _mm_set1_ps(-0.0f),
+           dx = _mm_andnot_ps(absmask, _mm_sub_ps(_mm_set1_ps(bo.x), _mm_loadu_ps(bb[0]))),
+           dy = _mm_andnot_ps(absmask, _mm_sub_ps(_mm_set1_ps(bo.y), _mm_loadu_ps(bb[1]))),
+           dz = _mm_andnot_ps(absmask, _mm_sub_ps(_mm_set1_ps(bo.z), _mm_loadu_ps(bb[2]))),
+           outside = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(dx, _mm_add_ps(_mm_set1_ps(br.x), _mm_loadu_ps(bb[3]))),
+                                         _mm_cmpgt_ps(dy, _mm_add_ps(_mm_set1_ps(br.y), _mm_loadu_ps(bb[4])))),
+                                _mm_cmpgt_ps(dz, _mm_add_ps(_mm_set1_ps(br.z), _mm_loadu_ps(bb[5]))));
+    return ~_mm_movemask_ps(outside) & ((1<<l.numtris)-1);
+#else
+    int overlaps = 0;
+    loopi(l.numtris) if(!m.tribbs[l.tris[i]].outside(bo, br)) overlaps |= 1<<i;
+    return overlaps;
+#endif
+}
+
 struct traversestate
 {
     BIH::node *node;
@@ -70,12 +174,12 @@ inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec
                     tmin = max(tmin, farsplit);
                     continue;
                 }
-                else if(triintersect(m, curnode->childindex(faridx), mo, mray, maxdist, dist, mode)) return true;
+                else if(leafintersect(m, curnode->childindex(faridx), mo, mray, maxdist, dist, mode)) return true;
             }
         }
         else if(curnode->isleaf(nearidx))
         {
-            if(triintersect(m, curnode->childindex(nearidx), mo, mray, maxdist, dist, mode)) return true;
+            if(leafintersect(m, curnode->childindex(nearidx), mo, mray, maxdist, dist, mode)) return true;
             if(farsplit < tmax)
             {
                 if(!curnode->isleaf(faridx))
@@ -84,7 +188,7 @@ inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec
                     tmin = max(tmin, farsplit);
                     continue;
                 }
-                else if(triintersect(m, curnode->childindex(faridx), mo, mray, maxdist, dist, mode)) return true;
+                else if(leafintersect(m, curnode->childindex(faridx), mo, mray, maxdist, dist, mode)) return true;
             }
         }
         else
@@ -108,7 +212,7 @@ inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec
                         continue;
                     }
                 }
-                else if(triintersect(m, curnode->childindex(faridx), mo, mray, maxdist, dist, mode)) return true;
+                else if(leafintersect(m, curnode->childindex(faridx), mo, mray, maxdist, dist, mode)) return true;
             }
             curnode += curnode->childindex(nearidx);
             tmax = min(tmax, nearsplit);
@@ -145,69 +249,125 @@ inline bool BIH::traverse(const vec &o, const vec &ray, float maxdist, float &di
     return false;
 }
 
-void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax)
+int BIH::buildleaf(mesh &m, const uint *indices, int numindices)
 {
-    int axis = 2;
-    loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
+    int lidx = m.numleaves++;
+    leaf &l = m.leaves[lidx];
+    memset(&l, 0, sizeof(leaf));
+    l.numtris = numindices;
+    loopi(numindices) l.tris[i] = indices[i];
+    return lidx;
+}
 
-    ivec leftmin, leftmax, rightmin, rightmax;
-    int splitleft, splitright;
-    int left, right;
-    loopk(3)
+static inline float bihboxarea(const ivec &bmin, const ivec &bmax)
+{
+    if(bmin.x > bmax.x) return 0;
+    float dx = bmax.x - bmin.x, dy = bmax.y - bmin.y, dz = bmax.z - bmin.z;
+    return dx*dy + dy*dz + dz*dx;
+}
+
+#define BIHSAHBINS 16
+
+// splits the triangles by the surface area heuristic over their binned centers, falling back to
+// halving them along the longest axis when the centers all coincide
+void BIH::build(mesh &m, uint *indices, int numindices, const ivec &vmin, const ivec &vmax)
+{
+    ivec cmin(INT_MAX, INT_MAX, INT_MAX), cmax(INT_MIN, INT_MIN, INT_MIN);
+    loopi(numindices)
     {
-        leftmin = rightmin = ivec(INT_MAX, INT_MAX, INT_MAX);
-        leftmax = rightmax = ivec(INT_MIN, INT_MIN, INT_MIN);
-        int split = (vmax[axis] + vmin[axis])/2;
-        for(left = 0, right = numindices, splitleft = SHRT_MIN, splitright = SHRT_MAX; left < right;)
+        ivec c(m.tribbs[indices[i]].center);
+        cmin.min(c);
+        cmax.max(c);
+    }
+
+    int axis = -1, splitbin = -1;
+    if(numindices > LEAFTRIS)
+    {
+        float bestcost = 1e30f;
+        loopk(3)
         {
-            const tribb &tri = m.tribbs[indices[left]];
-            ivec trimin = ivec(tri.center).sub(ivec(tri.radius)),
-                 trimax = ivec(tri.center).add(ivec(tri.radius));
-            int amin = trimin[axis], amax = trimax[axis];
-            if(max(split - amin, 0) > max(amax - split, 0))
+            int extent = cmax[k] - cmin[k];
+            if(extent <= 0) continue;
+            int bincount[BIHSAHBINS];
+            ivec binmin[BIHSAHBINS], binmax[BIHSAHBINS];
+            loopj(BIHSAHBINS)
+            {
+                bincount[j] = 0;
+                binmin[j] = ivec(INT_MAX, INT_MAX, INT_MAX);
+                binmax[j] = ivec(INT_MIN, INT_MIN, INT_MIN);
+            }
+            loopi(numindices)
+            {
+                const tribb &tri = m.tribbs[indices[i]];
+                int bin = ((tri.center[k] - cmin[k])*BIHSAHBINS)/(extent+1);
+                bincount[bin]++;
+                binmin[bin].min(ivec(tri.center).sub(ivec(tri.radius)));
+                binmax[bin].max(ivec(tri.center).add(ivec(tri.radius)));
+            }
+            float rightarea[BIHSAHBINS];
+            ivec rmin(INT_MAX, INT_MAX, INT_MAX), rmax(INT_MIN, INT_MIN, INT_MIN);
+            for(int j = BIHSAHBINS-1; j > 0; j--)
             {
-                ++left;
-                splitleft = max(splitleft, amax);
-                leftmin.min(trimin);
-                leftmax.max(trimax);
+                rmin.min(binmin[j]);
+                rmax.max(binmax[j]);
+                rightarea[j] = bihboxarea(rmin, rmax);
             }
-            else
+            ivec lmin(INT_MAX, INT_MAX, INT_MAX), lmax(INT_MIN, INT_MIN, INT_MIN);
+            int leftcount = 0;
+            loopj(BIHSAHBINS-1)
             {
-                --right;
-                swap(indices[left], indices[right]);
-                splitright = min(splitright, amin);
-                rightmin.min(trimin);
-                rightmax.max(trimax);
+                lmin.min(binmin[j]);
+                lmax.max(binmax[j]);
+                leftcount += bincount[j];
+                if(!leftcount || leftcount >= numindices) continue;
+                float cost = bihboxarea(lmin, lmax)*leftcount + rightarea[j+1]*(numindices - leftcount);
+                if(cost < bestcost)
+                {
+                    bestcost = cost;
+                    axis = k;
+                    splitbin = j;
+                }
             }
         }
-        if(left > 0 && right < numindices) break;
-        axis = (axis+1)%3;
     }
 
-    if(!left || right==numindices)
+    int left, right;
+    if(axis >= 0)
+    {
+        int extent = cmax[axis] - cmin[axis];
+        for(left = 0, right = numindices; left < right;)
+        {
+            int bin = ((m.tribbs[indices[left]].center[axis] - cmin[axis])*BIHSAHBINS)/(extent+1);
+            if(bin <= splitbin) ++left;
+            else swap(indices[left], indices[--right]);
+        }
+    }
+    else
+    {
+        axis = 2;
+        loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
+        left = right = numindices > LEAFTRIS ? numindices/2 : numindices;
+    }
+
+    ivec leftmin(INT_MAX, INT_MAX, INT_MAX), leftmax(INT_MIN, INT_MIN, INT_MIN),
+         rightmin(INT_MAX, INT_MAX, INT_MAX), rightmax(INT_MIN, INT_MIN, INT_MIN);
+    int splitleft = SHRT_MIN, splitright = SHRT_MAX;
+    loopi(numindices)
     {
-        leftmin = rightmin = ivec(INT_MAX, INT_MAX, INT_MAX);
-        leftmax = rightmax = ivec(INT_MIN, INT_MIN, INT_MIN);
-        left = right = numindices/2;
-        splitleft = SHRT_MIN;
-        splitright = SHRT_MAX;
-        loopi(numindices)
+        const tribb &tri = m.tribbs[indices[i]];
+        ivec trimin = ivec(tri.center).sub(ivec(tri.radius)),
+             trimax = ivec(tri.center).add(ivec(tri.radius));
+        if(i < left)
         {
-            const tribb &tri = m.tribbs[indices[i]];
-            ivec trimin = ivec(tri.center).sub(ivec(tri.radius)),
-                 trimax = ivec(tri.center).add(ivec(tri.radius));
-            if(i < left)
-            {
-                splitleft = max(splitleft, trimax[axis]);
-                leftmin.min(trimin);
-                leftmax.max(trimax);
-            }
-            else
-            {
-                splitright = min(splitright, trimin[axis]);
-                rightmin.min(trimin);
-                rightmax.max(trimax);
-            }
+            splitleft = max(splitleft, trimax[axis]);
+            leftmin.min(trimin);
+            leftmax.max(trimax);
+        }
+        else
+        {
+            splitright = min(splitright, trimin[axis]);
+            rightmin.min(trimin);
+            rightmax.max(trimax);
         }
     }
 
@@ -216,23 +376,206 @@ void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, cons
     curnode.split[0] = short(splitleft);
     curnode.split[1] = short(splitright);
 
-    if(left==1) curnode.child[0] = (axis<<14) | indices[0];
+    bool leftleaf = left <= LEAFTRIS;
+    if(leftleaf) curnode.child[0] = (axis<<30) | buildleaf(m, indices, left);
     else
     {
-        curnode.child[0] = (axis<<14) | (m.numnodes - offset);
+        curnode.child[0] = (axis<<30) | (m.numnodes - offset);
         build(m, indices, left, leftmin, leftmax);
     }
 
-    if(numindices-right==1) curnode.child[1] = (1<<15) | (left==1 ? 1<<14 : 0) | indices[right];
+    if(numindices-right <= LEAFTRIS) curnode.child[1] = (1U<<31) | (leftleaf ? 1<<30 : 0) | buildleaf(m, &indices[right], numindices-right);
     else
     {
-        curnode.child[1] = (left==1 ? 1<<14 : 0) | (m.numnodes - offset);
+        curnode.child[1] = (leftleaf ? 1<<30 : 0) | (m.numnodes - offset);
         build(m, &indices[right], numindices-right, rightmin, rightmax);
     }
 }
 
+// on-disk cache of built trees, keyed by a 64-bit hash of the transformed collision meshes along
+// with their vertex and index counts so that the same model at the same model scale skips the build
+// on later loads
+VARP(bihcache, 0, 1, 1);
+
+struct bihcachekey
+{
+    ullong hash;
+    int numverts, numindices;
+
+    bool operator==(const bihcachekey &o) const { return hash == o.hash && numverts == o.numverts && numindices == o.numindices; }
+};
+
+static inline ullong bihhash(ullong h, const void *data, size_t len)
+{
+    const uchar *p = (const uchar *)data;
+    loopi(len) h = (h ^ p[i]) * 0x100000001B3ULL;
+    return h;
+}
+
+static bihcachekey bihcachehash(const BIH &b)
+{
+    bihcachekey key = { 0xCBF29CE484222325ULL, 0, 0 };
+    loopi(b.nummeshes)
+    {
+        const BIH::mesh &m = b.meshes[i];
+        int numverts = 0;
+        loopj(m.numtris) loopk(3) numverts = max(numverts, m.tris[j].vert[k]+1);
+        int header[3] = { m.numtris, numverts, m.flags };
+        key.hash = bihhash(key.hash, header, sizeof(header));
+        key.hash = bihhash(key.hash, &m.xform, sizeof(m.xform));
+        key.hash = bihhash(key.hash, m.tris, m.numtris*sizeof(BIH::tri));
+        loopj(numverts) key.hash = bihhash(key.hash, m.pos + j*m.posstride, sizeof(vec));
+        key.numverts += numverts;
+        key.numindices += 3*m.numtris;
+    }
+    return key;
+}
+
+static const char *bihcachename(const bihcachekey &key, const char *ext = "bih")
+{
+    static thread_local string name;
+    formatstring(name, "cache/bih/%016llx-%d-%d.%s", key.hash, key.numverts, key.numindices, ext);
+    return name;
+}
+
+#define BIHCACHEVERSION 3
+
+static bool readbihcache(BIH &b, const bihcachekey &key)
+{
+    stream *f = openrawfile(bihcachename(key), "rb");
+    if(!f) return false;
+    char magic[4];
+    bool valid = false;
+    if(f->read(magic, 4) == 4 && !memcmp(magic, "BIHC", 4) && f->getlil<int>() == BIHCACHEVERSION)
+    {
+        bihcachekey filekey;
+        filekey.hash = f->getlil<ullong>();
+        filekey.numverts = f->getlil<int>();
+        filekey.numindices = f->getlil<int>();
+        valid = filekey == key && f->getlil<int>() == b.numtris && f->getlil<int>() == b.nummeshes;
+    }
+    if(valid)
+    {
+        int numnodes = f->getlil<int>(), numleaves = f->getlil<int>();
+        valid = numnodes > 0 && numnodes <= b.numtris + b.nummeshes && numleaves > 0 && numleaves <= b.numtris + b.nummeshes;
+        int totalnodes = 0, totalleaves = 0;
+        loopi(b.nummeshes)
+        {
+            BIH::mesh &m = b.meshes[i];
+            m.numnodes = f->getlil<int>();
+            m.numleaves = f->getlil<int>();
+            if(m.numnodes <= 0 || m.numleaves <= 0) valid = false;
+            totalnodes += m.numnodes;
+            totalleaves += m.numleaves;
+        }
+        if(valid && totalnodes == numnodes && totalleaves == numleaves)
+        {
+            b.nodes = new BIH::node[numnodes];
+            b.leaves = new BIH::leaf[numleaves];
+            if(f->read(b.nodes, numnodes*sizeof(BIH::node)) == numnodes*sizeof(BIH::node) &&
+               f->read(b.leaves, numleaves*sizeof(BIH::leaf)) == numleaves*sizeof(BIH::leaf))
+            {
+                b.numnodes = numnodes;
+                b.numleaves = numleaves;
+                loopi(numnodes) { lilswap(b.nodes[i].split, 2); lilswap(b.nodes[i].child, 2); }
+                lilswap((uint *)b.leaves, numleaves*sizeof(BIH::leaf)/sizeof(uint));
+                // a corrupt cache must not send traversal out of bounds
+                BIH::node *curnode = b.nodes;
+                BIH::leaf *curleaf = b.leaves;
+                loopi(b.nummeshes)
+                {
+                    BIH::mesh &m = b.meshes[i];
+                    m.nodes = curnode;
+                    m.leaves = curleaf;
+                    curnode += m.numnodes;
+                    curleaf += m.numleaves;
+                    loopj(m.numnodes) loopk(2)
+                    {
+                        int child = m.nodes[j].childindex(k);
+                        if(m.nodes[j].isleaf(k) ? child >= m.numleaves : child <= 0 || j + child >= m.numnodes) valid = false;
+                    }
+                    loopj(m.numleaves)
+                    {
+                        const BIH::leaf &l = m.leaves[j];
+                        if(l.numtris < 0 || l.numtris > BIH::LEAFTRIS) { valid = false; break; }
+                        loopk(l.numtris) if(l.tris[k] < 0 || l.tris[k] >= m.numtris) valid = false;
+                    }
+                }
+            }
+            else valid = false;
+            if(!valid)
+            {
+                DELETEA(b.nodes);
+                DELETEA(b.leaves);
+                b.numnodes = b.numleaves = 0;
+            }
+        }
+        else valid = false;
+    }
+    delete f;
+    if(!valid) loopi(b.nummeshes)
+    {
+        BIH::mesh &m = b.meshes[i];
+        m.nodes = NULL;
+        m.leaves = NULL;
+        m.numnodes = m.numleaves = 0;
+    }
+    return valid;
+}
+
+static void writebihcache(const BIH &b, const bihcachekey &key)
+{
+    // write under a temporary name and rename it into place, so an interrupted write or another
+    // instance loading the same model never sees a partial cache file
+    defformatstring(tmpext, "%lu.tmp", (unsigned long)SDL_ThreadID());
+    string tmpname, cachename;
+    copystring(tmpname, bihcachename(key, tmpext));
+    copystring(cachename, bihcachename(key));
+    path(tmpname);
+    path(cachename);
+    stream *f = openrawfile(tmpname, "wb");
+    if(!f) return;
+    bool ok = f->write("BIHC", 4) == 4;
+    ok &= f->putlil<int>(BIHCACHEVERSION);
+    ok &= f->putlil<ullong>(key.hash);
+    ok &= f->putlil<int>(key.numverts);
+    ok &= f->putlil<int>(key.numindices);
+    ok &= f->putlil<int>(b.numtris);
+    ok &= f->putlil<int>(b.nummeshes);
+    ok &= f->putlil<int>(b.numnodes);
+    ok &= f->putlil<int>(b.numleaves);
+    loopi(b.nummeshes)
+    {
+        ok &= f->putlil<int>(b.meshes[i].numnodes);
+        ok &= f->putlil<int>(b.meshes[i].numleaves);
+    }
+    loopi(b.numnodes)
+    {
+        BIH::node n = b.nodes[i];
+        lilswap(n.split, 2);
+        lilswap(n.child, 2);
+        ok &= f->write(&n, sizeof(n)) == sizeof(n);
+    }
+    loopi(b.numleaves)
+    {
+        BIH::leaf l = b.leaves[i];
+        lilswap((uint *)&l, sizeof(l)/sizeof(uint));
+        ok &= f->write(&l, sizeof(l)) == sizeof(l);
+    }
+    delete f;
+    string tmpfile;
+    copystring(tmpfile, findfile(tmpname, "wb"));
+    if(ok)
+    {
+        const char *cachefile = findfile(cachename, "wb");
+        remove(cachefile);
+        if(!rename(tmpfile, cachefile)) return;
+    }
+    remove(tmpfile);
+}
+
 BIH::BIH(vector<mesh> &buildmeshes)
-  : meshes(NULL), nummeshes(0), nodes(NULL), numnodes(0), tribbs(NULL), numtris(0), bbmin(1e16f, 1e16f, 1e16f), bbmax(-1e16f, -1e16f, -1e16f), center(0, 0, 0), radius(0), entradius(0)
+  : meshes(NULL), nummeshes(0), nodes(NULL), numnodes(0), leaves(NULL), numleaves(0), tribbs(NULL), numtris(0), bbmin(1e16f, 1e16f, 1e16f), bbmax(-1e16f, -1e16f, -1e16f), center(0, 0, 0), radius(0), entradius(0)
 {
     if(buildmeshes.empty()) return;
     loopv(buildmeshes) numtris += buildmeshes[i].numtris;
@@ -280,25 +623,57 @@ BIH::BIH(vector<mesh> &buildmeshes)
     radius = vec(bbmax).sub(bbmin).mul(0.5f).magnitude();
     entradius = max(bbmin.squaredlen(), bbmax.squaredlen());
 
-    nodes = new node[numtris];
+    bihcachekey key = { 0, 0, 0 };
+    if(bihcache)
+    {
+        key = bihcachehash(*this);
+        if(readbihcache(*this, key)) return;
+    }
+
+    // every leaf holds at least one triangle, except for the empty sibling of a mesh's only leaf
+    nodes = new node[numtris + nummeshes];
+    leaves = new leaf[numtris + nummeshes];
     node *curnode = nodes;
-    ushort *indices = new ushort[numtris];
+    leaf *curleaf = leaves;
+    uint *indices = new uint[numtris];
     loopi(nummeshes)
     {
         mesh &m = meshes[i];
         m.nodes = curnode;
+        m.leaves = curleaf;
         loopj(m.numtris) indices[j] = j;
         build(m, indices, m.numtris, ivec::floor(m.bbmin), ivec::ceil(m.bbmax));
         curnode += m.numnodes;
+        curleaf += m.numleaves;
     }
     delete[] indices;
     numnodes = int(curnode - nodes);
+    numleaves = int(curleaf - leaves);
+
+    // trim the worst case allocations down to what the build used
+    node *packednodes = new node[numnodes];
+    memcpy(packednodes, nodes, numnodes*sizeof(node));
+    leaf *packedleaves = new leaf[numleaves];
+    memcpy(packedleaves, leaves, numleaves*sizeof(leaf));
+    loopi(nummeshes)
+    {
+        mesh &m = meshes[i];
+        m.nodes = packednodes + (m.nodes - nodes);
+        m.leaves = packedleaves + (m.leaves - leaves);
+    }
+    delete[] nodes;
+    delete[] leaves;
+    nodes = packednodes;
+    leaves = packedleaves;
+
+    if(bihcache) writebihcache(*this, key);
 }
 
 BIH::~BIH()
 {
     delete[] meshes;
     delete[] nodes;
+    delete[] leaves;
     delete[] tribbs;
 }
 
@@ -484,10 +859,8 @@ static inline bool triboxoverlap(const vec &radius, const vec &a, const vec &b,
 }
 
 template<>
-inline void BIH::tricollide<COLLIDE_ELLIPSE>(const mesh &m, int tidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, const ivec &bo, const ivec &br)
+inline void BIH::tricollide<COLLIDE_ELLIPSE>(const mesh &m, int tidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist)
 {
-    if(m.tribbs[tidx].outside(bo, br)) return; 
-
     const tri &t = m.tris[tidx];
     vec a = m.getpos(t.vert[0]), b = m.getpos(t.vert[1]), c = m.getpos(t.vert[2]),
         zdir = vec(orient.rowz()).mul(m.invscale*m.invscale*(radius.z - radius.x));
@@ -517,10 +890,8 @@ inline void BIH::tricollide<COLLIDE_ELLIPSE>(const mesh &m, int tidx, physent *d
 }
 
 template<>
-inline void BIH::tricollide<COLLIDE_OBB>(const mesh &m, int tidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, const ivec &bo, const ivec &br)
+inline void BIH::tricollide<COLLIDE_OBB>(const mesh &m, int tidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist)
 {
-    if(m.tribbs[tidx].outside(bo, br)) return;
-
     const tri &t = m.tris[tidx];
     vec a = orient.transform(m.getpos(t.vert[0])), b = orient.transform(m.getpos(t.vert[1])), c = orient.transform(m.getpos(t.vert[2]));
     if(!triboxoverlap(radius, a, b, c)) return;
@@ -549,6 +920,14 @@ inline void BIH::tricollide<COLLIDE_OBB>(const mesh &m, int tidx, physent *d, co
     collidewall = n;
 }
 
+template<int C>
+inline void BIH::leafcollide(const mesh &m, int lidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, const ivec &bo, const ivec &br)
+{
+    const leaf &l = m.leaves[lidx];
+    int overlaps = leafoverlaps(m, l, bo, br);
+    loopi(l.numtris) if(overlaps&(1<<i)) tricollide<C>(m, l.tris[i], d, dir, cutoff, center, radius, orient, dist);
+}
+
 template<int C>
 inline void BIH::collide(const mesh &m, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, node *curnode, const ivec &bo, const ivec &br)
 {
@@ -571,12 +950,12 @@ inline void BIH::collide(const mesh &m, physent *d, const vec &dir, float cutoff
                     curnode += curnode->childindex(faridx);
                     continue;
                 }
-                else tricollide<C>(m, curnode->childindex(faridx), d, dir, cutoff, center, radius, orient, dist, bo, br);
+                else leafcollide<C>(m, curnode->childindex(faridx), d, dir, cutoff, center, radius, orient, dist, bo, br);
             }
         }
         else if(curnode->isleaf(nearidx))
         {
-            tricollide<C>(m, curnode->childindex(nearidx), d, dir, cutoff, center, radius, orient, dist, bo, br);
+            leafcollide<C>(m, curnode->childindex(nearidx), d, dir, cutoff, center, radius, orient, dist, bo, br);
             if(farsplit <= 0)
             {
                 if(!curnode->isleaf(faridx))
@@ -584,7 +963,7 @@ inline void BIH::collide(const mesh &m, physent *d, const vec &dir, float cutoff
                     curnode += curnode->childindex(faridx);
                     continue;
                 }
-                else tricollide<C>(m, curnode->childindex(faridx), d, dir, cutoff, center, radius, orient, dist, bo, br);
+                else leafcollide<C>(m, curnode->childindex(faridx), d, dir, cutoff, center, radius, orient, dist, bo, br);
             }
         }
         else
@@ -599,12 +978,12 @@ inline void BIH::collide(const mesh &m, physent *d, const vec &dir, float cutoff
                     }
                     else
                     {
-                        collide<C>(m, d, dir, cutoff, center, radius, orient, dist, &nodes[curnode->childindex(nearidx)], bo, br);
+                        collide<C>(m, d, dir, cutoff, center, radius, orient, dist, curnode + curnode->childindex(nearidx), bo, br);
                         curnode += curnode->childindex(faridx);
                         continue;
                     }
                 }
-                else tricollide<C>(m, curnode->childindex(faridx), d, dir, cutoff, center, radius, orient, dist, bo, br);
+                else leafcollide<C>(m, curnode->childindex(faridx), d, dir, cutoff, center, radius, orient, dist, bo, br);
             }
             curnode += curnode->childindex(nearidx);
             continue;
@@ -697,10 +1076,8 @@ bool BIH::boxcollide(physent *d, const vec &dir, float cutoff, const vec &o, int
     return false;
 }
 
-inline void BIH::genstaintris(stainrenderer *s, const mesh &m, int tidx, const vec &center, float radius, const matrix4x3 &orient, const ivec &bo, const ivec &br)
+inline void BIH::genstaintris(stainrenderer *s, const mesh &m, int tidx, const vec &center, float radius, const matrix4x3 &orient)
 {
-    if(m.tribbs[tidx].outside(bo, br)) return;
-
     const tri &t = m.tris[tidx];
     vec v[3] =
     {
@@ -712,6 +1089,13 @@ inline void BIH::genstaintris(stainrenderer *s, const mesh &m, int tidx, const v
     genstainmmtri(s, v);
 }
 
+inline void BIH::genstainleaf(stainrenderer *s, const mesh &m, int lidx, const vec &center, float radius, const matrix4x3 &orient, const ivec &bo, const ivec &br)
+{
+    const leaf &l = m.leaves[lidx];
+    int overlaps = leafoverlaps(m, l, bo, br);
+    loopi(l.numtris) if(overlaps&(1<<i)) genstaintris(s, m, l.tris[i], center, radius, orient);
+}
+
 void BIH::genstaintris(stainrenderer *s, const mesh &m, const vec &center, float radius, const matrix4x3 &orient, node *curnode, const ivec &bo, const ivec &br)
 {
     node *stack[128];
@@ -733,12 +1117,12 @@ void BIH::genstaintris(stainrenderer *s, const mesh &m, const vec &center, float
                     curnode += curnode->childindex(faridx);
                     continue;
                 }
-                else genstaintris(s, m, curnode->childindex(faridx), center, radius, orient, bo, br);
+                else genstainleaf(s, m, curnode->childindex(faridx), center, radius, orient, bo, br);
             }
         }
         else if(curnode->isleaf(nearidx))
         {
-            genstaintris(s, m, curnode->childindex(nearidx), center, radius, orient, bo, br);
+            genstainleaf(s, m, curnode->childindex(nearidx), center, radius, orient, bo, br);
             if(farsplit <= 0)
             {
                 if(!curnode->isleaf(faridx))
@@ -746,7 +1130,7 @@ void BIH::genstaintris(stainrenderer *s, const mesh &m, const vec &center, float
                     curnode += curnode->childindex(faridx);
                     continue;
                 }
-                else genstaintris(s, m, curnode->childindex(faridx), center, radius, orient, bo, br);
+                else genstainleaf(s, m, curnode->childindex(faridx), center, radius, orient, bo, br);
             }
         }
         else
@@ -761,12 +1145,12 @@ void BIH::genstaintris(stainrenderer *s, const mesh &m, const vec &center, float
                     }
                     else
                     {
-                        genstaintris(s, m, center, radius, orient, &nodes[curnode->childindex(nearidx)], bo, br);
+                        genstaintris(s, m, center, radius, orient, curnode + curnode->childindex(nearidx), bo, br);
                         curnode += curnode->childindex(faridx);
                         continue;
                     }
                 }
-                else genstaintris(s, m, curnode->childindex(faridx), center, radius, orient, bo, br);
+                else genstainleaf(s, m, curnode->childindex(faridx), center, radius, orient, bo, br);
             }
             curnode += curnode->childindex(nearidx);
             continue;
@@ -811,3 +1195,76 @@ void BIH::genstaintris(stainrenderer *s, const vec &staincenter, float stainradi
     }
 }
 
+
+// tests the ray against every triangle without the tree, as a reference for bihbench
+static bool bihbruteforce(BIH &b, const vec &o, const vec &ray, float maxdist, float &dist, int mode)
+{
+    loopi(b.nummeshes)
+    {
+        const BIH::mesh &m = b.meshes[i];
+        if(!(m.flags&BIH::MESH_RENDER) || (!(mode&RAY_SHADOW) && m.flags&BIH::MESH_NOCLIP)) continue;
+        vec mo = m.invxform.transform(o), mray = m.invxformnorm.transform(ray);
+        loopj(m.numtris) if(b.triintersect(m, j, mo, mray, maxdist, dist, mode)) return true;
+    }
+    return false;
+}
+
+// times building the model's BIH and then casting rays at it and colliding a player sized box and ellipse against it,
+// and checks the rays' hits against testing every triangle
+void bihbench(const char *name, int *numqueries)
+{
+    model *m = loadmodel(name);
+    if(!m) { conoutf(CON_ERROR, "could not load model: %s", name); return; }
+    int n = clamp(*numqueries > 0 ? *numqueries : 100000, 1, 1<<24);
+    DELETEP(m->bih);
+    Uint64 start = SDL_GetPerformanceCounter();
+    BIH *b = m->setBIH();
+    Uint64 built = SDL_GetPerformanceCounter();
+    if(!b || !b->numnodes) { conoutf(CON_ERROR, "model has no collision mesh: %s", name); return; }
+
+    vector<vec> origins, rays;
+    loopi(n)
+    {
+        vec dir(rndscale(2)-1, rndscale(2)-1, rndscale(2)-1);
+        if(dir.iszero()) dir = vec(0, 0, 1);
+        dir.normalize();
+        origins.add(vec(dir).mul(b->radius*1.5f).add(b->center));
+        vec target(b->center.x + (rndscale(2)-1)*b->radius, b->center.y + (rndscale(2)-1)*b->radius, b->center.z + (rndscale(2)-1)*b->radius);
+        rays.add(target.sub(origins.last()).normalize());
+    }
+    int hits = 0;
+    Uint64 raystart = SDL_GetPerformanceCounter();
+    loopi(n)
+    {
+        float dist;
+        if(b->traverse(origins[i], rays[i], 1e16f, dist, RAY_CLIPMAT|RAY_POLY)) hits++;
+    }
+    Uint64 rayend = SDL_GetPerformanceCounter();
+
+    int checked = min(n, 10000), mismatches = 0;
+    loopi(checked)
+    {
+        float dist;
+        if(b->traverse(origins[i], rays[i], 1e16f, dist, RAY_CLIPMAT|RAY_POLY) != bihbruteforce(*b, origins[i], rays[i], 1e16f, dist, RAY_CLIPMAT|RAY_POLY)) mismatches++;
+    }
+
+    physent d;
+    d.type = ENT_PLAYER;
+    int collisions = 0;
+    Uint64 collidestart = SDL_GetPerformanceCounter();
+    loopi(n)
+    {
+        d.o = vec(rays[i]).mul(rndscale(2*b->radius)).add(origins[i]);
+        if(b->ellipsecollide(&d, rays[i], 0, vec(0, 0, 0), 0, 0, 0)) collisions++;
+        if(b->boxcollide(&d, rays[i], 0, vec(0, 0, 0), 0, 0, 0)) collisions++;
+    }
+    Uint64 collideend = SDL_GetPerformanceCounter();
+
+    double freq = SDL_GetPerformanceFrequency();
+    conoutf("bihbench: %s: %d tris, %d nodes, %d leaves, built in %.2f ms", name, b->numtris, b->numnodes, b->numleaves, (built - start)*1000/freq);
+    conoutf("bihbench: %d rays (%d hits) at %.2f Mrays/s, %d collisions (%d hits) at %.2f Mqueries/s",
+        n, hits, n/((rayend - raystart)/freq)/1e6, 2*n, collisions, 2*n/((collideend - collidestart)/freq)/1e6);
+    if(mismatches) conoutf(CON_ERROR, "bihbench: %d of %d rays disagree with testing every triangle", mismatches, checked);
+    else conoutf("bihbench: %d rays agree with testing every triangle", checked);
+}
+COMMAND(bihbench, "si");
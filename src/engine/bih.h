@@ -2,14 +2,23 @@ struct stainrenderer;
 
 struct BIH
 {
+    enum { LEAFTRIS = 4 };
+
     struct node
     {
         short split[2];
-        ushort child[2];
+        uint child[2];
 
-        int axis() const { return child[0]>>14; }
-        int childindex(int which) const { return child[which]&0x3FFF; }
-        bool isleaf(int which) const { return (child[1]&(1<<(14+which)))!=0; }
+        int axis() const { return child[0]>>30; }
+        int childindex(int which) const { return child[which]&0x3FFFFFFF; }
+        bool isleaf(int which) const { return (child[1]&(1<<(30+which)))!=0; }
+    };
+
+    // leaves list up to LEAFTRIS triangles of their mesh, which are tested together straight
+    // from the mesh's shared vertex and triangle arrays
+    struct leaf
+    {
+        int tris[LEAFTRIS], numtris;
     };
 
     struct tri
@@ -38,6 +47,8 @@ struct BIH
         float scale, invscale;
         node *nodes;
         int numnodes;
+        leaf *leaves;
+        int numleaves;
         const tri *tris;
         const tribb *tribbs;
         int numtris;
@@ -47,7 +58,7 @@ struct BIH
         int flags;
         vec bbmin, bbmax;
 
-        mesh() : numnodes(0), numtris(0), tex(NULL), flags(0) {}
+        mesh() : numnodes(0), numleaves(0), numtris(0), tex(NULL), flags(0) {}
 
         vec getpos(int i) const { return *(const vec *)(pos + i*posstride); }
         vec2 gettc(int i) const { return *(const vec2 *)(tc + i*tcstride); }
@@ -57,6 +68,8 @@ struct BIH
     int nummeshes;
     node *nodes;
     int numnodes;
+    leaf *leaves;
+    int numleaves;
     tribb *tribbs;
     int numtris;
     vec bbmin, bbmax, center;
@@ -66,11 +79,13 @@ struct BIH
 
     ~BIH();
 
-    void build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax);
+    int buildleaf(mesh &m, const uint *indices, int numindices);
+    void build(mesh &m, uint *indices, int numindices, const ivec &vmin, const ivec &vmax);
 
     bool traverse(const vec &o, const vec &ray, float maxdist, float &dist, int mode);
     bool traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax);
     bool triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode);
+    bool leafintersect(const mesh &m, int lidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode);
 
     bool boxcollide(physent *d, const vec &dir, float cutoff, const vec &o, int yaw, int pitch, int roll, float scale = 1);
     bool ellipsecollide(physent *d, const vec &dir, float cutoff, const vec &o, int yaw, int pitch, int roll, float scale = 1);
@@ -78,11 +93,14 @@ struct BIH
     template<int C>
     void collide(const mesh &m, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, node *curnode, const ivec &bo, const ivec &br);
     template<int C>
-    void tricollide(const mesh &m, int tidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, const ivec &bo, const ivec &br);
+    void tricollide(const mesh &m, int tidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist);
+    template<int C>
+    void leafcollide(const mesh &m, int lidx, physent *d, const vec &dir, float cutoff, const vec &center, const vec &radius, const matrix4x3 &orient, float &dist, const ivec &bo, const ivec &br);
 
     void genstaintris(stainrenderer *s, const vec &staincenter, float stainradius, const vec &o, int yaw, int pitch, int roll, float scale = 1);
     void genstaintris(stainrenderer *s, const mesh &m, const vec &center, float radius, const matrix4x3 &orient, node *curnode, const ivec &bo, const ivec &br);
-    void genstaintris(stainrenderer *s, const mesh &m, int tidx, const vec &center, float radius, const matrix4x3 &orient, const ivec &bo, const ivec &br);
+    void genstaintris(stainrenderer *s, const mesh &m, int tidx, const vec &center, float radius, const matrix4x3 &orient);
+    void genstainleaf(stainrenderer *s, const mesh &m, int lidx, const vec &center, float radius, const matrix4x3 &orient, const ivec &bo, const ivec &br);
  
     void preload();
 };
@@ -1,5 +1,10 @@
 #include "engine.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLENDSSE2
+#endif
+
 enum
 {
     BM_BRANCH = 0,
@@ -52,6 +57,83 @@ struct BlendMapImage
     uchar data[BM_IMAGE_SIZE*BM_IMAGE_SIZE];
 };
 
+// row kernels for the blend map images, 16 pixels at a time where SSE2 is available
+
+static inline bool uniformblendrow(const uchar *src, int n, uchar val)
+{
+    int i = 0;
+#ifdef BLENDSSE2
+    const __m128i v = _mm_set1_epi8(val);
+    for(; i + 16 <= n; i += 16)
+        if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&src[i]), v)) != 0xFFFF) return false;
+#endif
+    for(; i < n; i++) if(src[i] != val) return false;
+    return true;
+}
+
+static inline void invertblendrow(uchar *dst, int n)
+{
+    int i = 0;
+#ifdef BLENDSSE2
+    const __m128i ones = _mm_set1_epi8(-1);
+    for(; i + 16 <= n; i += 16)
+        _mm_storeu_si128((__m128i *)&dst[i], _mm_xor_si128(_mm_loadu_si128((const __m128i *)&dst[i]), ones));
+#endif
+    for(; i < n; i++) dst[i] = 255-dst[i];
+}
+
+// modes 2 and 3 take the min/max with the source, 4 and 5 the same with the inverted source
+static inline void blitblendrow(uchar *dst, const uchar *src, int n, int smode)
+{
+    if(smode == 1) { memcpy(dst, src, n); return; }
+    int i = 0;
+#ifdef BLENDSSE2
+    const __m128i invert = _mm_set1_epi8(smode >= 4 ? -1 : 0);
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i *)&dst[i]),
+                v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&src[i]), invert);
+        _mm_storeu_si128((__m128i *)&dst[i], smode&1 ? _mm_max_epu8(d, v) : _mm_min_epu8(d, v));
+    }
+#endif
+    switch(smode)
+    {
+        case 2: for(; i < n; i++) dst[i] = min(dst[i], src[i]); break;
+        case 3: for(; i < n; i++) dst[i] = max(dst[i], src[i]); break;
+        case 4: for(; i < n; i++) dst[i] = min(dst[i], uchar(0xFF - src[i])); break;
+        case 5: for(; i < n; i++) dst[i] = max(dst[i], uchar(0xFF - src[i])); break;
+    }
+}
+
+// takes every step'th pixel of the row, as blend textures are rendered at a power of two fraction of the blend map
+static inline void downsampleblendrow(uchar *dst, const uchar *src, int n, int step)
+{
+    if(step <= 1) { memcpy(dst, src, n); return; }
+    int i = 0;
+#ifdef BLENDSSE2
+    if(step == 2)
+    {
+        const __m128i lo = _mm_set1_epi16(0xFF);
+        for(; i + 16 <= n; i += 16)
+            _mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(_mm_and_si128(_mm_loadu_si128((const __m128i *)&src[2*i]), lo),
+                                                                  _mm_and_si128(_mm_loadu_si128((const __m128i *)&src[2*i+16]), lo)));
+    }
+    else if(step == 4)
+    {
+        const __m128i lo = _mm_set1_epi32(0xFF);
+        for(; i + 16 <= n; i += 16)
+        {
+            __m128i a = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i *)&src[4*i]), lo),
+                                        _mm_and_si128(_mm_loadu_si128((const __m128i *)&src[4*i+16]), lo)),
+                    b = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128((const __m128i *)&src[4*i+32]), lo),
+                                        _mm_and_si128(_mm_loadu_si128((const __m128i *)&src[4*i+48]), lo));
+            _mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(a, b));
+        }
+    }
+#endif
+    for(int k = i*step; i < n; i++, k += step) dst[i] = src[k];
+}
+
 void BlendMapNode::cleanup(int type)
 {
     switch(type)
@@ -119,6 +201,13 @@ struct BlendMapCache
     BlendMapRoot node;
     int scale;
     ivec2 origin;
+    // the last leaf found below node, since neighbouring lookups mostly land in the same one
+    uchar leaftype;
+    BlendMapNode leaf;
+    int leafsize;
+    ivec2 leaforigin;
+
+    BlendMapCache() : leafsize(0) {}
 };
 
 BlendMapCache *newblendmapcache() { return new BlendMapCache; }
@@ -127,6 +216,7 @@ void freeblendmapcache(BlendMapCache *&cache) { delete cache; cache = NULL; }
 
 bool setblendmaporigin(BlendMapCache *cache, const ivec &o, int size)
 {
+    cache->leafsize = 0;
     if(blendmap.type!=BM_BRANCH)
     {
         cache->node = blendmap;
@@ -168,19 +258,29 @@ bool hasblendmap(BlendMapCache *cache)
     return cache->node.solid!=&bmsolids[0xFF];
 }
 
-static uchar lookupblendmap(int x, int y, BlendMapBranch *bm, int bmscale)
+static uchar lookupblendmap(BlendMapCache *cache, int x, int y)
 {
-    for(;;)
+    if(uint(x - cache->leaforigin.x) >= uint(cache->leafsize) || uint(y - cache->leaforigin.y) >= uint(cache->leafsize))
     {
-        bmscale--;
-        int n = (((y>>bmscale)&1)<<1) | ((x>>bmscale)&1);
-        switch(bm->type[n])
+        BlendMapBranch *bm = cache->node.branch;
+        int bmscale = cache->scale;
+        for(;;)
         {
-            case BM_SOLID: return bm->children[n].solid->val;
-            case BM_IMAGE: return bm->children[n].image->data[(y&((1<<bmscale)-1))*BM_IMAGE_SIZE + (x&((1<<bmscale)-1))];
+            bmscale--;
+            int n = (((y>>bmscale)&1)<<1) | ((x>>bmscale)&1);
+            if(bm->type[n]!=BM_BRANCH)
+            {
+                cache->leaftype = bm->type[n];
+                cache->leaf = bm->children[n];
+                cache->leafsize = 1<<bmscale;
+                cache->leaforigin = ivec2(x&(~0U<<bmscale), y&(~0U<<bmscale));
+                break;
+            }
+            bm = bm->children[n].branch;
         }
-        bm = bm->children[n].branch;
     }
+    if(cache->leaftype==BM_SOLID) return cache->leaf.solid->val;
+    return cache->leaf.image->data[(y - cache->leaforigin.y)*BM_IMAGE_SIZE + (x - cache->leaforigin.x)];
 }
 
 uchar lookupblendmap(BlendMapCache *cache, const vec &pos)
@@ -196,7 +296,7 @@ uchar lookupblendmap(BlendMapCache *cache, const vec &pos)
         int cx = clamp(rx+vx, 0, (1<<cache->scale)-1), cy = clamp(ry+vy, 0, (1<<cache->scale)-1);
         if(cache->node.type==BM_IMAGE)
             *val++ = cache->node.image->data[cy*BM_IMAGE_SIZE + cx];
-        else *val++ = lookupblendmap(cx, cy, cache->node.branch, cache->scale);
+        else *val++ = lookupblendmap(cache, cx, cy);
     }
     float fx = bx - ix, fy = by - iy;
     return uchar((1-fy)*((1-fx)*vals[0] + fx*vals[1]) +
@@ -302,7 +402,7 @@ static void invertblendmap(uchar &type, BlendMapNode &node, int size, int x1, in
         uchar *dst = &node.image->data[y1*BM_IMAGE_SIZE + x1];
         loopi(y2-y1)
         {
-            loopj(x2-x1) dst[j] = 255-dst[j];
+            invertblendrow(dst, x2-x1);
             dst += BM_IMAGE_SIZE;
         }
     }
@@ -399,28 +499,7 @@ static void blitblendmap(uchar &type, BlendMapNode &node, int bmx, int bmy, int
     src += max(bmy - sy, 0)*sw + max(bmx - sx, 0);
     loopi(y2-y1)
     {
-        switch(smode)
-        {
-            case 1:
-                memcpy(dst, src, x2 - x1);
-                break;
-
-            case 2:
-                loopi(x2 - x1) dst[i] = min(dst[i], src[i]);
-                break;
-
-            case 3:
-                loopi(x2 - x1) dst[i] = max(dst[i], src[i]);
-                break;
-
-            case 4:
-                loopi(x2 - x1) dst[i] = min(dst[i], uchar(0xFF - src[i]));
-                break;
-
-            case 5:
-                loopi(x2 - x1) dst[i] = max(dst[i], uchar(0xFF - src[i]));
-                break;
-        }
+        blitblendrow(dst, src, x2 - x1, smode);
         dst += BM_IMAGE_SIZE;
         src += sw;
     }
@@ -505,7 +584,7 @@ static int calcblendlayer(uchar &type, BlendMapNode &node, int bmx, int bmy, int
         val = src[0];
         loopi(y2-y1)
         {
-            loopj(x2-x1) if(src[j] != val) return LAYER_BLEND;
+            if(!uniformblendrow(src, x2-x1, val)) return LAYER_BLEND;
             src += BM_IMAGE_SIZE;
         }
     }
@@ -725,8 +804,7 @@ static void renderblendtexture(uchar &type, BlendMapNode &node, int bmx, int bmy
         uchar *src = &node.image->data[y1*BM_IMAGE_SIZE + x1];
         loopi(steph)
         {
-            if(step <= 1) memcpy(dst, src, stepw);
-            else for(int j = 0, k = 0; j < stepw; j++, k += step) dst[j] = src[k];
+            downsampleblendrow(dst, src, stepw, step);
             src += step*BM_IMAGE_SIZE;
             dst += dsize;
         }
@@ -830,14 +908,15 @@ static void updateblendtextures(uchar &type, BlendMapNode &node, int bmx, int bm
         int tsize = 1<<(min(worldscale, 12)-BM_SCALE),
             ux1 = tx, ux2 = tx + tsize, uy1 = ty, uy2 = ty + tsize,
             step = tsize/bt->size;
-        if(!bt->valid)
+        // a texture that already holds the blend map only needs the changed area redrawn, a new one all of it
+        if(bt->valid)
         {
             ux1 = max(ux1, ux&~(step-1));
             ux2 = min(ux2, (ux+uw+step-1)&~(step-1));
             uy1 = max(uy1, uy&~(step-1));
             uy2 = min(uy2, (uy+uh+step-1)&~(step-1));
-            bt->valid = true;
         }
+        else bt->valid = true;
         uchar *data = bt->data + (uy1-ty)/step*bt->size + (ux1-tx)/step;
         renderblendtexture(type, node, bmx, bmy, bmsize, data, bt->size, ux1, uy1, ux2-ux1, uy2-uy1);
         glPixelStorei(GL_UNPACK_ROW_LENGTH, bt->size);
@@ -28,6 +28,13 @@ void conline(int type, const char *sf)        // add a line to the console buffe
 
 void conoutfv(int type, const char *fmt, va_list args)
 {
+    if(!ismainthread())
+    {
+        char line[CONSTRLEN];
+        vformatstring(line, fmt, args, sizeof(line));
+        deferconsole(type, line);
+        return;
+    }
     static char buf[CONSTRLEN];
     vformatstring(buf, fmt, args, sizeof(buf));
     conline(type, buf);
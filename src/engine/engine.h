@@ -4,6 +4,10 @@
 #include "cube.h"
 #include "world.h"
 
+// octaio
+extern void fixent(entity &e, int version);
+extern bool loadmapheader(stream *f, const char *ogzname, mapheader &hdr, octaheader &ohdr);
+
 #ifndef STANDALONE
 
 #include "octa.h"
@@ -70,6 +74,7 @@ static inline void setfont(font *f) { if(f) curfont = f; }
 extern int hwtexsize, hwcubetexsize, hwmaxaniso, maxtexsize, hwtexunits, hwvtexunits;
 
 extern Texture *textureload(const char *name, int clamp = 0, bool mipit = true, bool msg = true);
+extern Texture *preloadtexture(const char *name, int clamp = 0, bool mipit = true);
 extern int texalign(const void *data, int w, int bpp);
 extern bool floatformat(GLenum format);
 extern void cleanuptexture(Texture *t);
@@ -113,6 +118,7 @@ extern void setviewcell(const vec &p);
 extern void savepvs(stream *f);
 extern void loadpvs(stream *f, int numpvs);
 extern int getnumviewcells();
+extern void pvschanged(const ivec &bbmin, const ivec &bbmax);
 
 static inline bool pvsoccluded(const ivec &bborigin, int size)
 {
@@ -203,13 +209,16 @@ extern int familysize(const cube &c);
 extern void freeocta(cube *c);
 extern void discardchildren(cube &c, bool fixtex = false, int depth = 0);
 extern void optiface(uchar *p, cube &c);
-extern void validatec(cube *c, int size = 0);
+extern int validatec(cube *c, int size = 0);
 extern bool isvalidcube(const cube &c);
+extern void clearmaterialgrid();
+extern void genmaterialgrid();
+extern void updatematerialgrid(const ivec &bbmin, const ivec &bbmax);
 extern ivec lu;
 extern int lusize;
 extern cube &lookupcube(const ivec &to, int tsize = 0, ivec &ro = lu, int &rsize = lusize);
-extern const cube *neighbourstack[32];
-extern int neighbourdepth;
+extern thread_local const cube *neighbourstack[32];
+extern thread_local int neighbourdepth;
 extern const cube &neighbourcube(const cube &c, int orient, const ivec &co, int size, ivec &ro = lu, int &rsize = lusize);
 extern void resetclipplanes();
 extern int getmippedtexture(const cube &p, int orient);
@@ -238,7 +247,9 @@ extern void invalidatemerges(cube &c, const ivec &co, int size, bool msg);
 extern void calcmerges();
 extern int mergefaces(int orient, facebounds *m, int sz);
 extern void mincubeface(const cube &cu, int orient, const ivec &o, int size, const facebounds &orig, facebounds &cf, ushort nmat = MAT_AIR, ushort matmask = MATF_VOLUME);
-extern void remip();
+extern void remipchanged(const ivec &bbmin, const ivec &bbmax);
+extern void clearremipchanges();
+extern void remip(bool incremental = false);
 
 static inline cubeext &ext(cube &c)
 {
@@ -632,6 +643,27 @@ enum { TI_CONSOLE = 1<<0, TI_GUI = 1<<1 };
 
 extern void textinput(bool on, int mask = ~0);
 
+// jobs
+typedef void (*jobfunc)(void *data);
+
+struct jobgroup
+{
+    int queued, finished;
+
+    jobgroup() : queued(0), finished(0) {}
+
+    int pending() const { return queued - finished; }
+};
+
+extern bool ismainthread();
+extern void initjobs();
+extern void cleanupjobs();
+extern void addjob(jobfunc work, jobfunc finish, void *data, jobgroup *group = NULL, bool urgent = false);
+extern void processjobs();
+extern void waitjobs(jobgroup *group = NULL, const char *progress = NULL, jobfunc poll = NULL);
+extern void countallocs(uint &allocs, size_t &bytes);
+extern void deferconsole(int type, const char *line);
+
 // physics
 extern void modifyorient(float yaw, float pitch);
 extern void mousemove(int dx, int dy);
@@ -639,6 +671,8 @@ extern bool pointincube(const clipplanes &p, const vec &v);
 extern bool overlapsdynent(const vec &o, float radius);
 extern void rotatebb(vec &center, vec &radius, int yaw, int pitch, int roll = 0);
 extern float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity *t = NULL);
+extern void physicstrigger(physent *d, bool local, int floorlevel, int waterlevel, int material = 0);
+extern void resetcollidemodels();
 
 // world
 
@@ -653,6 +687,14 @@ extern bool pointinsel(const selinfo &sel, const vec &o);
 extern void resetmap();
 extern void startmap(const char *name);
 
+// worldio
+extern void startloadphase(const char *name, stream *f = NULL);
+
+// octaio
+extern void saveoctree(stream *f, bool nolms = false);
+extern cube *loadoctree(stream *f, int size, bool &failed);
+extern void skiplightmaps(stream *f, int numlightmaps);
+
 // rendermodel
 struct mapmodelinfo { string name; model *m, *collide; };
 
@@ -0,0 +1,262 @@
+// jobs.cpp: background worker threads for asset loading and other deferrable work
+// jobs are queued from the main thread, their work function runs on a worker and
+// their finish function runs back on the main thread from processjobs()/waitjobs()
+
+#include "engine.h"
+
+struct job
+{
+    jobfunc work, finish;
+    void *data;
+    jobgroup *group;
+};
+
+static SDL_mutex *joblock = NULL;
+static SDL_cond *jobcond = NULL, *donecond = NULL;
+static vector<SDL_Thread *> jobworkers;
+static vector<job> queuedjobs, donejobs;
+static int queuedhead = 0, numpending = 0;
+static bool jobsquit = false;
+static SDL_threadID mainthreadid = 0;
+static uint joballocs = 0;
+static size_t joballocbytes = 0;
+
+struct deferredline
+{
+    int type;
+    char *line;
+};
+static vector<deferredline> deferredlines;
+
+bool ismainthread()
+{
+    return !mainthreadid || SDL_ThreadID() == mainthreadid;
+}
+
+// takes the oldest queued job, or the oldest one of the group if given
+static bool popjob(job &j, jobgroup *group = NULL)
+{
+    int i = queuedhead;
+    if(group) while(i < queuedjobs.length() && queuedjobs[i].group != group) i++;
+    if(i >= queuedjobs.length()) return false;
+    j = queuedjobs[i];
+    if(i == queuedhead) queuedhead++;
+    else queuedjobs.remove(i);
+    if(queuedhead >= queuedjobs.length()) { queuedjobs.setsize(0); queuedhead = 0; }
+    return true;
+}
+
+static int jobworker(void *data)
+{
+    SDL_LockMutex(joblock);
+    for(;;)
+    {
+        job j;
+        if(!popjob(j))
+        {
+            if(jobsquit) break;
+            SDL_CondWait(jobcond, joblock);
+            continue;
+        }
+        SDL_UnlockMutex(joblock);
+        if(j.work) j.work(j.data);
+        SDL_LockMutex(joblock);
+        // hand the worker's allocation counts over before the job is seen as done
+        joballocs += numallocs;
+        joballocbytes += numallocbytes;
+        numallocs = 0;
+        numallocbytes = 0;
+        donejobs.add(j);
+        SDL_CondSignal(donecond);
+    }
+    SDL_UnlockMutex(joblock);
+    return 0;
+}
+
+// allocations made so far by the main thread and every job that has completed on the workers
+void countallocs(uint &allocs, size_t &bytes)
+{
+    allocs = numallocs;
+    bytes = numallocbytes;
+    if(!joblock) return;
+    SDL_LockMutex(joblock);
+    allocs += joballocs;
+    bytes += joballocbytes;
+    SDL_UnlockMutex(joblock);
+}
+
+static void startjobworkers()
+{
+    extern int jobthreads;
+    int numthreads = jobthreads > 0 ? jobthreads : max(numcpus-1, 1);
+    jobsquit = false;
+    loopi(numthreads)
+    {
+        SDL_Thread *thread = SDL_CreateThread(jobworker, "job worker", NULL);
+        if(thread) jobworkers.add(thread);
+    }
+}
+
+static void stopjobworkers()
+{
+    if(jobworkers.empty()) return;
+    SDL_LockMutex(joblock);
+    jobsquit = true;
+    SDL_CondBroadcast(jobcond);
+    SDL_UnlockMutex(joblock);
+    loopv(jobworkers) SDL_WaitThread(jobworkers[i], NULL);
+    jobworkers.setsize(0);
+    jobsquit = false;
+}
+
+VARF(jobthreads, 0, 0, 16,
+{
+    if(!joblock) return;
+    waitjobs();
+    stopjobworkers();
+    startjobworkers();
+});
+
+void initjobs()
+{
+    if(joblock) return;
+    mainthreadid = SDL_ThreadID();
+    joblock = SDL_CreateMutex();
+    jobcond = SDL_CreateCond();
+    donecond = SDL_CreateCond();
+    startjobworkers();
+}
+
+void cleanupjobs()
+{
+    if(!joblock || !ismainthread()) return;
+    waitjobs();
+    stopjobworkers();
+    SDL_DestroyCond(donecond);
+    SDL_DestroyCond(jobcond);
+    SDL_DestroyMutex(joblock);
+    donecond = jobcond = NULL;
+    joblock = NULL;
+}
+
+// urgent jobs skip ahead of queued background loads since the main thread is about to wait on them
+void addjob(jobfunc work, jobfunc finish, void *data, jobgroup *group, bool urgent)
+{
+    if(!joblock || !ismainthread())
+    {
+        if(work) work(data);
+        if(finish) finish(data);
+        return;
+    }
+    numpending++;
+    if(group) group->queued++;
+    SDL_LockMutex(joblock);
+    job j;
+    j.work = work;
+    j.finish = finish;
+    j.data = data;
+    j.group = group;
+    if(urgent) queuedjobs.insert(queuedhead, j);
+    else queuedjobs.add(j);
+    SDL_CondSignal(jobcond);
+    SDL_UnlockMutex(joblock);
+}
+
+void deferconsole(int type, const char *line)
+{
+    if(!joblock) return;
+    SDL_LockMutex(joblock);
+    deferredline &d = deferredlines.add();
+    d.type = type;
+    d.line = newstring(line);
+    SDL_UnlockMutex(joblock);
+}
+
+static void flushconsole()
+{
+    vector<deferredline> lines;
+    SDL_LockMutex(joblock);
+    lines.move(deferredlines);
+    SDL_UnlockMutex(joblock);
+    loopv(lines)
+    {
+        conoutf(lines[i].type, "%s", lines[i].line);
+        delete[] lines[i].line;
+    }
+}
+
+static int finishjobs()
+{
+    vector<job> finished;
+    SDL_LockMutex(joblock);
+    finished.move(donejobs);
+    SDL_UnlockMutex(joblock);
+    if(deferredlines.length()) flushconsole();
+    loopv(finished)
+    {
+        job &j = finished[i];
+        if(j.finish) j.finish(j.data);
+        if(j.group) j.group->finished++;
+        numpending--;
+    }
+    return finished.length();
+}
+
+// without any worker threads, queued work is run here at one job per call so that async
+// loads still trickle in instead of stalling the frame
+void processjobs()
+{
+    if(!joblock || !numpending) return;
+    if(jobworkers.empty())
+    {
+        job j;
+        SDL_LockMutex(joblock);
+        bool found = popjob(j);
+        SDL_UnlockMutex(joblock);
+        if(found)
+        {
+            if(j.work) j.work(j.data);
+            SDL_LockMutex(joblock);
+            donejobs.add(j);
+            SDL_UnlockMutex(joblock);
+        }
+    }
+    finishjobs();
+}
+
+// waits for every job of the group (or all jobs if none) while running the group's queued work on
+// the main thread as well, showing load progress if given a caption. Other groups' jobs, such as
+// long background decodes, are left to the workers so they do not stall the wait. A poll function
+// is called at least every POLLJOBSMILLIS while waiting, for callers with their own progress display
+#define POLLJOBSMILLIS 100
+
+void waitjobs(jobgroup *group, const char *progress, jobfunc poll)
+{
+    if(!joblock || !ismainthread()) return;
+    int total = group ? group->pending() : numpending;
+    if(progress && total) renderprogress(0, progress);
+    for(;;)
+    {
+        int finished = finishjobs();
+        int remaining = group ? group->pending() : numpending;
+        if(!remaining) break;
+        if(progress && finished) renderprogress(float(total - min(remaining, total))/total, progress);
+
+        job j;
+        SDL_LockMutex(joblock);
+        if(popjob(j, group))
+        {
+            SDL_UnlockMutex(joblock);
+            if(j.work) j.work(j.data);
+            SDL_LockMutex(joblock);
+            donejobs.add(j);
+        }
+        else if(donejobs.empty())
+        {
+            if(poll) SDL_CondWaitTimeout(donecond, joblock, POLLJOBSMILLIS);
+            else SDL_CondWait(donecond, joblock);
+        }
+        SDL_UnlockMutex(joblock);
+        if(poll) poll(NULL);
+    }
+}
@@ -330,7 +330,7 @@ const vector<int> &checklightcache(int x, int y)
     return lce.lights;
 }
 
-static uint lightprogress = 0;
+static SDL_atomic_t lightprogress;
 
 bool calclight_canceled = false;
 volatile bool check_calclight_progress = false;
@@ -346,7 +346,7 @@ void check_calclight_canceled()
 
 void show_calclight_progress()
 {
-    float bar1 = float(lightprogress) / float(allocnodes);
+    float bar1 = float(SDL_AtomicGet(&lightprogress)) / float(allocnodes);
     defformatstring(text1, "%d%%", int(bar1 * 100));
 
     renderprogress(bar1, text1);
@@ -484,33 +484,97 @@ static void calcsurfaces(cube &c, const ivec &co, int size, int usefacemask, int
     }
 }
 
+static void calcsurfaces(cube &c, const ivec &o, int size)
+{
+    if(isempty(c)) return;
+    if(c.ext)
+    {
+        loopj(6) c.ext->surfaces[j].clear();
+    }
+    int usefacemask = 0;
+    loopj(6) if(c.texture[j] != DEFAULT_SKY && (!(c.merged&(1<<j)) || (c.ext && c.ext->surfaces[j].numverts&MAXFACEVERTS)))
+    {
+        usefacemask |= visibletris(c, j, o, size)<<(4*j);
+    }
+    if(usefacemask) calcsurfaces(c, o, size, usefacemask);
+}
+
 static void calcsurfaces(cube *c, const ivec &co, int size)
 {
-    CHECK_CALCLIGHT_PROGRESS(return, show_calclight_progress);
+    // only the main thread may show progress or poll for cancellation, the workers just stop once it was canceled
+    if(ismainthread())
+    {
+        CHECK_CALCLIGHT_PROGRESS(return, show_calclight_progress);
+    }
+    else if(calclight_canceled) return;
 
-    lightprogress++;
+    SDL_AtomicAdd(&lightprogress, 1);
 
     loopi(8)
     {
         ivec o(i, co, size);
         if(c[i].children)
             calcsurfaces(c[i].children, o, size >> 1);
-        else if(!isempty(c[i]))
+        else calcsurfaces(c[i], o, size);
+    }
+}
+
+VARP(lightthreads, 0, 1, 1);
+
+// the surfaces of each subtree are computed by their own job, every cube's surfaces only depend on
+// the finished octree and normals so the subtrees can be lit in any order
+struct surfacetask
+{
+    cube *c;
+    ivec co;
+    int size;
+};
+
+static vector<surfacetask> surfacetasks;
+
+static void gensurfacetask(void *data)
+{
+    surfacetask &t = *(surfacetask *)data;
+    calcsurfaces(t.c, t.co, t.size);
+}
+
+static void splitsurfacetasks(int levels, cube *c = worldroot, const ivec &co = ivec(0, 0, 0), int size = worldsize>>1)
+{
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(!c[i].children) calcsurfaces(c[i], o, size);
+        else if(levels > 1) splitsurfacetasks(levels-1, c[i].children, o, size>>1);
+        else
         {
-            if(c[i].ext)
-            {
-                loopj(6) c[i].ext->surfaces[j].clear();
-            }
-            int usefacemask = 0;
-            loopj(6) if(c[i].texture[j] != DEFAULT_SKY && (!(c[i].merged&(1<<j)) || (c[i].ext && c[i].ext->surfaces[j].numverts&MAXFACEVERTS)))
-            {
-                usefacemask |= visibletris(c[i], j, o, size)<<(4*j);
-            }
-            if(usefacemask) calcsurfaces(c[i], o, size, usefacemask);
+            surfacetask &t = surfacetasks.add();
+            t.c = c[i].children;
+            t.co = o;
+            t.size = size>>1;
         }
     }
 }
 
+// keeps the progress bar and escape to abort live while the main thread waits on the workers
+static void pollcalclight(void *data)
+{
+    CHECK_CALCLIGHT_PROGRESS(return, show_calclight_progress);
+}
+
+static void calcsurfaces()
+{
+    if(!lightthreads || numcpus <= 1)
+    {
+        calcsurfaces(worldroot, ivec(0, 0, 0), worldsize >> 1);
+        return;
+    }
+    splitsurfacetasks(3);
+    jobgroup group;
+    loopv(surfacetasks) addjob(gensurfacetask, NULL, &surfacetasks[i], &group, true);
+    waitjobs(&group, NULL, pollcalclight);
+    surfacetasks.setsize(0);
+}
+
 static inline bool previewblends(cube &c, const ivec &o, int size)
 {
     if(isempty(c) || c.material&MAT_ALPHA) return false;
@@ -534,7 +598,22 @@ static inline bool previewblends(cube &c, const ivec &o, int size)
     return true;
 }
 
-static bool previewblends(cube *c, const ivec &co, int size, const ivec &bo, const ivec &bs)
+// blend previews are found in three passes: the leaves in the box are gathered and any merged vertex arrays
+// invalidated, then the leaves are relit in batches on the job threads, and last the vertex arrays above
+// any relit leaf are freed by walking the box again in the same order
+#define BLENDPREVIEWBATCH 256
+
+struct blendpreview
+{
+    cube *c;
+    ivec o;
+    int size;
+    bool changed;
+};
+
+static vector<blendpreview> blendpreviews;
+
+static bool gatherblends(cube *c, const ivec &co, int size, const ivec &bo, const ivec &bs)
 {
     bool changed = false;
     loopoctabox(co, size, bo, bs)
@@ -548,10 +627,38 @@ static bool previewblends(cube *c, const ivec &co, int size, const ivec &bo, con
             ext->va = NULL;
             invalidatemerges(c[i], co, size, true);
         }
-        if(c[i].children ? previewblends(c[i].children, o, size/2, bo, bs) : previewblends(c[i], o, size))
+        if(c[i].children)
+        {
+            if(gatherblends(c[i].children, o, size/2, bo, bs)) changed = true;
+        }
+        else
+        {
+            blendpreview &p = blendpreviews.add();
+            p.c = &c[i];
+            p.o = o;
+            p.size = size;
+            p.changed = false;
+        }
+    }
+    return changed;
+}
+
+static void genblendpreviews(void *data)
+{
+    blendpreview *p = (blendpreview *)data, *end = min(p + BLENDPREVIEWBATCH, blendpreviews.getbuf() + blendpreviews.length());
+    for(; p < end; p++) p->changed = previewblends(*p->c, p->o, p->size);
+}
+
+static bool finishblends(cube *c, const ivec &co, int size, const ivec &bo, const ivec &bs, int &cur)
+{
+    bool changed = false;
+    loopoctabox(co, size, bo, bs)
+    {
+        ivec o(i, co, size);
+        if(c[i].children ? finishblends(c[i].children, o, size/2, bo, bs, cur) : blendpreviews[cur++].changed)
         {
             changed = true;
-            ext = c[i].ext;
+            cubeext *ext = c[i].ext;
             if(ext && ext->va)
             {
                 destroyva(ext->va);
@@ -565,8 +672,19 @@ static bool previewblends(cube *c, const ivec &co, int size, const ivec &bo, con
 void previewblends(const ivec &bo, const ivec &bs)
 {
     updateblendtextures(bo.x, bo.y, bo.x+bs.x, bo.y+bs.y);
-    if(previewblends(worldroot, ivec(0, 0, 0), worldsize/2, bo, bs))
-        commitchanges(true);
+    bool changed = gatherblends(worldroot, ivec(0, 0, 0), worldsize/2, bo, bs);
+    if(lightthreads && numcpus > 1 && blendpreviews.length() > BLENDPREVIEWBATCH)
+    {
+        jobgroup group;
+        for(int i = 0; i < blendpreviews.length(); i += BLENDPREVIEWBATCH)
+            addjob(genblendpreviews, NULL, &blendpreviews[i], &group, true);
+        waitjobs(&group);
+    }
+    else for(int i = 0; i < blendpreviews.length(); i += BLENDPREVIEWBATCH) genblendpreviews(&blendpreviews[i]);
+    int cur = 0;
+    if(finishblends(worldroot, ivec(0, 0, 0), worldsize/2, bo, bs, cur)) changed = true;
+    blendpreviews.setsize(0);
+    if(changed) commitchanges(true);
 }
 
 extern int filltjoints;
@@ -584,13 +702,14 @@ void calclight()
     optimizeblendmap();
     clearlightcache();
     clearsurfaces(worldroot);
-    lightprogress = 0;
+    SDL_AtomicSet(&lightprogress, 0);
     calclight_canceled = false;
     check_calclight_progress = false;
     SDL_TimerID timer = SDL_AddTimer(250, calclighttimer, NULL);
     Uint32 start = SDL_GetTicks();
     calcnormals(filltjoints > 0);
-    calcsurfaces(worldroot, ivec(0, 0, 0), worldsize >> 1);
+    Uint32 normalsend = SDL_GetTicks();
+    calcsurfaces();
     clearnormals();
     Uint32 end = SDL_GetTicks();
     if(timer) SDL_RemoveTimer(timer);
@@ -600,8 +719,8 @@ void calclight()
     if(calclight_canceled)
         conoutf("calclight aborted");
     else
-        conoutf("computed lighting (%.1f seconds)",
-            (end - start) / 1000.0f);
+        conoutf("computed lighting (%.1f seconds, %.1f computing normals)",
+            (end - start) / 1000.0f, (normalsend - start) / 1000.0f);
 }
 
 void mpcalclight(bool local)
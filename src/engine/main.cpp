@@ -7,6 +7,7 @@ extern void cleargamma();
 void cleanup()
 {
     recorder::stop();
+    cleanupjobs();
     cleanupserver();
     SDL_ShowCursor(SDL_TRUE);
     SDL_SetRelativeMouseMode(SDL_FALSE);
@@ -325,7 +326,7 @@ void renderprogressview(int w, int h, float bar, const char *text)   // also use
 
 void renderprogress(float bar, const char *text, bool background)   // also used during loading
 {
-    if(!inbetweenframes || drawtex) return;
+    if(!inbetweenframes || drawtex || !ismainthread()) return;
 
     clientkeepalive();      // make sure our connection doesn't time out while loading maps etc.
 
@@ -1041,6 +1042,9 @@ int main(int argc, char **argv)
     ASSERT(dedicated <= 1);
     game::initclient();
 
+    logoutf("init: jobs");
+    initjobs();
+
     logoutf("init: video");
     SDL_SetHint(SDL_HINT_GRAB_KEYBOARD, "0");
     #if !defined(WIN32) && !defined(__APPLE__)
@@ -1163,6 +1167,7 @@ int main(int argc, char **argv)
         recomputecamera();
         updateparticles();
         updatesounds();
+        processjobs();
 
         if(minimized) continue;
 
@@ -0,0 +1,433 @@
+// maptool.cpp: headless map validation and conversion, loads and saves the octree with the same code as load_world()/save_world()
+
+#include "engine.h"
+
+#ifndef WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+int worldscale = 0, worldsize = 0, mapversion = MAPVERSION, totalmillis = 1, numcpus = 1;
+
+// octa.cpp is linked for the real octree code, the tool never renders or edits so these only satisfy the linker
+selinfo sel;
+void renderprogress(float bar, const char *text, bool background) {}
+void allchanged(bool load) {}
+void brightencube(cube &c) {}
+void setsurface(cube &c, int orient, const surfaceinfo &surf, const vertinfo *verts, int numverts) {}
+void destroyva(vtxarray *va, bool reparent) {}
+void freeoctaentities(cube &c) {}
+void reduceslope(ivec &n) {}
+bool pointincube(const clipplanes &p, const vec &v) { return false; }
+float raycube(const vec &o, const vec &ray, float radius, int mode, int size, extentity *t) { return radius; }
+namespace game
+{
+    void edittrigger(const selinfo &sel, int op, int arg1, int arg2, int arg3, const VSlot *vs) {}
+}
+
+void fatal(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+    exit(EXIT_FAILURE);
+}
+
+void conoutfv(int type, const char *fmt, va_list args)
+{
+    vfprintf(type == CON_ERROR ? stderr : stdout, fmt, args);
+    fputc('\n', type == CON_ERROR ? stderr : stdout);
+}
+
+void conoutf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    conoutfv(CON_INFO, fmt, args);
+    va_end(args);
+}
+
+void conoutf(int type, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    conoutfv(type, fmt, args);
+    va_end(args);
+}
+
+struct mapfile
+{
+    const char *name;
+    stream *f, *out;
+    int version, worldsize, numents, numvars, numvslots, numpvs, blendmap, lightmaps;
+    int nodes, empty, solid, normal, materials, merged, surfaces, verts, invalid, maxdepth;
+    int changedvslots;
+    stream::offset extrabytes;
+    bool droppvs, failed;
+
+    mapfile(const char *name) : name(name), f(NULL), out(NULL), version(0), worldsize(0), numents(0), numvars(0), numvslots(0), numpvs(0), blendmap(0), lightmaps(0),
+        nodes(0), empty(0), solid(0), normal(0), materials(0), merged(0), surfaces(0), verts(0), invalid(0), maxdepth(0),
+        changedvslots(0), extrabytes(0), droppvs(false), failed(false)
+    {}
+    ~mapfile()
+    {
+        DELETEP(f);
+        DELETEP(out);
+    }
+
+    template<class T> T copylil()
+    {
+        T n = f->getlil<T>();
+        if(out) out->putlil<T>(n);
+        return n;
+    }
+
+    int copychar()
+    {
+        int c = f->getchar();
+        if(out) out->putchar(c);
+        return c;
+    }
+
+    void copy(size_t len)
+    {
+        uchar buf[4096];
+        while(len > 0)
+        {
+            size_t n = f->read(buf, min(len, sizeof(buf)));
+            if(!n) { failed = true; return; }
+            if(out) out->write(buf, n);
+            len -= n;
+        }
+    }
+
+    void skip(size_t len)
+    {
+        stream *dst = out;
+        out = NULL;
+        copy(len);
+        out = dst;
+    }
+
+    stream::offset copyrest()
+    {
+        uchar buf[4096];
+        stream::offset total = 0;
+        for(;;)
+        {
+            size_t n = f->read(buf, sizeof(buf));
+            if(!n) break;
+            if(out) out->write(buf, n);
+            total += n;
+        }
+        return total;
+    }
+};
+
+static bool readheader(mapfile &m)
+{
+    mapheader hdr;
+    octaheader ohdr;
+    if(!loadmapheader(m.f, m.name, hdr, ohdr)) return false;
+
+    m.version = hdr.version;
+    m.worldsize = hdr.worldsize;
+    m.numents = hdr.numents;
+    m.numvars = hdr.numvars;
+    m.numvslots = hdr.numvslots;
+    m.numpvs = hdr.numpvs;
+    m.blendmap = hdr.blendmap;
+    m.lightmaps = hdr.version <= 0 ? ohdr.lightmaps : 0;
+
+    if(m.out)
+    {
+        hdr.numents = min(hdr.numents, MAXENTS);
+        // pvs before version 2 used a different layout that only the engine can convert, so it is
+        // left out and has to be recomputed
+        if(hdr.version < 2 && hdr.numpvs > 0)
+        {
+            hdr.numpvs = 0;
+            m.droppvs = true;
+        }
+        hdr.version = MAPVERSION;
+        hdr.headersize = sizeof(hdr);
+        lilswap(&hdr.version, 8);
+        m.out->write(&hdr, sizeof(hdr));
+    }
+    return true;
+}
+
+static void copyvars(mapfile &m)
+{
+    loopi(m.numvars)
+    {
+        int type = m.copychar(), ilen = m.copylil<ushort>();
+        m.copy(ilen);
+        switch(type)
+        {
+            case ID_VAR: m.copylil<int>(); break;
+            case ID_FVAR: m.copylil<float>(); break;
+            case ID_SVAR: m.copy(m.copylil<ushort>()); break;
+        }
+        if(m.failed) return;
+    }
+
+    int len = m.copychar();
+    if(len >= 0) m.copy(len+1);
+    int eif = m.copylil<ushort>(), extrasize = m.copylil<ushort>();
+    m.copy(extrasize);
+    int nummru = m.copylil<ushort>();
+    m.copy(nummru*sizeof(ushort));
+
+    loopi(min(m.numents, MAXENTS))
+    {
+        entity e;
+        if(m.f->read(&e, sizeof(entity)) != sizeof(entity)) { m.failed = true; return; }
+        fixent(e, m.version);
+        if(m.out) m.out->write(&e, sizeof(entity));
+        m.copy(eif);
+    }
+    if(m.numents > MAXENTS)
+    {
+        conoutf(CON_WARN, "warning: map %s has %d entities", m.name, m.numents);
+        m.f->seek((m.numents-MAXENTS)*(sizeof(entity) + eif), SEEK_CUR);
+        m.numents = MAXENTS;
+    }
+}
+
+static void copyvslots(mapfile &m)
+{
+    int numvslots = m.numvslots;
+    while(numvslots > 0 && !m.failed)
+    {
+        int changed = m.copylil<int>();
+        if(changed < 0) { numvslots += changed; continue; }
+        m.copylil<int>();
+        m.changedvslots++;
+        if(changed & (1<<VSLOT_SHPARAM))
+        {
+            int numparams = m.copylil<ushort>();
+            loopi(numparams)
+            {
+                m.copy(m.copylil<ushort>());
+                m.copy(4*sizeof(float));
+            }
+        }
+        if(changed & (1<<VSLOT_SCALE)) m.copylil<float>();
+        if(changed & (1<<VSLOT_ROTATION)) m.copylil<int>();
+        if(changed & (1<<VSLOT_OFFSET)) m.copy(2*sizeof(int));
+        if(changed & (1<<VSLOT_SCROLL)) m.copy(2*sizeof(float));
+        if(changed & (1<<VSLOT_LAYER)) m.copylil<int>();
+        if(changed & (1<<VSLOT_ALPHA)) m.copy(2*sizeof(float));
+        if(changed & (1<<VSLOT_COLOR)) m.copy(3*sizeof(float));
+        if(changed & (1<<VSLOT_REFRACT)) m.copy(4*sizeof(float));
+        if(changed & (1<<VSLOT_DETAIL)) m.copylil<int>();
+        numvslots--;
+    }
+}
+
+static void countcubes(mapfile &m, const cube *c, int depth)
+{
+    loopi(8)
+    {
+        const cube &cu = c[i];
+        if(cu.children)
+        {
+            m.nodes++;
+            countcubes(m, cu.children, depth+1);
+            continue;
+        }
+        if(isempty(cu)) m.empty++;
+        else if(isentirelysolid(cu)) m.solid++;
+        else m.normal++;
+        if(cu.material != MAT_AIR) m.materials++;
+        if(cu.merged) m.merged++;
+        if(cu.ext) loopj(6)
+        {
+            const surfaceinfo &surf = cu.ext->surfaces[j];
+            if(!surf.used()) continue;
+            m.surfaces++;
+            m.verts += surf.numverts&MAXFACEVERTS;
+        }
+        m.maxdepth = max(m.maxdepth, depth);
+    }
+}
+
+static void skipviewcells(mapfile &m, int depth = 0)
+{
+    int leafmask = m.f->getchar();
+    if(leafmask < 0 || depth > 32) { m.failed = true; return; }
+    loopi(8)
+    {
+        if(leafmask&(1<<i)) m.f->getlil<int>();
+        else skipviewcells(m, depth+1);
+        if(m.failed) return;
+    }
+}
+
+static void skippvs(mapfile &m)
+{
+    uint totallen = m.f->getlil<uint>();
+    if(totallen & 0x80000000U)
+    {
+        totallen &= ~0x80000000U;
+        m.skip(m.f->getlil<uint>()*sizeof(int));
+    }
+    m.skip(m.numpvs*sizeof(ushort));
+    m.skip(totallen);
+    if(!m.failed) skipviewcells(m);
+}
+
+static bool convertmap(mapfile &m)
+{
+    if(!readheader(m)) return false;
+    copyvars(m);
+    if(!m.failed) copyvslots(m);
+    if(m.failed) return false;
+
+    worldsize = m.worldsize;
+    for(worldscale = 0; 1<<worldscale < worldsize; worldscale++);
+    mapversion = m.version;
+    freeocta(worldroot);
+    worldroot = loadoctree(m.f, m.worldsize, m.failed);
+    if(m.failed) return false;
+    m.invalid = validatec(worldroot, m.worldsize>>1);
+    countcubes(m, worldroot, 0);
+    if(m.out) saveoctree(m.out);
+
+    if(m.version <= 0) skiplightmaps(m.f, m.lightmaps);
+    if(m.droppvs)
+    {
+        skippvs(m);
+        if(m.failed) return false;
+    }
+    m.extrabytes = m.copyrest();
+    return true;
+}
+
+static stream::offset inflatedsize(const char *name)
+{
+    // the gzip trailer ends with the inflated size, the gz stream can't tell once it has hit the end
+    stream *f = openfile(name, "rb");
+    if(!f) return -1;
+    stream::offset size = f->seek(-4, SEEK_END) ? stream::offset(f->getlil<uint>()) : stream::offset(-1);
+    delete f;
+    return size;
+}
+
+static bool processmap(const char *name, const char *outdir, int level, vector<char> &report)
+{
+    mapfile m(name);
+    m.f = opengzfile(name, "rb");
+    if(!m.f) { conoutf(CON_ERROR, "could not read map %s", name); return false; }
+    string outname = "";
+    if(outdir)
+    {
+        const char *base = strrchr(name, '/');
+        formatstring(outname, "%s/%s", outdir, base ? base+1 : name);
+        path(outname);
+        if(!strcmp(outname, name)) { conoutf(CON_ERROR, "refusing to overwrite %s in place", name); return false; }
+        m.out = opengzfile(outname, "wb", NULL, level);
+        if(!m.out) { conoutf(CON_ERROR, "could not write map %s", outname); return false; }
+    }
+
+    if(!convertmap(m))
+    {
+        if(m.failed) conoutf(CON_ERROR, "garbage in map %s", name);
+        if(m.out)
+        {
+            DELETEP(m.out);
+            remove(findfile(outname, "wb"));
+        }
+        return false;
+    }
+
+    int cubes = m.empty + m.solid + m.normal;
+    defformatstring(line, "%s: version %d, size %d, %d ents, %d vars, %d vslots (%d changed), %d nodes, %d cubes (%d empty, %d solid, %d normal, %d material, %d merged), depth %d, %d surfaces, %d verts, %d pvs, %s, %lld extra bytes, %lld bytes (%lld inflated)",
+        name, m.version, m.worldsize, m.numents, m.numvars, m.numvslots, m.changedvslots, m.nodes, cubes, m.empty, m.solid, m.normal, m.materials, m.merged, m.maxdepth, m.surfaces, m.verts, m.numpvs,
+        m.blendmap ? "blendmap" : "no blendmap", llong(m.extrabytes), llong(m.f->rawtell()), llong(inflatedsize(name)));
+    report.put(line, strlen(line));
+    if(m.invalid)
+    {
+        defformatstring(fixed, ", %d invalid cubes%s", m.invalid, m.out ? " fixed" : "");
+        report.put(fixed, strlen(fixed));
+    }
+    if(m.droppvs)
+    {
+        const char *dropped = ", old pvs dropped";
+        report.put(dropped, strlen(dropped));
+    }
+    if(m.out)
+    {
+        defformatstring(wrote, ", wrote %s", outname);
+        report.put(wrote, strlen(wrote));
+    }
+    report.add('\n');
+    return true;
+}
+
+static int processmaps(vector<const char *> &maps, int worker, int numworkers, const char *outdir, int level)
+{
+    int failures = 0;
+    for(int i = worker; i < maps.length(); i += numworkers)
+    {
+        vector<char> report;
+        if(!processmap(maps[i], outdir, level, report)) failures++;
+        report.add('\0');
+        fputs(report.getbuf(), stdout);
+        fflush(stdout);
+    }
+    return failures;
+}
+
+int main(int argc, char **argv)
+{
+    const char *outdir = NULL;
+    int level = Z_BEST_COMPRESSION, numworkers = 1;
+    vector<const char *> maps;
+    for(int i = 1; i < argc; i++)
+    {
+        if(argv[i][0]=='-') switch(argv[i][1])
+        {
+            case 'o': outdir = &argv[i][2]; break;
+            case 'z': level = clamp(atoi(&argv[i][2]), int(Z_NO_COMPRESSION), int(Z_BEST_COMPRESSION)); break;
+            case 'f': level = Z_NO_COMPRESSION; break; // load_world() inflates the octree a few bytes at a time, stored blocks make that a plain copy
+            case 'j': numworkers = max(atoi(&argv[i][2]), 1); break;
+            default: conoutf(CON_ERROR, "unknown option: %s", argv[i]); break;
+        }
+        else maps.add(argv[i]);
+    }
+    if(maps.empty())
+    {
+        conoutf("usage: %s [-o<outdir>] [-z<level>|-f] [-j<workers>] <map.ogz>...", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(outdir && !createdir(outdir)) { conoutf(CON_ERROR, "could not create directory %s", outdir); return EXIT_FAILURE; }
+    numworkers = min(numworkers, maps.length());
+
+    int failures = 0;
+#ifndef WIN32
+    if(numworkers > 1)
+    {
+        vector<pid_t> workers;
+        loopi(numworkers)
+        {
+            pid_t pid = fork();
+            if(!pid) _exit(processmaps(maps, i, numworkers, outdir, level) ? EXIT_FAILURE : EXIT_SUCCESS);
+            if(pid > 0) workers.add(pid);
+            else failures += processmaps(maps, i, numworkers, outdir, level);
+        }
+        loopv(workers)
+        {
+            int status = 0;
+            if(waitpid(workers[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) failures++;
+        }
+    }
+    else
+#endif
+    failures = processmaps(maps, 0, 1, outdir, level);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
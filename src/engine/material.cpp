@@ -234,83 +234,150 @@ void calcmatbb(vtxarray *va, const ivec &co, int size, vector<materialsurface> &
     }
 }
 
-static inline bool mergematcmp(const materialsurface &x, const materialsurface &y)
+struct matsortkey
 {
-    int dim = dimension(x.orient), c = C[dim], r = R[dim];
-    if(x.o[r] + x.rsize < y.o[r] + y.rsize) return true;
-    if(x.o[r] + x.rsize > y.o[r] + y.rsize) return false;
-    return x.o[c] < y.o[c];
-}
+    ullong key;
+    int index;
+};
+
+struct matmergebuf
+{
+    vector<matsortkey> keys, sorted;
+    vector<materialsurface> surfs;
+    vector<int> prev, next, grid;
+    vector<uchar> dead;
+};
+static thread_local matmergebuf matmerge;
 
-static int mergematr(materialsurface *m, int sz, materialsurface &n)
+// LSD radix sort on the keys in matmerge.keys, a byte per pass, skipping bytes shared by all keys, then permute the surfaces to match
+static void sortmatsurfs(materialsurface *m, int sz, int bits)
 {
-    int dim = dimension(n.orient), c = C[dim], r = R[dim];
-    for(int i = sz-1; i >= 0; --i)
+    if(sz <= 1) return;
+    matmergebuf &b = matmerge;
+    b.sorted.setsize(0);
+    matsortkey *src = b.keys.getbuf(), *dst = b.sorted.pad(sz);
+    for(int shift = 0; shift < bits; shift += 8)
     {
-        if(m[i].o[r] + m[i].rsize < n.o[r]) break;
-        if(m[i].o[r] + m[i].rsize == n.o[r] && m[i].o[c] == n.o[c] && m[i].csize == n.csize)
-        {
-            n.o[r] = m[i].o[r];
-            n.rsize += m[i].rsize;
-            memmove(&m[i], &m[i+1], (sz - (i+1)) * sizeof(materialsurface));
-            return 1;
-        }
+        int counts[256];
+        memset(counts, 0, sizeof(counts));
+        loopi(sz) counts[(src[i].key>>shift)&0xFF]++;
+        if(counts[(src[0].key>>shift)&0xFF] == sz) continue;
+        for(int i = 0, offset = 0; i < 256; i++) { int count = counts[i]; counts[i] = offset; offset += count; }
+        loopi(sz) dst[counts[(src[i].key>>shift)&0xFF]++] = src[i];
+        swap(src, dst);
     }
-    return 0;
+    vector<materialsurface> &surfs = b.surfs;
+    surfs.setsize(0);
+    surfs.put(m, sz);
+    loopi(sz) m[i] = surfs[src[i].index];
 }
 
-static int mergematc(materialsurface &m, materialsurface &n)
+static inline uint matgridhash(int rowend, int col)
 {
-    int dim = dimension(n.orient), c = C[dim], r = R[dim];
-    if(m.o[r] == n.o[r] && m.rsize == n.rsize && m.o[c] + m.csize == n.o[c])
-    {
-        n.o[c] = m.o[c];
-        n.csize += m.csize;
-        return 1;
-    }
-    return 0;
+    return (uint(rowend)*0x9E3779B1U) ^ (uint(col)*0x85EBCA77U);
 }
 
-static int mergemat(materialsurface *m, int sz, materialsurface &n)
+static inline int *findmatgrid(vector<int> &grid, const vector<materialsurface> &surfs, int r, int c, int rowend, int col)
 {
-    for(bool merged = false; sz; merged = true)
+    int mask = grid.length()-1;
+    for(uint i = matgridhash(rowend, col);; i++)
     {
-        int rmerged = mergematr(m, sz, n);
-        sz -= rmerged;
-        if(!rmerged && merged) break;
-        if(!sz) break;
-        int cmerged = mergematc(m[sz-1], n);
-        sz -= cmerged;
-        if(!cmerged) break;
+        int &slot = grid[i&mask];
+        if(slot < 0) return &slot;
+        const materialsurface &m = surfs[slot];
+        if(m.o[r] + m.rsize == rowend && m.o[c] == col) return &slot;
     }
-    m[sz++] = n;
-    return sz;
 }
 
 static int mergemats(materialsurface *m, int sz)
 {
-    quicksort(m, sz, mergematcmp);
+    if(sz <= 1) return sz;
+    int dim = dimension(m[0].orient), c = C[dim], r = R[dim];
+    matmergebuf &b = matmerge;
+    b.keys.setsize(0);
+    matsortkey *keys = b.keys.pad(sz);
+    loopi(sz)
+    {
+        keys[i].key = (ullong(m[i].o[r] + m[i].rsize)<<17) | uint(m[i].o[c]);
+        keys[i].index = i;
+    }
+    sortmatsurfs(m, sz, 34);
+
+    // surfaces are keyed in the grid by their row end and column start, which stay unique among live surfaces,
+    // so the surface a new one can extend is found directly instead of scanning back through the output
+    vector<materialsurface> &out = b.surfs;
+    vector<int> &prev = b.prev, &next = b.next, &grid = b.grid;
+    vector<uchar> &dead = b.dead;
+    out.setsize(0);
+    prev.setsize(0);
+    next.setsize(0);
+    dead.setsize(0);
+    int gridsize = 1;
+    while(gridsize < 2*sz) gridsize <<= 1;
+    grid.setsize(0);
+    memset(grid.pad(gridsize), 0xFF, gridsize*sizeof(int));
+
+    int last = -1, live = 0;
+    #define UNLINKMAT(i) do { \
+        int j = i; \
+        dead[j] = 1; \
+        if(prev[j] >= 0) next[prev[j]] = next[j]; \
+        if(next[j] >= 0) prev[next[j]] = prev[j]; \
+        else last = prev[j]; \
+        live--; \
+    } while(0)
+    loopi(sz)
+    {
+        materialsurface n = m[i];
+        for(bool merged = false; live; merged = true)
+        {
+            int above = *findmatgrid(grid, out, r, c, n.o[r], n.o[c]);
+            if(above >= 0 && !dead[above] && out[above].csize == n.csize)
+            {
+                n.o[r] = out[above].o[r];
+                n.rsize += out[above].rsize;
+                UNLINKMAT(above);
+            }
+            else if(merged) break;
+            if(!live) break;
+            const materialsurface &l = out[last];
+            if(l.o[r] != n.o[r] || l.rsize != n.rsize || l.o[c] + l.csize != n.o[c]) break;
+            n.o[c] = l.o[c];
+            n.csize += l.csize;
+            UNLINKMAT(last);
+        }
+        int idx = out.length();
+        out.add(n);
+        prev.add(last);
+        next.add(-1);
+        dead.add(0);
+        if(last >= 0) next[last] = idx;
+        last = idx;
+        live++;
+        *findmatgrid(grid, out, r, c, n.o[r] + n.rsize, n.o[c]) = idx;
+    }
+    #undef UNLINKMAT
 
     int nsz = 0;
-    loopi(sz) nsz = mergemat(m, nsz, m[i]);
+    loopv(out) if(!dead[i]) m[nsz++] = out[i];
     return nsz;
 }
 
-static inline bool optmatcmp(const materialsurface &x, const materialsurface &y)
-{
-    if(x.material < y.material) return true;
-    if(x.material > y.material) return false;
-    if(x.orient > y.orient) return true;
-    if(x.orient < y.orient) return false;
-    int dim = dimension(x.orient);
-    return x.o[dim] < y.o[dim];
-}
-
 VARF(optmats, 0, 1, 1, allchanged());
 
 int optimizematsurfs(materialsurface *matbuf, int matsurfs)
 {
-    quicksort(matbuf, matsurfs, optmatcmp);
+    // sort by material, then orientation descending, then depth, then visibility
+    matmergebuf &b = matmerge;
+    b.keys.setsize(0);
+    matsortkey *keys = b.keys.pad(matsurfs);
+    loopi(matsurfs)
+    {
+        const materialsurface &m = matbuf[i];
+        keys[i].key = (ullong(m.material)<<22) | (uint(5 - m.orient)<<19) | (uint(m.o[dimension(m.orient)])<<2) | m.visible;
+        keys[i].index = i;
+    }
+    sortmatsurfs(matbuf, matsurfs, 38);
     if(!optmats) return matsurfs;
     materialsurface *cur = matbuf, *end = matbuf+matsurfs;
     while(cur < end)
@@ -33,45 +33,87 @@ struct tnormal
     normalgroup *groups[2];
 };
 
-hashset<normalgroup> normalgroups(1<<16);
+// the normal groups are split into parts by key hash, so that each part can be linked by its own job
+#define NORMALPARTBITS 4
+#define NORMALPARTS (1<<NORMALPARTBITS)
+
+static inline int normalpart(const normalkey &k) { return (hthash(k)*0x9E3779B1U)>>(32-NORMALPARTBITS); }
+
+struct normalpartset
+{
+    int part;
+    hashset<normalgroup> groups;
+
+    normalpartset() : groups(1<<(16-NORMALPARTBITS)) {}
+};
+
+enum { NREF_FLAT = 0, NREF_NORMAL, NREF_TNORMAL };
+
+struct normalref
+{
+    normalkey key;
+    int type, index;
+};
+
+// the normals of one subtree of the world, numbered locally until all subtrees are merged in octree order
+struct normaltask
+{
+    cube *c;
+    ivec co;
+    int size;
+    bool leaf;
+    int normalbase, tnormalbase;
+    vector<normal> normals;
+    vector<tnormal> tnormals;
+    vector<normalkey> tnormalkeys;
+    vector<normalref> refs[NORMALPARTS];
+};
+
+static normalpartset normalparts[NORMALPARTS];
+static vector<normaltask *> normaltasks;
 vector<normal> normals;
 vector<tnormal> tnormals;
 vector<int> smoothgroups;
 
 VARR(lerpangle, 0, 44, 180);
+VARP(normalthreads, 0, 1, 1);
 
-static bool usetnormals = true;
+static bool usetnormals = true, threadednormals = false;
 
-static int addnormal(const vec &pos, int smooth, const vec &surface)
+static inline void addnormalref(normaltask &t, const vec &pos, int smooth, int type, int index)
 {
     normalkey key = { pos, smooth };
-    normalgroup &g = normalgroups.access(key, key);
-    normal &n = normals.add();
-    n.next = g.normals;
+    normalref &r = t.refs[normalpart(key)].add();
+    r.key = key;
+    r.type = type;
+    r.index = index;
+}
+
+static int addnormal(normaltask &t, const vec &pos, int smooth, const vec &surface)
+{
+    normal &n = t.normals.add();
+    n.next = -1;
     n.surface = surface;
-    return g.normals = normals.length()-1;
+    addnormalref(t, pos, smooth, NREF_NORMAL, t.normals.length()-1);
+    return t.normals.length()-1;
 }
 
-static void addtnormal(const vec &pos, int smooth, float offset, int normal1, int normal2, const vec &pos1, const vec &pos2)
+static void addtnormal(normaltask &t, const vec &pos, int smooth, float offset, int normal1, int normal2, const vec &pos1, const vec &pos2)
 {
-    normalkey key = { pos, smooth };
-    normalgroup &g = normalgroups.access(key, key);
-    tnormal &n = tnormals.add();
-    n.next = g.tnormals;
+    tnormal &n = t.tnormals.add();
+    n.next = -1;
     n.offset = offset;
     n.normals[0] = normal1;
     n.normals[1] = normal2;
     normalkey key1 = { pos1, smooth }, key2 = { pos2, smooth };
-    n.groups[0] = normalgroups.access(key1);
-    n.groups[1] = normalgroups.access(key2);
-    g.tnormals = tnormals.length()-1;
+    t.tnormalkeys.add(key1);
+    t.tnormalkeys.add(key2);
+    addnormalref(t, pos, smooth, NREF_TNORMAL, t.tnormals.length()-1);
 }
 
-static int addnormal(const vec &pos, int smooth, int axis)
+static int addnormal(normaltask &t, const vec &pos, int smooth, int axis)
 {
-    normalkey key = { pos, smooth };
-    normalgroup &g = normalgroups.access(key, key);
-    g.flat += 1<<(4*axis);
+    addnormalref(t, pos, smooth, NREF_FLAT, axis);
     return axis - 6;
 }
 
@@ -130,7 +172,7 @@ static inline bool findtnormal(const normalgroup &g, float lerpthreshold, const
 void findnormal(const vec &pos, int smooth, const vec &surface, vec &v)
 {
     normalkey key = { pos, smooth };
-    const normalgroup *g = normalgroups.access(key);
+    const normalgroup *g = normalparts[normalpart(key)].groups.access(key);
     if(g)
     {
         int angle = smoothgroups.inrange(smooth) && smoothgroups[smooth] >= 0 ? smoothgroups[smooth] : lerpangle;
@@ -152,15 +194,15 @@ void show_addnormals_progress()
     renderprogress(bar1, "computing normals...");
 }
 
-void addnormals(cube &c, const ivec &o, int size)
+static void addnormals(normaltask &t, cube &c, const ivec &o, int size)
 {
-    CHECK_CALCLIGHT_PROGRESS(return, show_addnormals_progress);
+    if(!threadednormals) CHECK_CALCLIGHT_PROGRESS(return, show_addnormals_progress);
 
     if(c.children)
     {
-        normalprogress++;
+        if(!threadednormals) normalprogress++;
         size >>= 1;
-        loopi(8) addnormals(c.children[i], ivec(i, o, size), size);
+        loopi(8) addnormals(t, c.children[i], ivec(i, o, size), size);
         return;
     }
     else if(isempty(c)) return;
@@ -170,7 +212,7 @@ void addnormals(cube &c, const ivec &o, int size)
     int tj = usetnormals && c.ext ? c.ext->tjoints : -1, vis;
     loopi(6) if((vis = visibletris(c, i, o, size)))
     {
-        CHECK_CALCLIGHT_PROGRESS(return, show_addnormals_progress);
+        if(!threadednormals) CHECK_CALCLIGHT_PROGRESS(return, show_addnormals_progress);
         if(c.texture[i] == DEFAULT_SKY) continue;
 
         vec planes[2];
@@ -209,15 +251,15 @@ void addnormals(cube &c, const ivec &o, int size)
         VSlot &vslot = lookupvslot(c.texture[i], false);
         int smooth = vslot.slot->smooth;
 
-        if(!numplanes) loopk(numverts) norms[k] = addnormal(pos[k], smooth, i);
-        else if(numplanes==1) loopk(numverts) norms[k] = addnormal(pos[k], smooth, planes[0]);
+        if(!numplanes) loopk(numverts) norms[k] = addnormal(t, pos[k], smooth, i);
+        else if(numplanes==1) loopk(numverts) norms[k] = addnormal(t, pos[k], smooth, planes[0]);
         else
         {
             vec avg = vec(planes[0]).add(planes[1]).normalize();
-            norms[0] = addnormal(pos[0], smooth, avg);
-            norms[1] = addnormal(pos[1], smooth, planes[0]);
-            norms[2] = addnormal(pos[2], smooth, avg);
-            for(int k = 3; k < numverts; k++) norms[k] = addnormal(pos[k], smooth, planes[1]);
+            norms[0] = addnormal(t, pos[0], smooth, avg);
+            norms[1] = addnormal(t, pos[1], smooth, planes[0]);
+            norms[2] = addnormal(t, pos[2], smooth, avg);
+            for(int k = 3; k < numverts; k++) norms[k] = addnormal(t, pos[k], smooth, planes[1]);
         }
 
         while(tj >= 0 && tjoints[tj].edge < i*(MAXFACEVERTS+1)) tj = tjoints[tj].next;
@@ -237,28 +279,137 @@ void addnormals(cube &c, const ivec &o, int size)
 
             while(tj >= 0)
             {
-                tjoint &t = tjoints[tj];
-                if(t.edge != edge) break;
-                float offset = (t.offset - offset1) * doffset;
-                vec tpos = vec(d).mul(t.offset/8.0f).add(o);
-                addtnormal(tpos, smooth, offset, norms[e1], norms[e2], v1, v2);
-                tj = t.next;
+                tjoint &tjt = tjoints[tj];
+                if(tjt.edge != edge) break;
+                float offset = (tjt.offset - offset1) * doffset;
+                vec tpos = vec(d).mul(tjt.offset/8.0f).add(o);
+                addtnormal(t, tpos, smooth, offset, norms[e1], norms[e2], v1, v2);
+                tj = tjt.next;
+            }
+        }
+    }
+}
+
+static void gennormaltask(void *data)
+{
+    normaltask &t = *(normaltask *)data;
+    if(calclight_canceled) return;
+    if(t.leaf) addnormals(t, *t.c, t.co, t.size);
+    else loopi(8) addnormals(t, t.c[i], ivec(i, t.co, t.size), t.size);
+}
+
+static void addnormaltask(cube *c, const ivec &co, int size, bool leaf)
+{
+    normaltask *t = new normaltask;
+    t->c = c;
+    t->co = co;
+    t->size = size;
+    t->leaf = leaf;
+    normaltasks.add(t);
+}
+
+static void splitnormaltasks(int levels, cube *c = worldroot, const ivec &co = ivec(0, 0, 0), int size = worldsize>>1)
+{
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(c[i].children)
+        {
+            if(levels > 1) splitnormaltasks(levels-1, c[i].children, o, size>>1);
+            else addnormaltask(c[i].children, o, size>>1, false);
+        }
+        else if(!isempty(c[i])) addnormaltask(&c[i], o, size, true);
+    }
+}
+
+// links each group's normals in the order a serial walk of the world would have added them
+static void gennormalpart(void *data)
+{
+    normalpartset &p = *(normalpartset *)data;
+    loopv(normaltasks)
+    {
+        normaltask &t = *normaltasks[i];
+        const vector<normalref> &refs = t.refs[p.part];
+        loopvj(refs)
+        {
+            const normalref &r = refs[j];
+            normalgroup &g = p.groups.access(r.key, r.key);
+            switch(r.type)
+            {
+                case NREF_FLAT:
+                    g.flat += 1<<(4*r.index);
+                    break;
+                case NREF_NORMAL:
+                    normals[t.normalbase + r.index].next = g.normals;
+                    g.normals = t.normalbase + r.index;
+                    break;
+                case NREF_TNORMAL:
+                    tnormals[t.tnormalbase + r.index].next = g.tnormals;
+                    g.tnormals = t.tnormalbase + r.index;
+                    break;
             }
         }
     }
 }
 
+static void runnormaljobs(jobfunc work, void **data, int num)
+{
+    if(threadednormals)
+    {
+        jobgroup group;
+        loopi(num) addjob(work, NULL, data[i], &group, true);
+        waitjobs(&group, "computing normals...");
+    }
+    else loopi(num) work(data[i]);
+}
+
 void calcnormals(bool lerptjoints)
 {
     usetnormals = lerptjoints;
     if(usetnormals) findtjoints();
     normalprogress = 1;
-    loopi(8) addnormals(worldroot[i], ivec(i, ivec(0, 0, 0), worldsize/2), worldsize/2);
+    threadednormals = normalthreads && numcpus > 1;
+    splitnormaltasks(3);
+    runnormaljobs(gennormaltask, (void **)normaltasks.getbuf(), normaltasks.length());
+
+    loopv(normaltasks)
+    {
+        normaltask &t = *normaltasks[i];
+        t.normalbase = normals.length();
+        t.tnormalbase = tnormals.length();
+        normals.put(t.normals.getbuf(), t.normals.length());
+        loopvj(t.tnormals)
+        {
+            tnormal &n = tnormals.add(t.tnormals[j]);
+            loopk(2) if(n.normals[k] >= 0) n.normals[k] += t.normalbase;
+        }
+    }
+    void *parts[NORMALPARTS];
+    loopi(NORMALPARTS)
+    {
+        normalparts[i].part = i;
+        parts[i] = &normalparts[i];
+    }
+    runnormaljobs(gennormalpart, parts, NORMALPARTS);
+    loopv(normaltasks)
+    {
+        normaltask &t = *normaltasks[i];
+        loopvj(t.tnormals)
+        {
+            tnormal &n = tnormals[t.tnormalbase + j];
+            loopk(2)
+            {
+                const normalkey &key = t.tnormalkeys[2*j + k];
+                n.groups[k] = normalparts[normalpart(key)].groups.access(key);
+            }
+        }
+    }
+    normaltasks.deletecontents();
 }
 
 void clearnormals()
 {
-    normalgroups.clear();
+    loopi(NORMALPARTS) normalparts[i].groups.clear();
     normals.setsize(0);
     tnormals.setsize(0);
 }
@@ -16,12 +16,92 @@ static struct emptycube : cube
     }
 } emptycube;
 
+// cube families and cubeexts are carved out of large slabs and recycled through free lists rather than
+// allocated from the heap one at a time, so a family and its siblings loaded together stay close in memory
+struct cubepool
+{
+    int size, perslab;
+    uchar *slabs, *cur, *end;
+    void *freelist;
+    int numslabs, used;
+
+    void *alloc()
+    {
+        used++;
+        if(freelist)
+        {
+            void *p = freelist;
+            freelist = *(void **)p;
+            return p;
+        }
+        if(cur >= end)
+        {
+            // each slab starts with a link to the previous one, padded to keep the payload aligned
+            uchar *slab = new uchar[16 + size*perslab];
+            *(uchar **)slab = slabs;
+            slabs = slab;
+            cur = slab + 16;
+            end = cur + size*perslab;
+            numslabs++;
+        }
+        void *p = cur;
+        cur += size;
+        return p;
+    }
+
+    void free(void *p)
+    {
+        *(void **)p = freelist;
+        freelist = p;
+        if(--used <= 0) clear();
+    }
+
+    void clear()
+    {
+        while(slabs)
+        {
+            uchar *next = *(uchar **)slabs;
+            delete[] slabs;
+            slabs = next;
+        }
+        cur = end = NULL;
+        freelist = NULL;
+        numslabs = used = 0;
+    }
+
+    size_t reserved() const { return size_t(numslabs)*(16 + size*perslab); }
+};
+
+// cubeexts are pooled by how many verts they hold, from none up to the 255 a uchar maxverts allows
+#define CUBEEXTPOOLS 8
+static inline int cubeextcapacity(int pool) { return pool ? 2<<pool : 0; }
+static inline int cubeextpool(int maxverts)
+{
+    int pool = 0;
+    while(cubeextcapacity(pool) < maxverts) pool++;
+    return pool;
+}
+
+static cubepool cubefamilies = { 8*sizeof(cube), 256 };
+static cubepool cubeexts[CUBEEXTPOOLS] =
+{
+#define CUBEEXTSIZE(pool) int(sizeof(cubeext) + ((pool) ? 2<<(pool) : 0)*sizeof(vertinfo))
+#define CUBEEXTPOOL(pool) { CUBEEXTSIZE(pool), max(65536/CUBEEXTSIZE(pool), 16) }
+    CUBEEXTPOOL(0), CUBEEXTPOOL(1), CUBEEXTPOOL(2), CUBEEXTPOOL(3),
+    CUBEEXTPOOL(4), CUBEEXTPOOL(5), CUBEEXTPOOL(6), CUBEEXTPOOL(7)
+#undef CUBEEXTPOOL
+#undef CUBEEXTSIZE
+};
+static SDL_SpinLock cubepoollock = 0;
+
 cube *worldroot = newcubes(F_SOLID);
 int allocnodes = 0;
 
 cubeext *growcubeext(cubeext *old, int maxverts)
 {
-    cubeext *ext = (cubeext *)new uchar[sizeof(cubeext) + maxverts*sizeof(vertinfo)];
+    SDL_AtomicLock(&cubepoollock);
+    cubeext *ext = (cubeext *)cubeexts[cubeextpool(maxverts)].alloc();
+    SDL_AtomicUnlock(&cubepoollock);
     if(old)
     {
         ext->va = old->va;
@@ -38,12 +118,19 @@ cubeext *growcubeext(cubeext *old, int maxverts)
     return ext;
 }
 
+static void freecubeext(cubeext *ext)
+{
+    SDL_AtomicLock(&cubepoollock);
+    cubeexts[cubeextpool(ext->maxverts)].free(ext);
+    SDL_AtomicUnlock(&cubepoollock);
+}
+
 void setcubeext(cube &c, cubeext *ext)
 {
     cubeext *old = c.ext;
     if(old == ext) return;
     c.ext = ext;
-    if(old) delete[] (uchar *)old;
+    if(old) freecubeext(old);
 }
 
 cubeext *newcubeext(cube &c, int maxverts, bool init)
@@ -65,7 +152,10 @@ cubeext *newcubeext(cube &c, int maxverts, bool init)
 
 cube *newcubes(uint face, int mat)
 {
-    cube *c = new cube[8];
+    SDL_AtomicLock(&cubepoollock);
+    cube *c = (cube *)cubefamilies.alloc();
+    allocnodes++;
+    SDL_AtomicUnlock(&cubepoollock);
     loopi(8)
     {
         c->children = NULL;
@@ -77,10 +167,17 @@ cube *newcubes(uint face, int mat)
         c->material = mat;
         c++;
     }
-    allocnodes++;
     return c-8;
 }
 
+static void freecubes(cube *c)
+{
+    SDL_AtomicLock(&cubepoollock);
+    cubefamilies.free(c);
+    allocnodes--;
+    SDL_AtomicUnlock(&cubepoollock);
+}
+
 int familysize(const cube &c)
 {
     int size = 1;
@@ -92,15 +189,14 @@ void freeocta(cube *c)
 {
     if(!c) return;
     loopi(8) discardchildren(c[i]);
-    delete[] c;
-    allocnodes--;
+    freecubes(c);
 }
 
 void freecubeext(cube &c)
 {
     if(c.ext)
     {
-        delete[] (uchar *)c.ext;
+        freecubeext(c.ext);
         c.ext = NULL;
     }
 }
@@ -131,8 +227,8 @@ void discardchildren(cube &c, bool fixtex, int depth)
             loopi(6) c.texture[i] = getmippedtexture(c, i);
             if(depth > 0 && filled != F_EMPTY) c.faces[0] = F_SOLID;
         }
-        DELETEA(c.children);
-        allocnodes--;
+        freecubes(c.children);
+        c.children = NULL;
     }
 }
 
@@ -197,8 +293,9 @@ bool isvalidcube(const cube &c)
     return true;
 }
 
-void validatec(cube *c, int size)
+int validatec(cube *c, int size)
 {
+    int invalid = 0;
     loopi(8)
     {
         if(c[i].children)
@@ -207,13 +304,14 @@ void validatec(cube *c, int size)
             {
                 solidfaces(c[i]);
                 discardchildren(c[i], true);
+                invalid++;
             }
-            else validatec(c[i].children, size>>1);
+            else invalid += validatec(c[i].children, size>>1);
         }
         else if(size > 0x1000)
         {
             subdividecube(c[i], true, false);
-            validatec(c[i].children, size>>1);
+            invalid += validatec(c[i].children, size>>1);
         }
         else
         {
@@ -222,12 +320,14 @@ void validatec(cube *c, int size)
                 uint f = c[i].faces[j], e0 = f&0x0F0F0F0FU, e1 = (f>>4)&0x0F0F0F0FU;
                 if(e0 == e1 || ((e1+0x07070707U)|(e1-e0))&0xF0F0F0F0U)
                 {
+                    if(c[i].faces[0] | c[i].faces[1] | c[i].faces[2]) invalid++;
                     emptyfaces(c[i]);
                     break;
                 }
             }
         }
     }
+    return invalid;
 }
 
 ivec lu;
@@ -259,10 +359,86 @@ cube &lookupcube(const ivec &to, int tsize, ivec &ro, int &rsize)
     return *c;
 }
 
+// coarse grid over the world holding each cell's material when the whole cell has only one, so that
+// most point material queries from physics and the game never have to walk down the octree
+#define MATGRID_MIXED 0xFFFF // never a real material since volume index 7 is unused
+static ushort *matgrid = NULL;
+static int matgridscale = 0, matgridworldscale = 0;
+
+VARF(materialgrid, 0, 6, 7, genmaterialgrid());
+
+void clearmaterialgrid()
+{
+    DELETEA(matgrid);
+    matgridscale = matgridworldscale = 0;
+}
+
+static int uniformmaterial(const cube &c)
+{
+    if(!c.children) return c.material;
+    int mat = uniformmaterial(c.children[0]);
+    if(mat == MATGRID_MIXED) return mat;
+    for(int i = 1; i < 8; i++) if(uniformmaterial(c.children[i]) != mat) return MATGRID_MIXED;
+    return mat;
+}
+
+static inline ushort &materialgridcell(int x, int y, int z)
+{
+    return matgrid[(((z<<matgridscale) + y)<<matgridscale) + x];
+}
+
+static void fillmaterialgrid(const cube *c, const ivec &co, int size, int cellscale)
+{
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(c[i].children && size > 1<<cellscale) { fillmaterialgrid(c[i].children, o, size>>1, cellscale); continue; }
+        int mat = uniformmaterial(c[i]), cells = size>>cellscale;
+        o.shr(cellscale);
+        loop(z, cells) loop(y, cells) loop(x, cells) materialgridcell(o.x + x, o.y + y, o.z + z) = mat;
+    }
+}
+
+void genmaterialgrid()
+{
+    clearmaterialgrid();
+    if(!materialgrid || !worldroot || worldscale <= 0) return;
+    matgridscale = min(materialgrid, worldscale);
+    matgridworldscale = worldscale;
+    matgrid = new ushort[1<<(3*matgridscale)];
+    fillmaterialgrid(worldroot, ivec(0, 0, 0), worldsize>>1, worldscale - matgridscale);
+}
+
+void updatematerialgrid(const ivec &bbmin, const ivec &bbmax)
+{
+    if(!matgrid) return;
+    if(matgridworldscale != worldscale) { genmaterialgrid(); return; }
+    int cellscale = worldscale - matgridscale;
+    ivec cmin = ivec(bbmin).max(0).shr(cellscale), cmax = ivec(bbmax).min(worldsize-1).shr(cellscale);
+    for(int z = cmin.z; z <= cmax.z; z++) for(int y = cmin.y; y <= cmax.y; y++) for(int x = cmin.x; x <= cmax.x; x++)
+    {
+        ivec o = ivec(x, y, z).shl(cellscale);
+        int scale = worldscale-1;
+        const cube *c = &worldroot[octastep(o.x, o.y, o.z, scale)];
+        while(c->children && scale > cellscale)
+        {
+            scale--;
+            c = &c->children[octastep(o.x, o.y, o.z, scale)];
+        }
+        materialgridcell(x, y, z) = uniformmaterial(*c);
+    }
+}
+
 int lookupmaterial(const vec &v)
 {
     ivec o(v);
     if(!insideworld(o)) return MAT_AIR;
+    if(matgrid && matgridworldscale == worldscale)
+    {
+        int cellscale = worldscale - matgridscale,
+            mat = materialgridcell(o.x>>cellscale, o.y>>cellscale, o.z>>cellscale);
+        if(mat != MATGRID_MIXED) return mat;
+    }
     int scale = worldscale-1;
     cube *c = &worldroot[octastep(o.x, o.y, o.z, scale)];
     while(c->children)
@@ -273,8 +449,8 @@ int lookupmaterial(const vec &v)
     return c->material;
 }
 
-const cube *neighbourstack[32];
-int neighbourdepth = -1;
+thread_local const cube *neighbourstack[32];
+thread_local int neighbourdepth = -1;
 
 const cube &neighbourcube(const cube &c, int orient, const ivec &co, int size, ivec &ro, int &rsize)
 {
@@ -473,10 +649,82 @@ int visibleorient(const cube &c, int orient)
 }
 
 VAR(mipvis, 0, 0, 1);
+VARP(remipthreads, 0, 1, 1);
+
+// remip first runs the subtrees at REMIPTASKDEPTH on the job threads. a task only merges the cubes that
+// lie strictly inside its subtree, since their neighbours can never be in another task, and the cubes
+// touching its bounds are merged afterwards by a second pass on the main thread. an incremental remip
+// only revisits cubes overlapping a box changed by edits since the last remip, as everything else would
+// merge exactly as it did then
+#define REMIPTASKDEPTH 3
+#define MAXREMIPBOXES 64
+
+struct remipbox
+{
+    ivec bbmin, bbmax;
+};
+
+struct remiptask
+{
+    cube *c;
+    ivec co;
+    int size;
+    vector<cube> discards;
+};
+
+static vector<remiptask *> remiptasks;
+static vector<remipbox> remipboxes;
+static int remipworldscale = 0;
+static bool incrementalremip = false;
 
 static int remipprogress = 0, remiptotal = 0;
 
-bool remip(cube &c, const ivec &co, int size)
+void remipchanged(const ivec &bbmin, const ivec &bbmax)
+{
+    if(remipworldscale != worldscale) return;
+    if(remipboxes.length() >= MAXREMIPBOXES)
+    {
+        remipbox &b = remipboxes[0];
+        for(int i = 1; i < remipboxes.length(); i++)
+        {
+            b.bbmin.min(remipboxes[i].bbmin);
+            b.bbmax.max(remipboxes[i].bbmax);
+        }
+        remipboxes.setsize(1);
+    }
+    remipbox &b = remipboxes.add();
+    b.bbmin = ivec(bbmin).sub(1);
+    b.bbmax = ivec(bbmax).add(1);
+}
+
+void clearremipchanges()
+{
+    remipboxes.setsize(0);
+    remipworldscale = 0;
+}
+
+static bool remipoverlaps(const ivec &co, int size)
+{
+    loopv(remipboxes)
+    {
+        const remipbox &b = remipboxes[i];
+        if(co.x < b.bbmax.x && co.y < b.bbmax.y && co.z < b.bbmax.z &&
+           co.x + 2*size > b.bbmin.x && co.y + 2*size > b.bbmin.y && co.z + 2*size > b.bbmin.z)
+            return true;
+    }
+    return false;
+}
+
+static bool insideremiptask(const ivec &co, int size)
+{
+    int tasksize = worldsize>>REMIPTASKDEPTH;
+    if(2*size >= tasksize) return false;
+    ivec t = ivec(co).mask(~(tasksize-1));
+    return co.x > t.x && co.y > t.y && co.z > t.z &&
+           co.x + 2*size < t.x + tasksize && co.y + 2*size < t.y + tasksize && co.z + 2*size < t.z + tasksize;
+}
+
+static bool remip(remiptask *t, cube &c, const ivec &co, int size)
 {
     cube *ch = c.children;
     if(!ch)
@@ -485,14 +733,17 @@ bool remip(cube &c, const ivec &co, int size)
         subdividecube(c);
         ch = c.children;
     }
-    else if((remipprogress++&0xFFF)==1) renderprogress(float(remipprogress)/remiptotal, "remipping...");
+    else if(incrementalremip && !remipoverlaps(co, size)) return false;
+    else if(!t && insideremiptask(co, size)) return false;
+    else if(ismainthread() && (remipprogress++&0xFFF)==1) renderprogress(float(remipprogress)/remiptotal, "remipping...");
 
     bool perfect = true;
     loopi(8)
     {
         ivec o(i, co, size);
-        if(!remip(ch[i], o, size>>1)) perfect = false;
+        if(!remip(t, ch[i], o, size>>1)) perfect = false;
     }
+    if(t && !insideremiptask(co, size)) return false;
 
     solidfaces(c); // so texmip is more consistent
     loopj(6)
@@ -556,7 +807,17 @@ bool remip(cube &c, const ivec &co, int size)
     }
 
     freeocta(nh);
-    discardchildren(c);
+    if(t)
+    {
+        // vertex arrays and octree entities can only be freed on the main thread
+        t->discards.add(c);
+        c.ext = NULL;
+        c.children = NULL;
+        c.material = MAT_AIR;
+        c.visible = 0;
+        c.merged = 0;
+    }
+    else discardchildren(c);
     loopi(3) c.faces[i] = n.faces[i];
     c.material = mat;
     loopi(6) if(vis[i]) c.visible |= 1<<i;
@@ -565,23 +826,74 @@ bool remip(cube &c, const ivec &co, int size)
     return true;
 }
 
-void remip()
+static void genremiptask(void *data)
 {
+    remiptask &t = *(remiptask *)data;
+    remip(&t, *t.c, t.co, t.size);
+}
+
+static void splitremiptasks(int levels, cube *c = worldroot, const ivec &co = ivec(0, 0, 0), int size = worldsize>>1)
+{
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(!c[i].children)
+        {
+            if(size <= 0x1000) continue;
+            subdividecube(c[i]);
+        }
+        if(incrementalremip && !remipoverlaps(o, size>>1)) continue;
+        if(levels > 1) splitremiptasks(levels-1, c[i].children, o, size>>1);
+        else
+        {
+            remiptask *t = new remiptask;
+            t->c = &c[i];
+            t->co = o;
+            t->size = size>>1;
+            remiptasks.add(t);
+        }
+    }
+}
+
+void remip(bool incremental)
+{
+    incrementalremip = incremental && remipworldscale == worldscale;
     remipprogress = 1;
     remiptotal = allocnodes;
+
+    splitremiptasks(REMIPTASKDEPTH);
+    if(remipthreads && numcpus > 1)
+    {
+        jobgroup group;
+        loopv(remiptasks) addjob(genremiptask, NULL, remiptasks[i], &group, true);
+        waitjobs(&group, "remipping...");
+    }
+    else loopv(remiptasks) genremiptask(remiptasks[i]);
+    loopv(remiptasks)
+    {
+        vector<cube> &discards = remiptasks[i]->discards;
+        loopvj(discards) discardchildren(discards[j]);
+    }
+    remiptasks.deletecontents();
+
     loopi(8)
     {
         ivec o(i, ivec(0, 0, 0), worldsize>>1);
-        remip(worldroot[i], o, worldsize>>2);
+        remip(NULL, worldroot[i], o, worldsize>>2);
     }
+    incrementalremip = false;
+    remipboxes.setsize(0);
+    remipworldscale = worldscale;
     calcmerges();
 }
 
+// only the local remip is limited to the areas edited since the last one, remips received from other
+// clients stay full so that every client ends up with the same octree whatever it edited in between
 void mpremip(bool local)
 {
     extern selinfo sel;
     if(local) game::edittrigger(sel, EDIT_REMIP);
-    remip();
+    remip(local);
     allchanged();
 }
 
@@ -1816,3 +2128,54 @@ void calcmerges()
     genmerges();
 }
 
+
+static int countcubes(const cube *c)
+{
+    int n = 8;
+    loopi(8) if(c[i].children) n += countcubes(c[i].children);
+    return n;
+}
+
+// reports how much memory the octree's cube pools hold and times a full walk of the octree
+// along with random point lookups and rays against it
+void octabench(int *numqueries)
+{
+    int n = clamp(*numqueries > 0 ? *numqueries : 1000000, 1, 1<<24);
+    size_t familybytes = size_t(cubefamilies.used)*cubefamilies.size, extbytes = 0, extreserved = 0;
+    int numexts = 0;
+    loopi(CUBEEXTPOOLS)
+    {
+        numexts += cubeexts[i].used;
+        extbytes += size_t(cubeexts[i].used)*cubeexts[i].size;
+        extreserved += cubeexts[i].reserved();
+    }
+    conoutf("octabench: %d families in %.2f MB (%.2f MB reserved), %d cubeexts in %.2f MB (%.2f MB reserved)",
+        cubefamilies.used, familybytes/(1024.0f*1024.0f), cubefamilies.reserved()/(1024.0f*1024.0f),
+        numexts, extbytes/(1024.0f*1024.0f), extreserved/(1024.0f*1024.0f));
+
+    vector<ivec> points;
+    vector<vec> origins, rays;
+    loopi(n)
+    {
+        points.add(ivec(rnd(worldsize), rnd(worldsize), rnd(worldsize)));
+        origins.add(vec(rndscale(worldsize), rndscale(worldsize), rndscale(worldsize)));
+        vec dir(rndscale(2)-1, rndscale(2)-1, rndscale(2)-1);
+        if(dir.iszero()) dir = vec(0, 0, 1);
+        rays.add(dir.normalize());
+    }
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    int numcubes = countcubes(worldroot);
+    Uint64 walked = SDL_GetPerformanceCounter();
+    int solid = 0;
+    loopi(n) if(!isempty(lookupcube(points[i]))) solid++;
+    Uint64 looked = SDL_GetPerformanceCounter();
+    int hits = 0;
+    loopi(n) if(raycube(origins[i], rays[i], 0, RAY_CLIPMAT|RAY_POLY) >= 0) hits++;
+    Uint64 end = SDL_GetPerformanceCounter();
+
+    double freq = SDL_GetPerformanceFrequency();
+    conoutf("octabench: walked %d cubes in %.2f ms, %d lookups (%d solid) at %.2f Mlookups/s, %d rays (%d hits) at %.2f Mrays/s",
+        numcubes, (walked - start)*1000/freq, n, solid, n/((looked - walked)/freq)/1e6, n, hits, n/((end - looked)/freq)/1e6);
+}
+COMMAND(octabench, "i");
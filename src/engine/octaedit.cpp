@@ -582,6 +582,9 @@ void commitchanges(bool force)
 void changed(const ivec &bbmin, const ivec &bbmax, bool commit)
 {
     readychanges(bbmin, bbmax, worldroot, ivec(0, 0, 0), worldsize/2);
+    updatematerialgrid(bbmin, bbmax);
+    pvschanged(bbmin, bbmax);
+    remipchanged(bbmin, bbmax);
     haschanged = true;
 
     if(commit) commitchanges();
@@ -590,7 +593,11 @@ void changed(const ivec &bbmin, const ivec &bbmax, bool commit)
 void changed(const block3 &sel, bool commit)
 {
     if(sel.s.iszero()) return;
-    readychanges(ivec(sel.o).sub(1), ivec(sel.s).mul(sel.grid).add(sel.o).add(1), worldroot, ivec(0, 0, 0), worldsize/2);
+    ivec bbmin = ivec(sel.o).sub(1), bbmax = ivec(sel.s).mul(sel.grid).add(sel.o).add(1);
+    readychanges(bbmin, bbmax, worldroot, ivec(0, 0, 0), worldsize/2);
+    updatematerialgrid(bbmin, bbmax);
+    pvschanged(bbmin, bbmax);
+    remipchanged(bbmin, bbmax);
     haschanged = true;
 
     if(commit) commitchanges();
@@ -2498,6 +2505,7 @@ void mpreplacetex(int oldtex, int newtex, bool insel, selinfo &sel, bool local)
     else
     {
         loopi(8) replacetexcube(worldroot[i], oldtex, newtex);
+        clearremipchanges();
     }
     allchanged();
 }
@@ -0,0 +1,315 @@
+// octaio.cpp: map header and octree records, shared by worldio.cpp and the map tool
+
+#include "engine.h"
+
+void fixent(entity &e, int version)
+{
+    if(version <= 0)
+    {
+        if(e.type >= ET_DECAL) e.type++;
+    }
+}
+
+bool loadmapheader(stream *f, const char *ogzname, mapheader &hdr, octaheader &ohdr)
+{
+    if(f->read(&hdr, 3*sizeof(int)) != 3*sizeof(int)) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
+    lilswap(&hdr.version, 2);
+
+    if(!memcmp(hdr.magic, "TMAP", 4))
+    {
+        if(hdr.version>MAPVERSION) { conoutf(CON_ERROR, "map %s requires a newer version of Tesseract", ogzname); return false; }
+        if(f->read(&hdr.worldsize, 6*sizeof(int)) != 6*sizeof(int)) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
+        lilswap(&hdr.worldsize, 6);
+        if(hdr.worldsize <= 0|| hdr.numents < 0) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
+    }
+    else if(!memcmp(hdr.magic, "OCTA", 4))
+    {
+        if(hdr.version!=OCTAVERSION) { conoutf(CON_ERROR, "map %s uses an unsupported map format version", ogzname); return false; }
+        if(f->read(&ohdr.worldsize, 7*sizeof(int)) != 7*sizeof(int)) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
+        lilswap(&ohdr.worldsize, 7);
+        if(ohdr.worldsize <= 0|| ohdr.numents < 0) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
+        memcpy(hdr.magic, "TMAP", 4);
+        hdr.version = 0;
+        hdr.headersize = sizeof(hdr);
+        hdr.worldsize = ohdr.worldsize;
+        hdr.numents = ohdr.numents;
+        hdr.numpvs = ohdr.numpvs;
+        hdr.blendmap = ohdr.blendmap;
+        hdr.numvars = ohdr.numvars;
+        hdr.numvslots = ohdr.numvslots;
+    }
+    else { conoutf(CON_ERROR, "map %s uses an unsupported map type", ogzname); return false; }
+
+    return true;
+}
+
+#ifndef STANDALONE
+static int savemapprogress = 0;
+
+static void savec(cube *c, const ivec &o, int size, stream *f, bool nolms)
+{
+    if((savemapprogress++&0xFFF)==0) renderprogress(float(savemapprogress)/allocnodes, "saving octree...");
+
+    loopi(8)
+    {
+        ivec co(i, o, size);
+        if(c[i].children)
+        {
+            f->putchar(OCTSAV_CHILDREN);
+            savec(c[i].children, co, size>>1, f, nolms);
+        }
+        else
+        {
+            int oflags = 0, surfmask = 0, totalverts = 0;
+            if(c[i].material!=MAT_AIR) oflags |= 0x40;
+            if(isempty(c[i])) f->putchar(oflags | OCTSAV_EMPTY);
+            else
+            {
+                if(!nolms)
+                {
+                    if(c[i].merged) oflags |= 0x80;
+                    if(c[i].ext) loopj(6)
+                    {
+                        const surfaceinfo &surf = c[i].ext->surfaces[j];
+                        if(!surf.used()) continue;
+                        oflags |= 0x20;
+                        surfmask |= 1<<j;
+                        totalverts += surf.totalverts();
+                    }
+                }
+
+                if(isentirelysolid(c[i])) f->putchar(oflags | OCTSAV_SOLID);
+                else
+                {
+                    f->putchar(oflags | OCTSAV_NORMAL);
+                    f->write(c[i].edges, 12);
+                }
+            }
+
+            loopj(6) f->putlil<ushort>(c[i].texture[j]);
+
+            if(oflags&0x40) f->putlil<ushort>(c[i].material);
+            if(oflags&0x80) f->putchar(c[i].merged);
+            if(oflags&0x20)
+            {
+                f->putchar(surfmask);
+                f->putchar(totalverts);
+                loopj(6) if(surfmask&(1<<j))
+                {
+                    surfaceinfo surf = c[i].ext->surfaces[j];
+                    vertinfo *verts = c[i].ext->verts() + surf.verts;
+                    int layerverts = surf.numverts&MAXFACEVERTS, numverts = surf.totalverts(),
+                        vertmask = 0, vertorder = 0,
+                        dim = dimension(j), vc = C[dim], vr = R[dim];
+                    if(numverts)
+                    {
+                        if(c[i].merged&(1<<j))
+                        {
+                            vertmask |= 0x04;
+                            if(layerverts == 4)
+                            {
+                                ivec v[4] = { verts[0].getxyz(), verts[1].getxyz(), verts[2].getxyz(), verts[3].getxyz() };
+                                loopk(4)
+                                {
+                                    const ivec &v0 = v[k], &v1 = v[(k+1)&3], &v2 = v[(k+2)&3], &v3 = v[(k+3)&3];
+                                    if(v1[vc] == v0[vc] && v1[vr] == v2[vr] && v3[vc] == v2[vc] && v3[vr] == v0[vr])
+                                    {
+                                        vertmask |= 0x01;
+                                        vertorder = k;
+                                        break;
+                                    }
+                                }
+                            }
+                        }
+                        else
+                        {
+                            int vis = visibletris(c[i], j, co, size);
+                            if(vis&4 || faceconvexity(c[i], j) < 0) vertmask |= 0x01;
+                            if(layerverts < 4 && vis&2) vertmask |= 0x02;
+                        }
+                        bool matchnorm = true;
+                        loopk(numverts)
+                        {
+                            const vertinfo &v = verts[k];
+                            if(v.norm) { vertmask |= 0x80; if(v.norm != verts[0].norm) matchnorm = false; }
+                        }
+                        if(matchnorm) vertmask |= 0x08;
+                    }
+                    surf.verts = vertmask;
+                    f->write(&surf, sizeof(surf));
+                    bool hasxyz = (vertmask&0x04)!=0, hasnorm = (vertmask&0x80)!=0;
+                    if(layerverts == 4)
+                    {
+                        if(hasxyz && vertmask&0x01)
+                        {
+                            ivec v0 = verts[vertorder].getxyz(), v2 = verts[(vertorder+2)&3].getxyz();
+                            f->putlil<ushort>(v0[vc]); f->putlil<ushort>(v0[vr]);
+                            f->putlil<ushort>(v2[vc]); f->putlil<ushort>(v2[vr]);
+                            hasxyz = false;
+                        }
+                    }
+                    if(hasnorm && vertmask&0x08) { f->putlil<ushort>(verts[0].norm); hasnorm = false; }
+                    if(hasxyz || hasnorm) loopk(layerverts)
+                    {
+                        const vertinfo &v = verts[(k+vertorder)%layerverts];
+                        if(hasxyz)
+                        {
+                            ivec xyz = v.getxyz();
+                            f->putlil<ushort>(xyz[vc]); f->putlil<ushort>(xyz[vr]);
+                        }
+                        if(hasnorm) f->putlil<ushort>(v.norm);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static cube *loadchildren(stream *f, const ivec &co, int size, bool &failed);
+
+static void loadc(stream *f, cube &c, const ivec &co, int size, bool &failed)
+{
+    int octsav = f->getchar();
+    switch(octsav&0x7)
+    {
+        case OCTSAV_CHILDREN:
+            c.children = loadchildren(f, co, size>>1, failed);
+            return;
+
+        case OCTSAV_EMPTY:  emptyfaces(c);        break;
+        case OCTSAV_SOLID:  solidfaces(c);        break;
+        case OCTSAV_NORMAL: f->read(c.edges, 12); break;
+        default: failed = true; return;
+    }
+    loopi(6) c.texture[i] = f->getlil<ushort>();
+    if(octsav&0x40) c.material = f->getlil<ushort>();
+    if(octsav&0x80) c.merged = f->getchar();
+    if(octsav&0x20)
+    {
+        int surfmask, totalverts;
+        surfmask = f->getchar();
+        totalverts = f->getchar();
+        newcubeext(c, totalverts, false);
+        memset(c.ext->surfaces, 0, sizeof(c.ext->surfaces));
+        memset(c.ext->verts(), 0, totalverts*sizeof(vertinfo));
+        int offset = 0;
+        loopi(6) if(surfmask&(1<<i))
+        {
+            surfaceinfo &surf = c.ext->surfaces[i];
+            if(mapversion <= 0)
+            {
+                polysurfacecompat psurf;
+                f->read(&psurf, sizeof(polysurfacecompat));
+                surf.verts = psurf.verts;
+                surf.numverts = psurf.numverts;
+            }
+            else f->read(&surf, sizeof(surf));
+            int vertmask = surf.verts, numverts = surf.totalverts();
+            if(!numverts) { surf.verts = 0; continue; }
+            surf.verts = offset;
+            vertinfo *verts = c.ext->verts() + offset;
+            offset += numverts;
+            ivec v[4], n, vo = ivec(co).mask(0xFFF).shl(3);
+            int layerverts = surf.numverts&MAXFACEVERTS, dim = dimension(i), vc = C[dim], vr = R[dim], bias = 0;
+            genfaceverts(c, i, v);
+            bool hasxyz = (vertmask&0x04)!=0, hasuv = mapversion <= 0 && (vertmask&0x40)!=0, hasnorm = (vertmask&0x80)!=0;
+            if(hasxyz)
+            {
+                ivec e1, e2, e3;
+                n.cross((e1 = v[1]).sub(v[0]), (e2 = v[2]).sub(v[0]));
+                if(n.iszero()) n.cross(e2, (e3 = v[3]).sub(v[0]));
+                bias = -n.dot(ivec(v[0]).mul(size).add(vo));
+            }
+            else
+            {
+                int vis = layerverts < 4 ? (vertmask&0x02 ? 2 : 1) : 3, order = vertmask&0x01 ? 1 : 0, k = 0;
+                verts[k++].setxyz(v[order].mul(size).add(vo));
+                if(vis&1) verts[k++].setxyz(v[order+1].mul(size).add(vo));
+                verts[k++].setxyz(v[order+2].mul(size).add(vo));
+                if(vis&2) verts[k++].setxyz(v[(order+3)&3].mul(size).add(vo));
+            }
+            if(layerverts == 4)
+            {
+                if(hasxyz && vertmask&0x01)
+                {
+                    ushort c1 = f->getlil<ushort>(), r1 = f->getlil<ushort>(), c2 = f->getlil<ushort>(), r2 = f->getlil<ushort>();
+                    ivec xyz;
+                    xyz[vc] = c1; xyz[vr] = r1; xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
+                    verts[0].setxyz(xyz);
+                    xyz[vc] = c1; xyz[vr] = r2; xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
+                    verts[1].setxyz(xyz);
+                    xyz[vc] = c2; xyz[vr] = r2; xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
+                    verts[2].setxyz(xyz);
+                    xyz[vc] = c2; xyz[vr] = r1; xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
+                    verts[3].setxyz(xyz);
+                    hasxyz = false;
+                }
+                if(hasuv && vertmask&0x02)
+                {
+                    loopk(4) f->getlil<ushort>();
+                    if(surf.numverts&LAYER_DUP) loopk(4) f->getlil<ushort>();
+                    hasuv = false;
+                }
+            }
+            if(hasnorm && vertmask&0x08)
+            {
+                ushort norm = f->getlil<ushort>();
+                loopk(layerverts) verts[k].norm = norm;
+                hasnorm = false;
+            }
+            if(hasxyz || hasuv || hasnorm) loopk(layerverts)
+            {
+                vertinfo &v = verts[k];
+                if(hasxyz)
+                {
+                    ivec xyz;
+                    xyz[vc] = f->getlil<ushort>(); xyz[vr] = f->getlil<ushort>();
+                    xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
+                    v.setxyz(xyz);
+                }
+                if(hasuv) { f->getlil<ushort>(); f->getlil<ushort>(); }
+                if(hasnorm) v.norm = f->getlil<ushort>();
+            }
+            if(hasuv && surf.numverts&LAYER_DUP) loopk(layerverts) { f->getlil<ushort>(); f->getlil<ushort>(); }
+        }
+    }
+}
+
+static cube *loadchildren(stream *f, const ivec &co, int size, bool &failed)
+{
+    cube *c = newcubes();
+    loopi(8)
+    {
+        loadc(f, c[i], ivec(i, co, size), size, failed);
+        if(failed) break;
+    }
+    return c;
+}
+
+void saveoctree(stream *f, bool nolms)
+{
+    savemapprogress = 0;
+    savec(worldroot, ivec(0, 0, 0), worldsize>>1, f, nolms);
+}
+
+cube *loadoctree(stream *f, int size, bool &failed)
+{
+    return loadchildren(f, ivec(0, 0, 0), size>>1, failed);
+}
+
+void skiplightmaps(stream *f, int numlightmaps)
+{
+    loopi(numlightmaps)
+    {
+        int type = f->getchar();
+        if(type&0x80)
+        {
+            f->getlil<ushort>();
+            f->getlil<ushort>();
+        }
+        int bpp = 3;
+        if(type&(1<<4) && (type&0x0F)!=2) bpp = 4;
+        f->seek(bpp*LM_PACKW*LM_PACKH, SEEK_CUR);
+    }
+}
+#endif
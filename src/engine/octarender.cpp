@@ -267,10 +267,22 @@ struct sortval
      sortval() {}
 };
 
+// a face found while walking the octree, kept until its vertex array is built on a job thread
+struct cubeface
+{
+    VSlot *vslot;
+    int orient, size, convex, numverts, firstvert, tj, grassy, layer;
+    ushort texture, envmap;
+    bool alpha;
+};
+
 struct vacollect : verthash
 {
     ivec origin;
     int size;
+    vector<cubeface> faces;
+    vector<vec> facepos;
+    vector<ushort> facenorms;
     hashtable<sortkey, sortval> indices;
     hashtable<decalkey, sortval> decalindices;
     vector<ushort> skyindices;
@@ -288,6 +300,9 @@ struct vacollect : verthash
     void clear()
     {
         clearverts();
+        faces.setsize(0);
+        facepos.setsize(0);
+        facenorms.setsize(0);
         worldtris = skytris = decaltris = 0;
         indices.clear();
         decalindices.clear();
@@ -305,6 +320,42 @@ struct vacollect : verthash
         nogimax = ivec(INT_MIN, INT_MIN, INT_MIN);
     }
 
+    void addface(VSlot &vslot, int orient, int size, const vec *pos, int convex, ushort texture, const vertinfo *vinfo, int numverts, int tj = -1, ushort envmap = EMID_NONE, int grassy = 0, bool alpha = false, int layer = LAYER_TOP)
+    {
+        if(numverts <= 0) return;
+        cubeface &f = faces.add();
+        f.vslot = &vslot;
+        f.orient = orient;
+        f.size = size;
+        f.convex = convex;
+        f.numverts = numverts;
+        f.firstvert = facepos.length();
+        f.tj = tj;
+        f.grassy = grassy;
+        f.layer = layer;
+        f.texture = texture;
+        f.envmap = envmap;
+        f.alpha = alpha;
+        facepos.put(pos, numverts);
+        loopk(numverts) facenorms.add(vinfo ? vinfo[k].norm : 0);
+    }
+
+    // takes over everything the octree walk gathered for a va, leaving the walker's collection empty
+    void takefaces(vacollect &o)
+    {
+        origin = o.origin;
+        size = o.size;
+        faces.move(o.faces);
+        facepos.move(o.facepos);
+        facenorms.move(o.facenorms);
+        matsurfs.move(o.matsurfs);
+        mapmodels.move(o.mapmodels);
+        decals.move(o.decals);
+        extdecals.move(o.extdecals);
+        nogimin = o.nogimin;
+        nogimax = o.nogimax;
+    }
+
     void optimize()
     {
         enumeratekt(indices, sortkey, k, sortval, t,
@@ -448,7 +499,6 @@ struct vacollect : verthash
 
     void setupdata(vtxarray *va)
     {
-        optimize();
         gendecals();
 
         va->verts = verts.length();
@@ -611,16 +661,16 @@ struct vacollect : verthash
             loadgrassshaders();
         }
 
-        if(mapmodels.length()) va->mapmodels.put(mapmodels.getbuf(), mapmodels.length());
-        if(decals.length()) va->decals.put(decals.getbuf(), decals.length());
     }
 
     bool emptyva()
     {
-        return verts.empty() && matsurfs.empty() && skyindices.empty() && grasstris.empty() && mapmodels.empty() && decals.empty();
+        return faces.empty() && verts.empty() && matsurfs.empty() && skyindices.empty() && grasstris.empty() && mapmodels.empty() && decals.empty();
     }
 } vc;
 
+static vector<vacollect *> freevacollects;
+
 int recalcprogress = 0;
 #define progress(s)     if((recalcprogress++&0xFFF)==0) renderprogress(recalcprogress/(float)allocnodes, s);
 
@@ -664,7 +714,7 @@ extern const vec orientation_bitangent[6][6] =
     { vec( 0,  0,  1), vec( 0,  0,  1), vec( 0,  0,  1), vec( 0,  0,  1), vec( 0,  1,  0), vec( 0, -1,  0) }
 };
 
-void addtris(VSlot &vslot, int orient, const sortkey &key, vertex *verts, int *index, int numverts, int convex, int tj)
+static void addtris(vacollect &vc, VSlot &vslot, int orient, const sortkey &key, vertex *verts, int *index, int numverts, int convex, int tj)
 {
     int &total = key.tex==DEFAULT_SKY ? vc.skytris : vc.worldtris;
     int edge = orient*(MAXFACEVERTS+1);
@@ -752,7 +802,7 @@ void addtris(VSlot &vslot, int orient, const sortkey &key, vertex *verts, int *i
     }
 }
 
-void addgrasstri(int face, vertex *verts, int numv, ushort texture, int layer)
+static void addgrasstri(vacollect &vc, int face, vertex *verts, int numv, ushort texture, int layer)
 {
     grasstri &g = vc.grasstris.add();
     int i1, i2, i3, i4;
@@ -857,7 +907,7 @@ void guessnormals(const vec *pos, int numverts, vec *normals)
     normals[3] = n2;
 }
 
-void addcubeverts(VSlot &vslot, int orient, int size, vec *pos, int convex, ushort texture, vertinfo *vinfo, int numverts, int tj = -1, ushort envmap = EMID_NONE, int grassy = 0, bool alpha = false, int layer = LAYER_TOP)
+static void addcubeverts(vacollect &vc, VSlot &vslot, int orient, int size, const vec *pos, int convex, ushort texture, const ushort *norms, int numverts, int tj, ushort envmap, int grassy, bool alpha, int layer)
 {
     vec4 sgen, tgen;
     calctexgen(vslot, orient, sgen, tgen);
@@ -869,9 +919,9 @@ void addcubeverts(VSlot &vslot, int orient, int size, vec *pos, int convex, usho
         vertex &v = verts[k];
         v.pos = pos[k];
         v.tc = vec(sgen.dot(v.pos), tgen.dot(v.pos), 0);
-        if(vinfo && vinfo[k].norm)
+        if(norms[k])
         {
-            vec n = decodenormal(vinfo[k].norm), t = orientation_tangent[vslot.rotation][orient];
+            vec n = decodenormal(norms[k]), t = orientation_tangent[vslot.rotation][orient];
             t.project(n).normalize();
             v.norm = bvec(n);
             v.tangent = bvec4(bvec(t), orientation_bitangent[vslot.rotation][orient].scalartriple(n, t) < 0 ? 0 : 255);
@@ -906,7 +956,7 @@ void addcubeverts(VSlot &vslot, int orient, int size, vec *pos, int convex, usho
     }
 
     sortkey key(texture, vslot.scroll.iszero() ? O_ANY : orient, layer&LAYER_BOTTOM ? layer : LAYER_TOP, envmap, alpha ? (vslot.refractscale > 0 ? ALPHA_REFRACT : (vslot.alphaback ? ALPHA_BACK : ALPHA_FRONT)) : NO_ALPHA);
-    addtris(vslot, orient, key, verts, index, numverts, convex, tj);
+    addtris(vc, vslot, orient, key, verts, index, numverts, convex, tj);
 
     if(grassy)
     {
@@ -915,16 +965,25 @@ void addcubeverts(VSlot &vslot, int orient, int size, vec *pos, int convex, usho
             int faces = 0;
             if(index[0]!=index[i+1] && index[i+1]!=index[i+2] && index[i+2]!=index[0]) faces |= 1;
             if(i+3 < numverts && index[0]!=index[i+2] && index[i+2]!=index[i+3] && index[i+3]!=index[0]) faces |= 2;
-            if(grassy > 1 && faces==3) addgrasstri(i, verts, 4, texture, layer);
+            if(grassy > 1 && faces==3) addgrasstri(vc, i, verts, 4, texture, layer);
             else
             {
-                if(faces&1) addgrasstri(i, verts, 3, texture, layer);
-                if(faces&2) addgrasstri(i+1, verts, 3, texture, layer);
+                if(faces&1) addgrasstri(vc, i, verts, 3, texture, layer);
+                if(faces&2) addgrasstri(vc, i+1, verts, 3, texture, layer);
             }
         }
     }
 }
 
+static void genfaces(vacollect &vc)
+{
+    loopv(vc.faces)
+    {
+        const cubeface &f = vc.faces[i];
+        addcubeverts(vc, *f.vslot, f.orient, f.size, &vc.facepos[f.firstvert], f.convex, f.texture, &vc.facenorms[f.firstvert], f.numverts, f.tj, f.envmap, f.grassy, f.alpha, f.layer);
+    }
+}
+
 struct edgegroup
 {
     ivec slope, origin;
@@ -957,10 +1016,103 @@ struct cubeedge
     uchar index, flags;
 };
 
-vector<cubeedge> cubeedges;
-hashtable<edgegroup, int> edgegroups(1<<13);
+// t-joints are found in two passes on the job threads: the top of the octree is split into subtrees
+// whose edges are sorted by edge group into a fixed set of parts, then each part builds and sweeps its
+// own groups. subtrees and parts are always merged back in the same order, so every group sees its
+// edges in octree order and the result does not depend on how many threads ran
+#define TJOINTPARTBITS 4
+#define TJOINTPARTS (1<<TJOINTPARTBITS)
+
+static inline int tjointpart(const edgegroup &g)
+{
+    return (hthash(g)*0x9E3779B1U)>>(32-TJOINTPARTBITS);
+}
+
+struct edgeref
+{
+    edgegroup g;
+    cubeedge ce;
+};
+
+struct tjointref
+{
+    cube *c;
+    ushort offset;
+    uchar edge;
+    bool flip;
+};
+
+struct tjointtask
+{
+    const cube *stack[32];
+    int depth;
+    cube *c;
+    ivec co;
+    int size;
+    bool leaf;
+    vector<edgeref> edges[TJOINTPARTS];
+};
+
+struct tjointset
+{
+    int part;
+    vector<cubeedge> cubeedges;
+    hashtable<edgegroup, int> edgegroups;
+    vector<tjointref> found;
+
+    tjointset() : edgegroups(1<<10) {}
+};
+
+static vector<tjointtask *> tjointtasks;
+static tjointset tjointsets[TJOINTPARTS];
+
+VARP(tjointthreads, 0, 1, 1);
+
+static void addcubeedge(tjointset &s, const edgegroup &g, cubeedge &ce)
+{
+    bool insert = true;
+    int *exists = s.edgegroups.access(g);
+    if(exists)
+    {
+        int prev = -1, cur = *exists;
+        while(cur >= 0)
+        {
+            cubeedge &p = s.cubeedges[cur];
+            if(p.flags&CE_DUP ?
+                ce.offset>=p.offset && ce.offset+ce.size<=p.offset+p.size :
+                ce.offset==p.offset && ce.size==p.size)
+            {
+                p.flags |= CE_DUP;
+                insert = false;
+                break;
+            }
+            else if(ce.offset >= p.offset)
+            {
+                if(ce.offset == p.offset+p.size) ce.flags &= ~CE_START;
+                prev = cur;
+                cur = p.next;
+            }
+            else break;
+        }
+        if(insert)
+        {
+            ce.next = cur;
+            while(cur >= 0)
+            {
+                cubeedge &p = s.cubeedges[cur];
+                if(ce.offset+ce.size==p.offset) { ce.flags &= ~CE_END; break; }
+                cur = p.next;
+            }
+            if(prev>=0) s.cubeedges[prev].next = s.cubeedges.length();
+            else *exists = s.cubeedges.length();
+        }
+    }
+    else s.edgegroups[g] = s.cubeedges.length();
+
+    if(insert) s.cubeedges.add(ce);
+}
 
-void gencubeedges(cube &c, const ivec &co, int size)
+static void gencubeedges(tjointtask &t, cube &c, const ivec &co, int size)
 {
     ivec pos[MAXFACEVERTS];
     int vis;
@@ -1009,68 +1161,68 @@ void gencubeedges(cube &c, const ivec &co, int size)
             g.origin = ivec(pos[e1]).sub(ivec(d).mul(t1));
             g.slope = d;
             g.axis = axis;
-            cubeedge ce;
+            edgeref &r = t.edges[tjointpart(g)].add();
+            r.g = g;
+            cubeedge &ce = r.ce;
             ce.c = &c;
             ce.offset = t1;
             ce.size = t2 - t1;
             ce.index = i*(MAXFACEVERTS+1)+j;
             ce.flags = CE_START | CE_END | (e1!=j ? CE_FLIP : 0);
             ce.next = -1;
-
-            bool insert = true;
-            int *exists = edgegroups.access(g);
-            if(exists)
-            {
-                int prev = -1, cur = *exists;
-                while(cur >= 0)
-                {
-                    cubeedge &p = cubeedges[cur];
-                    if(p.flags&CE_DUP ?
-                        ce.offset>=p.offset && ce.offset+ce.size<=p.offset+p.size :
-                        ce.offset==p.offset && ce.size==p.size)
-                    {
-                        p.flags |= CE_DUP;
-                        insert = false;
-                        break;
-                    }
-                    else if(ce.offset >= p.offset)
-                    {
-                        if(ce.offset == p.offset+p.size) ce.flags &= ~CE_START;
-                        prev = cur;
-                        cur = p.next;
-                    }
-                    else break;
-                }
-                if(insert)
-                {
-                    ce.next = cur;
-                    while(cur >= 0)
-                    {
-                        cubeedge &p = cubeedges[cur];
-                        if(ce.offset+ce.size==p.offset) { ce.flags &= ~CE_END; break; }
-                        cur = p.next;
-                    }
-                    if(prev>=0) cubeedges[prev].next = cubeedges.length();
-                    else *exists = cubeedges.length();
-                }
-            }
-            else edgegroups[g] = cubeedges.length();
-
-            if(insert) cubeedges.add(ce);
         }
     }
 }
 
-void gencubeedges(cube *c = worldroot, const ivec &co = ivec(0, 0, 0), int size = worldsize>>1)
+static void gencubeedges(tjointtask &t, cube *c, const ivec &co, int size)
 {
-    progress("fixing t-joints...");
     neighbourstack[++neighbourdepth] = c;
     loopi(8)
     {
         ivec o(i, co, size);
         if(c[i].ext) c[i].ext->tjoints = -1;
-        if(c[i].children) gencubeedges(c[i].children, o, size>>1);
-        else if(!isempty(c[i])) gencubeedges(c[i], o, size);
+        if(c[i].children) gencubeedges(t, c[i].children, o, size>>1);
+        else if(!isempty(c[i])) gencubeedges(t, c[i], o, size);
+    }
+    --neighbourdepth;
+}
+
+static void gentjointtask(void *data)
+{
+    tjointtask &t = *(tjointtask *)data;
+    int depth = neighbourdepth;
+    memcpy(neighbourstack, t.stack, (t.depth+1)*sizeof(t.stack[0]));
+    neighbourdepth = t.depth;
+    if(t.leaf) gencubeedges(t, *t.c, t.co, t.size);
+    else gencubeedges(t, t.c, t.co, t.size);
+    neighbourdepth = depth;
+}
+
+static void addtjointtask(cube *c, const ivec &co, int size, bool leaf)
+{
+    tjointtask *t = new tjointtask;
+    memcpy(t->stack, neighbourstack, (neighbourdepth+1)*sizeof(t->stack[0]));
+    t->depth = neighbourdepth;
+    t->c = c;
+    t->co = co;
+    t->size = size;
+    t->leaf = leaf;
+    tjointtasks.add(t);
+}
+
+static void splittjointtasks(int levels, cube *c = worldroot, const ivec &co = ivec(0, 0, 0), int size = worldsize>>1)
+{
+    neighbourstack[++neighbourdepth] = c;
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(c[i].ext) c[i].ext->tjoints = -1;
+        if(c[i].children)
+        {
+            if(levels > 1) splittjointtasks(levels-1, c[i].children, o, size>>1);
+            else addtjointtask(c[i].children, o, size>>1, false);
+        }
+        else if(!isempty(c[i])) addtjointtask(&c[i], o, size, true);
     }
     --neighbourdepth;
 }
@@ -1117,14 +1269,14 @@ void gencubeverts(cube &c, const ivec &co, int size, int csi)
         int hastj = tj >= 0 && tjoints[tj].edge < (i+1)*(MAXFACEVERTS+1) ? tj : -1;
         int grassy = vslot.slot->grass && i!=O_BOTTOM ? (vis!=3 || convex ? 1 : 2) : 0;
         if(!c.ext)
-            addcubeverts(vslot, i, size, pos, convex, c.texture[i], NULL, numverts, hastj, envmap, grassy, (c.material&MAT_ALPHA)!=0);
+            vc.addface(vslot, i, size, pos, convex, c.texture[i], NULL, numverts, hastj, envmap, grassy, (c.material&MAT_ALPHA)!=0);
         else
         {
             const surfaceinfo &surf = c.ext->surfaces[i];
             if(!surf.numverts || surf.numverts&LAYER_TOP)
-                addcubeverts(vslot, i, size, pos, convex, c.texture[i], verts, numverts, hastj, envmap, grassy, (c.material&MAT_ALPHA)!=0, surf.numverts&LAYER_BLEND);
+                vc.addface(vslot, i, size, pos, convex, c.texture[i], verts, numverts, hastj, envmap, grassy, (c.material&MAT_ALPHA)!=0, surf.numverts&LAYER_BLEND);
             if(surf.numverts&LAYER_BOTTOM)
-                addcubeverts(layer ? *layer : vslot, i, size, pos, convex, vslot.layer, verts, numverts, hastj, envmap2, 0, false, surf.numverts&LAYER_TOP ? LAYER_BOTTOM : LAYER_TOP);
+                vc.addface(layer ? *layer : vslot, i, size, pos, convex, vslot.layer, verts, numverts, hastj, envmap2, 0, false, surf.numverts&LAYER_TOP ? LAYER_BOTTOM : LAYER_TOP);
         }
     }
 }
@@ -1135,20 +1287,50 @@ int allocva = 0;
 int wtris = 0, wverts = 0, vtris = 0, vverts = 0, glde = 0, gbatches = 0;
 vector<vtxarray *> valist, varoot;
 
-vtxarray *newva(const ivec &o, int size)
+// the faces gathered for each new va are turned into vertices on the job threads while the octree walk
+// goes on, but the finished vas are still packed into vbos one at a time in the order they were made, so
+// the buffers come out exactly as if everything had been built in sequence
+struct vabuild
 {
-    vtxarray *va = new vtxarray;
-    va->parent = NULL;
-    va->o = o;
-    va->size = size;
-    va->curvfc = VFC_NOT_VISIBLE;
-    va->occluded = OCCLUDE_NOTHING;
-    va->query = NULL;
-    va->bbmin = va->alphamin = va->refractmin = va->skymin = ivec(-1, -1, -1);
-    va->bbmax = va->alphamax = va->refractmax = va->skymax = ivec(-1, -1, -1);
-    va->hasmerges = 0;
-    va->mergelevel = -1;
+    vtxarray *va;
+    vacollect *vc;
+    jobgroup group;
+};
+
+static vector<vabuild *> vabuilds;
+static int vabuildhead = 0;
+
+VARP(vathreads, 0, 1, 1);
+
+static void genvabuild(void *data)
+{
+    vabuild &b = *(vabuild *)data;
+    genfaces(*b.vc);
+    b.vc->optimize();
+}
+
+static void calcgeombb(vacollect &vc, const ivec &co, int size, ivec &bbmin, ivec &bbmax)
+{
+    vec vmin(co), vmax = vmin;
+    vmin.add(size);
+
+    loopv(vc.verts)
+    {
+        const vec &v = vc.verts[i].pos;
+        vmin.min(v);
+        vmax.max(v);
+    }
+
+    bbmin = ivec(vmin.mul(8)).shr(3);
+    bbmax = ivec(vmax.mul(8)).add(7).shr(3);
+}
+
+static void finishva(vabuild &b)
+{
+    waitjobs(&b.group);
 
+    vtxarray *va = b.va;
+    vacollect &vc = *b.vc;
     vc.setupdata(va);
 
     if(va->alphafronttris || va->alphabacktris || va->refracttris)
@@ -1168,12 +1350,66 @@ vtxarray *newva(const ivec &o, int size)
         va->skymin = ivec(vec(vc.skymin).mul(8)).shr(3);
         va->skymax = ivec(vec(vc.skymax).mul(8)).add(7).shr(3);
     }
-        
+
     va->nogimin = vc.nogimin;
     va->nogimax = vc.nogimax;
 
     wverts += va->verts;
     wtris  += va->tris + va->blends + va->alphabacktris + va->alphafronttris + va->refracttris + va->decaltris;
+
+    calcgeombb(vc, va->o, va->size, va->geommin, va->geommax);
+    calcmatbb(va, va->o, va->size, vc.matsurfs);
+
+    vc.clear();
+    freevacollects.add(&vc);
+    delete &b;
+}
+
+static void finishvas(int maxpending = 0)
+{
+    while(vabuilds.length() - vabuildhead > maxpending) finishva(*vabuilds[vabuildhead++]);
+    if(vabuildhead >= vabuilds.length())
+    {
+        vabuilds.setsize(0);
+        vabuildhead = 0;
+    }
+}
+
+vtxarray *newva(const ivec &o, int size)
+{
+    vtxarray *va = new vtxarray;
+    va->parent = NULL;
+    va->o = o;
+    va->size = size;
+    va->curvfc = VFC_NOT_VISIBLE;
+    va->occluded = OCCLUDE_NOTHING;
+    va->query = NULL;
+    va->bbmin = va->alphamin = va->refractmin = va->skymin = ivec(-1, -1, -1);
+    va->bbmax = va->alphamax = va->refractmax = va->skymax = ivec(-1, -1, -1);
+    va->hasmerges = 0;
+    va->mergelevel = -1;
+
+    // entity lists are needed right away by the walk of any enclosing va
+    if(vc.mapmodels.length()) va->mapmodels.put(vc.mapmodels.getbuf(), vc.mapmodels.length());
+    if(vc.decals.length()) va->decals.put(vc.decals.getbuf(), vc.decals.length());
+
+    vabuild *b = new vabuild;
+    b->va = va;
+    if(freevacollects.empty()) freevacollects.add(new vacollect)->clear();
+    b->vc = freevacollects.pop();
+    b->vc->takefaces(vc);
+    vabuilds.add(b);
+    if(vathreads && numcpus > 1)
+    {
+        addjob(genvabuild, NULL, b, &b->group, true);
+        finishvas(4*numcpus);
+    }
+    else
+    {
+        genvabuild(b);
+        finishvas();
+    }
+
     allocva++;
     valist.add(va);
 
@@ -1379,7 +1615,7 @@ void addmergedverts(int level, const ivec &o)
         }
         VSlot &vslot = lookupvslot(mf.tex, true);
         int grassy = vslot.slot->grass && mf.orient!=O_BOTTOM && mf.numverts&LAYER_TOP ? 2 : 0;
-        addcubeverts(vslot, mf.orient, 1<<level, pos, 0, mf.tex, mf.verts, numverts, mf.tjoints, mf.envmap, grassy, (mf.mat&MAT_ALPHA)!=0, mf.numverts&LAYER_BLEND);
+        vc.addface(vslot, mf.orient, 1<<level, pos, 0, mf.tex, mf.verts, numverts, mf.tjoints, mf.envmap, grassy, (mf.mat&MAT_ALPHA)!=0, mf.numverts&LAYER_BLEND);
         vahasmerges |= MERGE_USE;
     }
     mfl.setsize(0);
@@ -1453,22 +1689,6 @@ void rendercube(cube &c, const ivec &co, int size, int csi, int &maxlevel) // cr
     if(csi <= MAXMERGELEVEL && vamerges[csi].length()) addmergedverts(csi, co);
 }
 
-void calcgeombb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
-{
-    vec vmin(co), vmax = vmin;
-    vmin.add(size);
-
-    loopv(vc.verts)
-    {
-        const vec &v = vc.verts[i].pos;
-        vmin.min(v);
-        vmax.max(v);
-    }
-
-    bbmin = ivec(vmin.mul(8)).shr(3);
-    bbmax = ivec(vmax.mul(8)).add(7).shr(3);
-}
-
 static int entdepth = -1;
 static octaentities *entstack[32];
 
@@ -1495,8 +1715,6 @@ void setva(cube &c, const ivec &co, int size, int csi)
     {
         vtxarray *va = newva(co, size);
         ext(c).va = va;
-        calcgeombb(co, size, va->geommin, va->geommax);
-        calcmatbb(va, co, size, vc.matsurfs);
         va->hasmerges = vahasmerges;
         va->mergelevel = vamergemax;
     }
@@ -1598,40 +1816,29 @@ int updateva(cube *c, const ivec &co, int size, int csi)
     return ccount;
 }
 
-void addtjoint(const edgegroup &g, const cubeedge &e, int offset)
+static void addtjoint(tjointset &s, const edgegroup &g, const cubeedge &e, int offset)
 {
     int vcoord = (g.slope[g.axis]*offset + g.origin[g.axis]) & 0x7FFF;
-    tjoint &tj = tjoints.add();
-    tj.offset = vcoord / g.slope[g.axis];
-    tj.edge = e.index;
-
-    int prev = -1, cur = ext(*e.c).tjoints;
-    while(cur >= 0)
-    {
-        tjoint &o = tjoints[cur];
-        if(tj.edge < o.edge || (tj.edge==o.edge && (e.flags&CE_FLIP ? tj.offset > o.offset : tj.offset < o.offset))) break;
-        prev = cur;
-        cur = o.next;
-    }
-
-    tj.next = cur;
-    if(prev < 0) e.c->ext->tjoints = tjoints.length()-1;
-    else tjoints[prev].next = tjoints.length()-1;
+    tjointref &r = s.found.add();
+    r.c = e.c;
+    r.offset = vcoord / g.slope[g.axis];
+    r.edge = e.index;
+    r.flip = (e.flags&CE_FLIP)!=0;
 }
 
-void findtjoints(int cur, const edgegroup &g)
+static void findtjoints(tjointset &s, int cur, const edgegroup &g)
 {
     int active = -1;
     while(cur >= 0)
     {
-        cubeedge &e = cubeedges[cur];
+        cubeedge &e = s.cubeedges[cur];
         int prevactive = -1, curactive = active;
         while(curactive >= 0)
         {
-            cubeedge &a = cubeedges[curactive];
+            cubeedge &a = s.cubeedges[curactive];
             if(a.offset+a.size <= e.offset)
             {
-                if(prevactive >= 0) cubeedges[prevactive].next = a.next;
+                if(prevactive >= 0) s.cubeedges[prevactive].next = a.next;
                 else active = a.next;
             }
             else
@@ -1640,16 +1847,16 @@ void findtjoints(int cur, const edgegroup &g)
                 if(!(a.flags&CE_DUP))
                 {
                     if(e.flags&CE_START && e.offset > a.offset && e.offset < a.offset+a.size)
-                        addtjoint(g, a, e.offset);
+                        addtjoint(s, g, a, e.offset);
                     if(e.flags&CE_END && e.offset+e.size > a.offset && e.offset+e.size < a.offset+a.size)
-                        addtjoint(g, a, e.offset+e.size);
+                        addtjoint(s, g, a, e.offset+e.size);
                 }
                 if(!(e.flags&CE_DUP))
                 {
                     if(a.flags&CE_START && a.offset > e.offset && a.offset < e.offset+e.size)
-                        addtjoint(g, e, a.offset);
+                        addtjoint(s, g, e, a.offset);
                     if(a.flags&CE_END && a.offset+a.size > e.offset && a.offset+a.size < e.offset+e.size)
-                        addtjoint(g, e, a.offset+a.size);
+                        addtjoint(s, g, e, a.offset+a.size);
                 }
             }
             curactive = a.next;
@@ -1661,14 +1868,76 @@ void findtjoints(int cur, const edgegroup &g)
     }
 }
 
+static void gentjointset(void *data)
+{
+    tjointset &s = *(tjointset *)data;
+    loopv(tjointtasks)
+    {
+        vector<edgeref> &edges = tjointtasks[i]->edges[s.part];
+        loopvj(edges) addcubeedge(s, edges[j].g, edges[j].ce);
+    }
+    enumeratekt(s.edgegroups, edgegroup, g, int, e, findtjoints(s, e, g));
+    s.cubeedges.setsize(0);
+    s.edgegroups.clear();
+}
+
+static void addtjoint(const tjointref &r)
+{
+    tjoint &tj = tjoints.add();
+    tj.offset = r.offset;
+    tj.edge = r.edge;
+
+    int prev = -1, cur = ext(*r.c).tjoints;
+    while(cur >= 0)
+    {
+        tjoint &o = tjoints[cur];
+        if(tj.edge < o.edge || (tj.edge==o.edge && (r.flip ? tj.offset > o.offset : tj.offset < o.offset))) break;
+        prev = cur;
+        cur = o.next;
+    }
+
+    tj.next = cur;
+    if(prev < 0) r.c->ext->tjoints = tjoints.length()-1;
+    else tjoints[prev].next = tjoints.length()-1;
+}
+
+static void runtjointjobs(jobfunc work, void **data, int num)
+{
+    if(tjointthreads && numcpus > 1)
+    {
+        jobgroup group;
+        loopi(num) addjob(work, NULL, data[i], &group, true);
+        waitjobs(&group, "fixing t-joints...");
+    }
+    else loopi(num)
+    {
+        if(!(i&0x3F)) renderprogress(float(i)/num, "fixing t-joints...");
+        work(data[i]);
+    }
+}
+
 void findtjoints()
 {
-    recalcprogress = 0;
-    gencubeedges();
+    startloadphase("collecting t-joint edges");
     tjoints.setsize(0);
-    enumeratekt(edgegroups, edgegroup, g, int, e, findtjoints(e, g));
-    cubeedges.setsize(0);
-    edgegroups.clear();
+    splittjointtasks(3);
+    runtjointjobs(gentjointtask, (void **)tjointtasks.getbuf(), tjointtasks.length());
+
+    startloadphase("resolving t-joints");
+    void *sets[TJOINTPARTS];
+    loopi(TJOINTPARTS)
+    {
+        tjointsets[i].part = i;
+        sets[i] = &tjointsets[i];
+    }
+    runtjointjobs(gentjointset, sets, TJOINTPARTS);
+    tjointtasks.deletecontents();
+    loopi(TJOINTPARTS)
+    {
+        vector<tjointref> &found = tjointsets[i].found;
+        loopvj(found) addtjoint(found[j]);
+        found.setsize(0);
+    }
 }
 
 void octarender()                               // creates va s for all leaf cubes that don't already have them
@@ -1679,6 +1948,7 @@ void octarender()                               // creates va s for all leaf cub
     recalcprogress = 0;
     varoot.setsize(0);
     updateva(worldroot, ivec(0, 0, 0), worldsize/2, csi-1);
+    finishvas();
     loadprogress = 0;
     flushvbo();
 
@@ -1711,6 +1981,8 @@ void precachetextures()
             }
         }
     }
+    loopv(texs) lookupvslot(texs[i], false).slot->preload();
+    waitslotpreloads();
     loopv(texs)
     {
         loadprogress = float(i+1)/texs.length();
@@ -1722,24 +1994,37 @@ void precachetextures()
 void allchanged(bool load)
 {
     renderprogress(0, "clearing vertex arrays...");
+    startloadphase("clearing vertex arrays");
     clearvas(worldroot);
     resetqueries();
     resetclipplanes();
+    genmaterialgrid();
     if(load) initenvmaps();
     entitiesinoctanodes();
     tjoints.setsize(0);
     if(filltjoints) findtjoints();
+    startloadphase("generating vertex arrays");
     octarender();
-    if(load) precachetextures();
+    if(load)
+    {
+        startloadphase("precaching textures");
+        precachetextures();
+    }
+    startloadphase("setting up materials");
     setupmaterials();
     clearshadowcache();
     updatevabbs(true);
     if(load)
     {
+        startloadphase("generating shadow meshes");
         genshadowmeshes();
+        startloadphase("updating blend textures");
         updateblendtextures();
+        startloadphase("seeding particles");
         seedparticles();
+        startloadphase("generating environment maps");
         genenvmaps();
+        startloadphase("drawing minimap");
         drawminimap();
     }
 }
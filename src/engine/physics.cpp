@@ -6,32 +6,127 @@
 #include "engine.h"
 #include "mpr.h"
 
-const int MAXCLIPPLANES = 1024;
-static clipplanes clipcache[MAXCLIPPLANES];
-static int clipcacheversion = -2;
+// clip planes are cached per thread, so physics jobs never share entries and a hit hands back a
+// reference into the cache without copying or locking. Each cache is set-associative and evicts
+// stale entries first and then the least recently used one, going by a per-cache use counter.
+enum { CLIPCACHEWAYS = 4 };
 
-static inline clipplanes &getclipplanes(const cube &c, const ivec &o, int size, bool collide = true, int offset = 0)
+struct clipcacheentry
 {
-    clipplanes &p = clipcache[int(&c - worldroot)&(MAXCLIPPLANES-1)];
-    if(p.owner != &c || p.version != clipcacheversion+offset)
+    uint lastuse;
+    clipplanes planes;
+};
+
+static int clipcachesets = 0, clipcachegen = 0, clipcacheversion = -2;
+
+struct clipcache
+{
+    clipcacheentry *entries;
+    int setmask, gen;
+    uint usecount;
+    int misses, evictions;
+
+    clipcache() : entries(NULL), setmask(0), gen(-1), usecount(0), misses(0), evictions(0) {}
+    ~clipcache() { DELETEA(entries); }
+
+    // resizing or clearing only bumps clipcachegen, each thread then redoes its own cache
+    // on its next lookup, so no other thread's entries are touched while jobs run
+    void sync()
     {
-        p.owner = &c;
-        p.version = clipcacheversion+offset;
-        genclipplanes(c, o, size, p, collide);
+        if(gen == clipcachegen) return;
+        // a single set serves until the first map load sizes the caches
+        int sets = max(clipcachesets, 1);
+        if(!entries || setmask != sets-1)
+        {
+            DELETEA(entries);
+            entries = new clipcacheentry[sets*CLIPCACHEWAYS];
+            setmask = sets-1;
+        }
+        loopi(sets*CLIPCACHEWAYS)
+        {
+            clipcacheentry &e = entries[i];
+            e.lastuse = 0;
+            e.planes.owner = NULL;
+            e.planes.version = -1;
+        }
+        usecount = 0;
+        misses = evictions = 0;
+        gen = clipcachegen;
     }
+};
+
+static thread_local clipcache threadclipcache;
+
+static void resizeclipcache(int size)
+{
+    int sets = 1;
+    while(sets*2*CLIPCACHEWAYS <= size) sets *= 2;
+    if(sets == clipcachesets) return;
+    clipcachesets = sets;
+    clipcachegen++;
+}
+
+VARF(clipcachesize, 1024, 4096, 1<<20, { if(clipcachesets) resizeclipcache(clipcachesize); });
+
+static inline const clipplanes &getclipplanes(const cube &c, const ivec &o, int size, bool collide = true, int offset = 0)
+{
+    clipcache &cache = threadclipcache;
+    cache.sync();
+    int version = clipcacheversion+offset;
+    uint h = uint(size_t(&c)/sizeof(cube))*0x9E3779B1U;
+    clipcacheentry *set = &cache.entries[((h>>4)&cache.setmask)*CLIPCACHEWAYS], *victim = NULL;
+    bool stale = false;
+    loopi(CLIPCACHEWAYS)
+    {
+        clipcacheentry &e = set[i];
+        if(e.planes.owner == &c && e.planes.version == version)
+        {
+            e.lastuse = ++cache.usecount;
+            return e.planes;
+        }
+        if(stale) continue;
+        if(e.planes.version != clipcacheversion && e.planes.version != clipcacheversion+1) { victim = &e; stale = true; }
+        else if(!victim || e.lastuse < victim->lastuse) victim = &e;
+    }
+    cache.misses++;
+    if(!stale) cache.evictions++;
+    clipplanes &p = victim->planes;
+    genclipplanes(c, o, size, p, collide);
+    p.owner = &c;
+    p.version = version;
+    victim->lastuse = ++cache.usecount;
     return p;
 }
 
 void resetclipplanes()
 {
+    if(!clipcachesets) resizeclipcache(clipcachesize);
     clipcacheversion += 2;
     if(!clipcacheversion)
     {
-        memset(clipcache, 0, sizeof(clipcache));
+        clipcachegen++;
         clipcacheversion = 2;
     }
 }
 
+// reports the calling thread's cache, physics jobs keep their own
+static void clipcachestats()
+{
+    clipcache &cache = threadclipcache;
+    int used = 0;
+    if(cache.entries) loopi((cache.setmask+1)*CLIPCACHEWAYS)
+    {
+        const clipplanes &p = cache.entries[i].planes;
+        if(p.owner && (p.version == clipcacheversion || p.version == clipcacheversion+1)) used++;
+    }
+    conoutf("clip cache: %d/%d entries, %d misses, %d evictions", used, cache.entries ? (cache.setmask+1)*CLIPCACHEWAYS : 0, cache.misses, cache.evictions);
+}
+COMMAND(clipcachestats, "");
+
+// collision queries tallied by benchmarks
+static bool countingphysics = false;
+static physcounts curphyscounts;
+
 /////////////////////////  ray - cube collision ///////////////////////////////////////////////
 
 static inline bool pointinbox(const vec &v, const vec &bo, const vec &br)
@@ -99,7 +194,7 @@ bool pointincube(const clipplanes &p, const vec &v)
          else if(v[i] < p.o[i]-p.r[i] || v[i] > p.o[i]+p.r[i]) exit; \
     }
 
-vec hitsurface;
+thread_local vec hitsurface;
 
 static inline bool raycubeintersect(const clipplanes &p, const cube &c, const vec &v, const vec &ray, const vec &invray, float maxdist, float &dist)
 {
@@ -277,6 +372,7 @@ static float shadowent(octaentities *oc, const vec &o, const vec &ray, float rad
 
 float raycube(const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
 {
+    if(countingphysics) curphyscounts.rays++;
     if(ray.iszero()) return 0;
 
     INITRAYCUBE;
@@ -409,12 +505,377 @@ float rayfloor(const vec &o, vec &floor, int mode, float radius)
     return dist;
 }
 
+/////////////////////////  packet ray - cube collision  /////////////////////////////////////////
+
+// traces up to four rays at once down the octree, visiting each node only once for the whole
+// packet and testing all rays against it together, which pays off for coherent rays such as
+// shotgun spreads or many line of sight checks from one eye position
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define RAYPACKETSSE
+#endif
+
+#define RAYPACKETMODES (RAY_ALPHAPOLY|RAY_CLIPMAT|RAY_SHADOW)
+
+struct raypacket
+{
+    float ox[4], oy[4], oz[4], dx[4], dy[4], dz[4], ix[4], iy[4], iz[4], best[4];
+    const vec *o[4], *ray[4];
+    int mode, order;
+};
+
+#ifdef RAYPACKETSSE
+typedef __m128 raylanes;
+static inline raylanes zerolanes() { return _mm_setzero_ps(); }
+static inline raylanes loadlanes(const float *f) { return _mm_loadu_ps(f); }
+static inline void storelanes(float *f, const raylanes &a) { _mm_storeu_ps(f, a); }
+static inline raylanes lanesmin(const raylanes &a, const raylanes &b) { return _mm_min_ps(a, b); }
+static inline raylanes lanesmax(const raylanes &a, const raylanes &b) { return _mm_max_ps(a, b); }
+static inline raylanes lanesmid(const raylanes &a, const raylanes &b) { return _mm_mul_ps(_mm_add_ps(a, b), _mm_set1_ps(0.5f)); }
+static inline raylanes lanesslab(float c, const float *o, const float *inv) { return _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(c), _mm_loadu_ps(o)), _mm_loadu_ps(inv)); }
+static inline int laneswithin(const raylanes &a, const raylanes &b) { return _mm_movemask_ps(_mm_cmple_ps(a, b)); }
+#else
+struct raylanes { float v[4]; };
+static inline raylanes zerolanes() { raylanes r; loopk(4) r.v[k] = 0; return r; }
+static inline raylanes loadlanes(const float *f) { raylanes r; loopk(4) r.v[k] = f[k]; return r; }
+static inline void storelanes(float *f, const raylanes &a) { loopk(4) f[k] = a.v[k]; }
+static inline raylanes lanesmin(const raylanes &a, const raylanes &b) { raylanes r; loopk(4) r.v[k] = min(a.v[k], b.v[k]); return r; }
+static inline raylanes lanesmax(const raylanes &a, const raylanes &b) { raylanes r; loopk(4) r.v[k] = max(a.v[k], b.v[k]); return r; }
+static inline raylanes lanesmid(const raylanes &a, const raylanes &b) { raylanes r; loopk(4) r.v[k] = 0.5f*(a.v[k] + b.v[k]); return r; }
+static inline raylanes lanesslab(float c, const float *o, const float *inv) { raylanes r; loopk(4) r.v[k] = (c - o[k])*inv[k]; return r; }
+static inline int laneswithin(const raylanes &a, const raylanes &b) { int mask = 0; loopk(4) if(a.v[k] <= b.v[k]) mask |= 1<<k; return mask; }
+#endif
+
+// clips the lanes against the cube's planes and bounding box like raycubeintersect
+static inline int packetplanes(const raypacket &p, const clipplanes &c, int active, float *enter)
+{
+#ifdef RAYPACKETSSE
+    __m128 ox = _mm_loadu_ps(p.ox), oy = _mm_loadu_ps(p.oy), oz = _mm_loadu_ps(p.oz),
+           dx = _mm_loadu_ps(p.dx), dy = _mm_loadu_ps(p.dy), dz = _mm_loadu_ps(p.dz),
+           zero = _mm_setzero_ps(),
+           tmin = _mm_set1_ps(-1e16f), tmax = _mm_set1_ps(1e16f), miss = zero;
+    loopi(c.size)
+    {
+        const plane &pl = c.p[i];
+        __m128 nx = _mm_set1_ps(pl.x), ny = _mm_set1_ps(pl.y), nz = _mm_set1_ps(pl.z),
+               pdist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, ox), _mm_mul_ps(ny, oy)), _mm_add_ps(_mm_mul_ps(nz, oz), _mm_set1_ps(pl.offset))),
+               facing = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, dx), _mm_mul_ps(ny, dy)), _mm_mul_ps(nz, dz)),
+               t = _mm_div_ps(pdist, _mm_sub_ps(zero, facing)),
+               enters = _mm_cmplt_ps(facing, zero), exits = _mm_cmpgt_ps(facing, zero);
+        tmin = _mm_or_ps(_mm_and_ps(enters, _mm_max_ps(tmin, t)), _mm_andnot_ps(enters, tmin));
+        tmax = _mm_or_ps(_mm_and_ps(exits, _mm_min_ps(tmax, t)), _mm_andnot_ps(exits, tmax));
+        miss = _mm_or_ps(miss, _mm_and_ps(_mm_cmpeq_ps(facing, zero), _mm_cmpgt_ps(pdist, zero)));
+    }
+    __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(c.o.x - c.r.x), ox), _mm_loadu_ps(p.ix)),
+           x2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(c.o.x + c.r.x), ox), _mm_loadu_ps(p.ix)),
+           y1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(c.o.y - c.r.y), oy), _mm_loadu_ps(p.iy)),
+           y2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(c.o.y + c.r.y), oy), _mm_loadu_ps(p.iy)),
+           z1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(c.o.z - c.r.z), oz), _mm_loadu_ps(p.iz)),
+           z2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(c.o.z + c.r.z), oz), _mm_loadu_ps(p.iz));
+    tmin = _mm_max_ps(tmin, _mm_max_ps(_mm_max_ps(_mm_min_ps(x1, x2), _mm_min_ps(y1, y2)), _mm_min_ps(z1, z2)));
+    tmax = _mm_min_ps(tmax, _mm_min_ps(_mm_min_ps(_mm_max_ps(x1, x2), _mm_max_ps(y1, y2)), _mm_max_ps(z1, z2)));
+    _mm_storeu_ps(enter, _mm_max_ps(_mm_add_ps(tmin, _mm_set1_ps(0.1f)), zero));
+    __m128 hit = _mm_andnot_ps(miss, _mm_and_ps(_mm_cmple_ps(tmin, tmax), _mm_cmpge_ps(tmax, zero)));
+    return active & _mm_movemask_ps(hit);
+#else
+    int hit = 0;
+    loopk(4) if(active&(1<<k))
+    {
+        vec v(p.ox[k], p.oy[k], p.oz[k]), ray(p.dx[k], p.dy[k], p.dz[k]), invray(p.ix[k], p.iy[k], p.iz[k]);
+        const clipplanes &p = c;
+        INTERSECTPLANES(, goto nextlane);
+        INTERSECTBOX(, goto nextlane);
+        if(exitdist < 0) continue;
+        enter[k] = max(enterdist+0.1f, 0.0f);
+        hit |= 1<<k;
+    nextlane:;
+    }
+    return hit;
+#endif
+}
+
+static void packetents(raypacket &p, octaentities *oc, int active)
+{
+    loopk(4) if(active&(1<<k))
+    {
+        float edist = disttoent(oc, *p.o[k], *p.ray[k], p.best[k], p.mode, NULL);
+        if(edist < p.best[k]) p.best[k] = edist;
+    }
+}
+
+// lo/hi hold the distances at which each lane crosses the low and high faces of the node
+// along every axis, so the children's slabs follow from their midpoints without a full
+// box test per child
+static void packetcube(raypacket &p, cube *c, const ivec &co, int size, int active, const raylanes *lo, const raylanes *hi)
+{
+    raylanes mid[3], slabmin[3][2], slabmax[3][2], zero = zerolanes();
+    loopi(3)
+    {
+        mid[i] = lanesmid(lo[i], hi[i]);
+        slabmin[i][0] = lanesmin(lo[i], mid[i]);
+        slabmax[i][0] = lanesmax(lo[i], mid[i]);
+        slabmin[i][1] = lanesmin(mid[i], hi[i]);
+        slabmax[i][1] = lanesmax(mid[i], hi[i]);
+    }
+    loopi(8)
+    {
+        int n = i^p.order, x = n&1, y = (n>>1)&1, z = (n>>2)&1;
+        raylanes tmin = lanesmax(lanesmax(slabmin[0][x], slabmin[1][y]), lanesmax(slabmin[2][z], zero)),
+                 tmax = lanesmin(lanesmin(slabmax[0][x], slabmax[1][y]), lanesmin(slabmax[2][z], loadlanes(p.best)));
+        int lanes = active & laneswithin(tmin, tmax);
+        if(!lanes) continue;
+        ivec o(n, co, size);
+        cube &cc = c[n];
+        if(cc.ext && cc.ext->ents && p.mode&RAY_BB) packetents(p, cc.ext->ents, lanes);
+        if(cc.children)
+        {
+            raylanes clo[3] = { x ? mid[0] : lo[0], y ? mid[1] : lo[1], z ? mid[2] : lo[2] },
+                     chi[3] = { x ? hi[0] : mid[0], y ? hi[1] : mid[1], z ? hi[2] : mid[2] };
+            packetcube(p, cc.children, o, size>>1, lanes, clo, chi);
+            continue;
+        }
+        if(p.mode&RAY_CLIPMAT && (cc.material&MATF_CLIP) == MAT_NOCLIP) continue;
+        float enter[4];
+        if(isentirelysolid(cc) || (p.mode&RAY_CLIPMAT && isclipped(cc.material&MATF_VOLUME))) storelanes(enter, tmin);
+        else if(isempty(cc)) continue;
+        else
+        {
+            const clipplanes &planes = getclipplanes(cc, o, size, false, 1);
+            lanes = packetplanes(p, planes, lanes, enter);
+        }
+        loopk(4) if(lanes&(1<<k)) p.best[k] = min(p.best[k], enter[k]);
+    }
+}
+
+static void raypacketcube(const vec **o, const vec **ray, int numrays, float *dists, float radius, int mode, vec *hitpos)
+{
+    raypacket p;
+    p.mode = mode;
+    int active = 0;
+    float limit[4];
+    loopk(4)
+    {
+        int j = min(k, numrays-1);
+        const vec &ro = *o[j], &rd = *ray[j];
+        p.o[k] = &ro;
+        p.ray[k] = &rd;
+        p.ox[k] = ro.x; p.oy[k] = ro.y; p.oz[k] = ro.z;
+        p.dx[k] = rd.x; p.dy[k] = rd.y; p.dz[k] = rd.z;
+        p.ix[k] = rd.x ? 1/rd.x : 1e16f;
+        p.iy[k] = rd.y ? 1/rd.y : 1e16f;
+        p.iz[k] = rd.z ? 1/rd.z : 1e16f;
+        // rays that miss the world return -1 without a radius, otherwise they stop where they leave it
+        float enterworld = 0, exitworld = 1e16f;
+        loopi(3)
+        {
+            float c = ro[i], inv = i ? (i > 1 ? p.iz[k] : p.iy[k]) : p.ix[k];
+            enterworld = max(enterworld, ((inv>0?0:worldsize)-c)*inv);
+            exitworld = min(exitworld, ((inv>0?worldsize:0)-c)*inv);
+        }
+        if(rd.iszero()) limit[k] = 0;
+        else if(radius > 0) limit[k] = radius;
+        else if(enterworld > exitworld) limit[k] = -1;
+        else limit[k] = exitworld;
+        p.best[k] = max(limit[k], 0.0f);
+        if(k < numrays && limit[k] > 0) active |= 1<<k;
+    }
+    if(active)
+    {
+        p.order = (p.dx[0] < 0 ? 1 : 0) | (p.dy[0] < 0 ? 2 : 0) | (p.dz[0] < 0 ? 4 : 0);
+        raylanes lo[3] = { lanesslab(0, p.ox, p.ix), lanesslab(0, p.oy, p.iy), lanesslab(0, p.oz, p.iz) },
+                 hi[3] = { lanesslab(worldsize, p.ox, p.ix), lanesslab(worldsize, p.oy, p.iy), lanesslab(worldsize, p.oz, p.iz) };
+        packetcube(p, worldroot, ivec(0, 0, 0), worldsize>>1, active, lo, hi);
+    }
+    loopk(numrays)
+    {
+        float dist = limit[k] > 0 ? min(p.best[k], limit[k]) : limit[k];
+        dists[k] = dist;
+        if(hitpos) hitpos[k] = vec(*ray[k]).mul(dist).add(*o[k]);
+    }
+}
+
+static void raypacketcubes(const vec *o, int ostride, const vec *rays, int numrays, float *dists, float radius, int mode, vec *hitpos)
+{
+    if(mode&~RAYPACKETMODES)
+    {
+        loopi(numrays)
+        {
+            const vec &ro = o[i*ostride];
+            float dist = raycube(ro, rays[i], radius, mode);
+            if(radius>0 && dist>=radius) dist = radius;
+            dists[i] = dist;
+            if(hitpos) hitpos[i] = vec(rays[i]).mul(dist).add(ro);
+        }
+        return;
+    }
+    for(int i = 0; i < numrays; i += 4)
+    {
+        int n = min(numrays - i, 4);
+        const vec *po[4], *pray[4];
+        loopk(n)
+        {
+            po[k] = &o[(i+k)*ostride];
+            pray[k] = &rays[i+k];
+        }
+        raypacketcube(po, pray, n, &dists[i], radius, mode, hitpos ? &hitpos[i] : NULL);
+    }
+}
+
+// batched raycubepos: distances are clamped to radius, and hitpos (if given) receives the hit points
+// unlike raycube, packets do not step past cube corners that a ray only grazes by less than 0.1
+void raycubes(const vec &o, const vec *rays, int numrays, float *dists, float radius, int mode, vec *hitpos)
+{
+    raypacketcubes(&o, 0, rays, numrays, dists, radius, mode, hitpos);
+}
+
+void raycubes(const vec *o, const vec *rays, int numrays, float *dists, float radius, int mode, vec *hitpos)
+{
+    raypacketcubes(o, 1, rays, numrays, dists, radius, mode, hitpos);
+}
+
+void raybench(int *numrays, int *spread, int *iterations)
+{
+    int n = clamp(*numrays, 1, 1<<16), iters = max(*iterations, 1);
+    float cone = clamp(*spread, 0, 180)*RAD;
+    vector<vec> rays;
+    vec dir;
+    vecfromyawpitch(camera1->yaw, camera1->pitch, 1, 0, dir);
+    vec side, up;
+    side.orthogonal(dir);
+    side.normalize();
+    up.cross(side, dir);
+    loopi(n)
+    {
+        float a = rndscale(2*M_PI), r = cone*sqrtf(rndscale(1));
+        rays.add(vec(dir).mul(cosf(r)).add(vec(side).mul(sinf(r)*cosf(a))).add(vec(up).mul(sinf(r)*sinf(a))).normalize());
+    }
+    float *scalar = new float[n], *packet = new float[n];
+    int mode = RAY_CLIPMAT|RAY_ALPHAPOLY;
+    Uint64 start = SDL_GetPerformanceCounter();
+    loopj(iters) loopi(n)
+    {
+        vec hit;
+        scalar[i] = raycubepos(camera1->o, rays[i], hit, 0, mode);
+    }
+    Uint64 mid = SDL_GetPerformanceCounter();
+    loopj(iters) raycubes(camera1->o, rays.getbuf(), n, packet, 0, mode);
+    Uint64 end = SDL_GetPerformanceCounter();
+    int mismatches = 0;
+    loopi(n) if(fabs(scalar[i] - packet[i]) > 1) mismatches++;
+    delete[] scalar;
+    delete[] packet;
+    double freq = SDL_GetPerformanceFrequency(), total = double(n)*iters;
+    conoutf("raybench: %d rays, %d degree spread: scalar %.2f Mrays/s, packet %.2f Mrays/s, %d mismatches",
+        n, *spread, total/((mid-start)/freq)/1e6, total/((end-mid)/freq)/1e6, mismatches);
+}
+COMMAND(raybench, "iii");
+
 /////////////////////////  entity collision  ///////////////////////////////////////////////
 
 // info about collisions
-bool collideinside; // whether an internal collision happened
-physent *collideplayer; // whether the collection hit a player
-vec collidewall; // just the normal vectors.
+thread_local bool collideinside; // whether an internal collision happened
+thread_local physent *collideplayer; // whether the collection hit a player
+thread_local vec collidewall; // just the normal vectors.
+
+// game callbacks raised inside physics jobs are queued and replayed on the main thread
+enum { PHYSEVENT_TRIGGER = 0, PHYSEVENT_BOUNCED, PHYSEVENT_COLLIDE, PHYSEVENT_SUICIDE };
+
+struct physevent
+{
+    int type;
+    physent *d, *o;
+    physent state;
+    vec dir;
+    bool local;
+    int floorlevel, waterlevel, material;
+};
+
+static thread_local vector<physevent> *jobevents = NULL;
+
+static physevent &queuephysevent(int type, physent *d)
+{
+    physevent &e = jobevents->add();
+    e.type = type;
+    e.d = d;
+    e.o = NULL;
+    e.state = *d;
+    return e;
+}
+
+void physicstrigger(physent *d, bool local, int floorlevel, int waterlevel, int material)
+{
+    if(!jobevents) { game::physicstrigger(d, local, floorlevel, waterlevel, material); return; }
+    physevent &e = queuephysevent(PHYSEVENT_TRIGGER, d);
+    e.local = local;
+    e.floorlevel = floorlevel;
+    e.waterlevel = waterlevel;
+    e.material = material;
+}
+
+static void bounced(physent *d, const vec &surface)
+{
+    if(!jobevents) { game::bounced(d, surface); return; }
+    queuephysevent(PHYSEVENT_BOUNCED, d).dir = surface;
+}
+
+static void dynentcollide(physent *d, physent *o, const vec &dir)
+{
+    if(!jobevents) { game::dynentcollide(d, o, dir); return; }
+    physevent &e = queuephysevent(PHYSEVENT_COLLIDE, d);
+    e.o = o;
+    e.dir = dir;
+}
+
+static void suicide(physent *d)
+{
+    if(!jobevents) { game::suicide(d); return; }
+    queuephysevent(PHYSEVENT_SUICIDE, d);
+}
+
+// the entity's physics state is put back to what it was when the event was raised, so the game
+// sees it exactly as the serial loop would show it. Afterwards the entity continues from the end
+// of its step, keeping any move, velocity or state change the game made in response
+static void flushphysevents(vector<physevent> &events)
+{
+    loopv(events)
+    {
+        physevent &e = events[i];
+        physent end = *e.d;
+        *e.d = e.state;
+        switch(e.type)
+        {
+            case PHYSEVENT_TRIGGER: game::physicstrigger(e.d, e.local, e.floorlevel, e.waterlevel, e.material); break;
+            case PHYSEVENT_BOUNCED: game::bounced(e.d, e.dir); break;
+            case PHYSEVENT_COLLIDE: game::dynentcollide(e.d, e.o, e.dir); break;
+            case PHYSEVENT_SUICIDE: game::suicide(e.d); break;
+        }
+        if(e.d->o != e.state.o) end.o = e.d->o;
+        if(e.d->vel != e.state.vel) end.vel = e.d->vel;
+        if(e.d->state != e.state.state) end.state = e.d->state;
+        *e.d = end;
+    }
+    events.setsize(0);
+}
+
+// while counting, game callbacks are dropped so that benchmark entities never reach game code
+static vector<physevent> droppedevents;
+
+void startphyscounts()
+{
+    memset(&curphyscounts, 0, sizeof(curphyscounts));
+    countingphysics = true;
+    jobevents = &droppedevents;
+}
+
+void stopphyscounts(physcounts &counts)
+{
+    curphyscounts.events = droppedevents.length();
+    droppedevents.setsize(0);
+    jobevents = NULL;
+    countingphysics = false;
+    counts = curphyscounts;
+}
 
 const float STAIRHEIGHT = 4.1f;
 const float FLOORZ = 0.867f;
@@ -516,47 +977,151 @@ bool ellipsecollide(physent *d, const vec &dir, const vec &o, const vec &center,
     return false;
 }
 
-#define DYNENTCACHESIZE 1024
-
-static uint dynentframe = 0;
+// uniform grid broadphase over the xy plane: built from all dynents in one pass and then kept current
+// by moving entities between cells as they move, either through updatedynentcache() or the sweep at the
+// start of each physics frame
 
-static struct dynentcacheentry
+struct dyncellkey
 {
     int x, y;
-    uint frame;
-    vector<physent *> dynents;
-} dynentcache[DYNENTCACHESIZE];
+
+    dyncellkey() {}
+    dyncellkey(int x, int y) : x(x), y(y) {}
+};
+
+static inline uint hthash(const dyncellkey &k) { return uint(k.x)*0x9E3779B1U ^ uint(k.y); }
+static inline bool htcmp(const dyncellkey &a, const dyncellkey &b) { return a.x == b.x && a.y == b.y; }
+
+struct dynentrange
+{
+    int x1, y1, x2, y2;
+
+    bool operator==(const dynentrange &o) const { return x1 == o.x1 && y1 == o.y1 && x2 == o.x2 && y2 == o.y2; }
+};
+
+static inline uint hthash(physent *d) { return hthash(int(size_t(d) >> 4)); }
+static inline bool htcmp(physent *a, physent *b) { return a == b; }
+
+struct dynentgrid
+{
+    hashtable<dyncellkey, vector<physent *> > cells;
+    hashtable<physent *, dynentrange> ranges;
+    int shift;
+    bool valid;
+
+    dynentgrid() : cells(1<<10), ranges(1<<8), shift(0), valid(false) {}
+
+    void calcrange(const vec &o, float radius, dynentrange &r) const
+    {
+        r.x1 = max(int(o.x-radius), 0)>>shift;
+        r.y1 = max(int(o.y-radius), 0)>>shift;
+        r.x2 = min(int(o.x+radius), worldsize-1)>>shift;
+        r.y2 = min(int(o.y+radius), worldsize-1)>>shift;
+    }
+
+    void clear(int cellshift)
+    {
+        // drop the cells outright when they no longer match the entity count, otherwise keep their storage
+        if(cellshift != shift || sparse()) cells.clear();
+        else enumerate(cells, vector<physent *>, ents, ents.setsize(0));
+        ranges.clear();
+        shift = cellshift;
+        valid = true;
+    }
+
+    void insert(physent *d, const dynentrange &r)
+    {
+        for(int x = r.x1; x <= r.x2; x++) for(int y = r.y1; y <= r.y2; y++) cells[dyncellkey(x, y)].add(d);
+        ranges[d] = r;
+    }
+
+    void add(physent *d)
+    {
+        dynentrange r;
+        calcrange(d->o, d->radius, r);
+        insert(d, r);
+    }
+
+    void update(physent *d)
+    {
+        if(!valid) return;
+        dynentrange r;
+        calcrange(d->o, d->radius, r);
+        dynentrange *old = ranges.access(d);
+        if(old)
+        {
+            if(*old == r) return;
+            for(int x = old->x1; x <= old->x2; x++) for(int y = old->y1; y <= old->y2; y++)
+            {
+                vector<physent *> *ents = cells.access(dyncellkey(x, y));
+                if(ents) ents->removeobj(d);
+            }
+        }
+        insert(d, r);
+    }
+
+    void remove(physent *d)
+    {
+        dynentrange *old = ranges.access(d);
+        if(!old) return;
+        for(int x = old->x1; x <= old->x2; x++) for(int y = old->y1; y <= old->y2; y++)
+        {
+            vector<physent *> *ents = cells.access(dyncellkey(x, y));
+            if(ents) ents->removeobj(d);
+        }
+        ranges.remove(d);
+    }
+
+    // cells emptied as entities roam are kept for reuse until they far outnumber the entities
+    bool sparse() const { return cells.numelems > 4*max(ranges.numelems, 64); }
+
+    const vector<physent *> &find(int x, int y)
+    {
+        static const vector<physent *> empty;
+        vector<physent *> *ents = cells.access(dyncellkey(x, y));
+        return ents ? *ents : empty;
+    }
+};
+
+static dynentgrid dyngrid;
 
 void cleardynentcache()
 {
-    dynentframe++;
-    if(!dynentframe || dynentframe == 1) loopi(DYNENTCACHESIZE) dynentcache[i].frame = 0;
-    if(!dynentframe) dynentframe = 1;
+    dyngrid.valid = false;
 }
 
 VARF(dynentsize, 4, 7, 12, cleardynentcache());
 
-#define DYNENTHASH(x, y) (((((x)^(y))<<5) + (((x)^(y))>>5)) & (DYNENTCACHESIZE - 1))
+static void builddynentcache()
+{
+    dyngrid.clear(dynentsize);
+    int numdyns = game::numdynents();
+    loopi(numdyns)
+    {
+        dynent *d = game::iterdynents(i);
+        if(d->state == CS_ALIVE) dyngrid.add(d);
+    }
+}
 
-const vector<physent *> &checkdynentcache(int x, int y)
+// moves the dynents whose cells changed since the last sweep and drops the ones no longer alive,
+// entities that move outside of moveplayer() such as remote players are picked up here
+static void syncdynentcache()
 {
-    dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-    if(dec.x == x && dec.y == y && dec.frame == dynentframe) return dec.dynents;
-    dec.x = x;
-    dec.y = y;
-    dec.frame = dynentframe;
-    dec.dynents.shrink(0);
-    int numdyns = game::numdynents(), dsize = 1<<dynentsize, dx = x<<dynentsize, dy = y<<dynentsize;
+    if(!dyngrid.valid || dyngrid.sparse()) { builddynentcache(); return; }
+    int numdyns = game::numdynents();
     loopi(numdyns)
     {
         dynent *d = game::iterdynents(i);
-        if(d->state != CS_ALIVE ||
-           d->o.x+d->radius <= dx || d->o.x-d->radius >= dx+dsize ||
-           d->o.y+d->radius <= dy || d->o.y-d->radius >= dy+dsize)
-            continue;
-        dec.dynents.add(d);
+        if(!d) continue;
+        if(d->state == CS_ALIVE) dyngrid.update(d);
+        else dyngrid.remove(d);
     }
-    return dec.dynents;
+}
+
+const vector<physent *> &checkdynentcache(int x, int y)
+{
+    if(!dyngrid.valid) builddynentcache();
+    return dyngrid.find(x, y);
 }
 
 #define loopdynentcache(curx, cury, o, radius) \
@@ -565,13 +1130,123 @@ const vector<physent *> &checkdynentcache(int x, int y)
 
 void updatedynentcache(physent *d)
 {
-    loopdynentcache(x, y, d->o, d->radius)
+    if(d->state != CS_ALIVE) return;
+    if(!dyngrid.valid) builddynentcache();
+    dyngrid.update(d);
+}
+
+// gathers each live dynent whose cells overlap the sphere once, into a buffer reused by the next query on this thread
+const vector<physent *> &finddynents(const vec &o, float radius)
+{
+    static thread_local vector<physent *> ents;
+    ents.setsize(0);
+    loopdynentcache(x, y, o, radius)
+    {
+        const vector<physent *> &dynents = checkdynentcache(x, y);
+        loopv(dynents)
+        {
+            physent *d = dynents[i];
+            if(d->state == CS_ALIVE && !d->o.reject(o, d->radius + radius) && ents.find(d) < 0) ents.add(d);
+        }
+    }
+    return ents;
+}
+
+// gathers each live dynent that may come within margin of the segment, sampling it every half
+// cell and widening each sample by half a cell plus the margin, into a buffer reused by the next query on this thread
+const vector<physent *> &raydynents(const vec &from, const vec &to, float margin)
+{
+    static thread_local vector<physent *> ents;
+    ents.setsize(0);
+    if(!dyngrid.valid) builddynentcache();
+    int size = 1<<dyngrid.shift;
+    float reach = margin + 1 + size*0.5f, steps = ceil(from.dist2(to)/(size*0.5f));
+    // with only a few dynents it is cheaper to return all of them than to walk many cells
+    int numdyns = game::numdynents();
+    if((steps + 1)*4 >= numdyns)
+    {
+        loopi(numdyns)
+        {
+            dynent *d = game::iterdynents(i);
+            if(d->state == CS_ALIVE) ents.add(d);
+        }
+        return ents;
+    }
+    vec step = vec(to).sub(from).div(max(steps, 1.0f));
+    for(int i = 0; i <= int(steps); i++)
+    {
+        vec p = vec(step).mul(i).add(from);
+        dynentrange r;
+        dyngrid.calcrange(p, reach, r);
+        for(int x = r.x1; x <= r.x2; x++) for(int y = r.y1; y <= r.y2; y++)
+        {
+            const vector<physent *> &cell = dyngrid.find(x, y);
+            loopvj(cell)
+            {
+                physent *d = cell[j];
+                if(d->state == CS_ALIVE && ents.find(d) < 0) ents.add(d);
+            }
+        }
+    }
+    return ents;
+}
+
+// moves numents random entities around for the given number of frames, comparing the grid's
+// neighbour queries against testing every pair
+void dynentbench(int *numents, int *frames)
+{
+    if(!worldroot) return;
+    int n = clamp(*numents, 1, 1<<16), numframes = clamp(*frames, 1, 10000);
+    physent *ents = new physent[n];
+    vec *vels = new vec[n];
+    loopi(n)
     {
-        dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-        if(dec.x != x || dec.y != y || dec.frame != dynentframe || dec.dynents.find(d) >= 0) continue;
-        dec.dynents.add(d);
+        ents[i].o = vec(rndscale(worldsize), rndscale(worldsize), worldsize/2);
+        ents[i].state = CS_ALIVE;
+        vels[i] = vec(rndscale(2)-1, rndscale(2)-1, 0).mul(10);
     }
+    dynentgrid grid;
+    grid.clear(dynentsize);
+    loopi(n) grid.add(&ents[i]);
+    vector<physent *> near;
+    int gridpairs = 0, brutepairs = 0;
+    Uint64 gridticks = 0, bruteticks = 0;
+    loop(frame, numframes)
+    {
+        Uint64 start = SDL_GetPerformanceCounter();
+        loopi(n)
+        {
+            physent &d = ents[i];
+            d.o.add(vels[i]);
+            loopk(2) if(d.o[k] < 0 || d.o[k] >= worldsize) { vels[i][k] = -vels[i][k]; d.o[k] = clamp(d.o[k], 0.0f, worldsize-1.0f); }
+            grid.update(&d);
+        }
+        loopi(n)
+        {
+            physent &d = ents[i];
+            dynentrange r;
+            grid.calcrange(d.o, d.radius, r);
+            near.setsize(0);
+            for(int x = r.x1; x <= r.x2; x++) for(int y = r.y1; y <= r.y2; y++)
+            {
+                const vector<physent *> &cell = grid.find(x, y);
+                loopvj(cell) if(cell[j] != &d && !d.o.reject(cell[j]->o, d.radius + cell[j]->radius) && near.find(cell[j]) < 0) near.add(cell[j]);
+            }
+            gridpairs += near.length();
+        }
+        Uint64 mid = SDL_GetPerformanceCounter();
+        loopi(n) loopj(n) if(i != j && !ents[i].o.reject(ents[j].o, ents[i].radius + ents[j].radius)) brutepairs++;
+        Uint64 end = SDL_GetPerformanceCounter();
+        gridticks += mid - start;
+        bruteticks += end - mid;
+    }
+    delete[] ents;
+    delete[] vels;
+    double freq = SDL_GetPerformanceFrequency();
+    conoutf("dynentbench: %d entities, %d frames: grid %.3f ms/frame (%d contacts), all pairs %.3f ms/frame (%d contacts)",
+        n, numframes, gridticks*1000/freq/numframes, gridpairs, bruteticks*1000/freq/numframes, brutepairs);
 }
+COMMAND(dynentbench, "ii");
 
 bool overlapsdynent(const vec &o, float radius)
 {
@@ -613,6 +1288,7 @@ bool plcollide(physent *d, const vec &dir)    // collide with player
         {
             physent *o = dynents[i];
             if(o==d || d->o.reject(o->o, d->radius+o->radius)) continue;
+            if(countingphysics) curphyscounts.dynents++;
             switch(d->collidetype)
             {
                 case COLLIDE_ELLIPSE:
@@ -632,7 +1308,7 @@ bool plcollide(physent *d, const vec &dir)    // collide with player
                 default: continue;
             }
             collideplayer = o;
-            game::dynentcollide(d, o, collidewall);
+            dynentcollide(d, o, collidewall);
             return true;
         }
     }
@@ -776,7 +1452,29 @@ static bool fuzzycollideellipse(physent *d, const vec &dir, float cutoff, const
     return true;
 }
 
-VAR(testtricol, 0, 0, 2);
+// set whenever map entities or map models change, so the next parallel physics step prepares them again
+static bool collidemodelsdirty = true;
+
+void resetcollidemodels()
+{
+    collidemodelsdirty = true;
+}
+
+VARF(testtricol, 0, 0, 2, resetcollidemodels());
+
+// models are only ever loaded on the main thread, physics jobs treat a model that failed to load as absent
+static model *loadcollidemodel(const extentity &e, mapmodelinfo &mmi)
+{
+    model *m = mmi.collide;
+    if(!m && ismainthread())
+    {
+        if(!mmi.m && !loadmodel(NULL, e.attr1)) return NULL;
+        if(mmi.m->collidemodel) m = loadmodel(mmi.m->collidemodel);
+        if(!m) m = mmi.m;
+        mmi.collide = m;
+    }
+    return m;
+}
 
 bool mmcollide(physent *d, const vec &dir, float cutoff, octaentities &oc) // collide with a mapmodel
 {
@@ -786,14 +1484,8 @@ bool mmcollide(physent *d, const vec &dir, float cutoff, octaentities &oc) // co
         extentity &e = *ents[oc.mapmodels[i]];
         if(e.flags&EF_NOCOLLIDE || !mapmodels.inrange(e.attr1)) continue;
         mapmodelinfo &mmi = mapmodels[e.attr1];
-        model *m = mmi.collide;
-        if(!m)
-        {
-            if(!mmi.m && !loadmodel(NULL, e.attr1)) continue;
-            if(mmi.m->collidemodel) m = loadmodel(mmi.m->collidemodel);
-            if(!m) m = mmi.m;
-            mmi.collide = m;
-        }
+        model *m = loadcollidemodel(e, mmi);
+        if(!m) continue;
         int mcol = mmi.m->collide;
         if(!mcol) continue;
 
@@ -801,11 +1493,12 @@ bool mmcollide(physent *d, const vec &dir, float cutoff, octaentities &oc) // co
         float rejectradius = m->collisionbox(center, radius), scale = e.attr5 > 0 ? e.attr5/100.0f : 1;
         center.mul(scale);
         if(d->o.reject(vec(e.o).add(center), d->radius + rejectradius*scale)) continue;
+        if(countingphysics) curphyscounts.mapmodels++;
 
         int yaw = e.attr2, pitch = e.attr3, roll = e.attr4;
         if(mcol == COLLIDE_TRI || testtricol)
         {
-            if(!m->bih && !m->setBIH()) continue;
+            if(!m->bih && (!ismainthread() || !m->setBIH())) continue;
             switch(testtricol ? testtricol : d->collidetype)
             {
                 case COLLIDE_ELLIPSE:
@@ -1055,6 +1748,7 @@ static bool cubecollideplanes(physent *d, const vec &dir, float cutoff, const cu
 
 static inline bool cubecollide(physent *d, const vec &dir, float cutoff, const cube &c, const ivec &co, int size, bool solid)
 {
+    if(countingphysics) curphyscounts.cubes++;
     switch(d->collidetype)
     {
     case COLLIDE_OBB:
@@ -1122,6 +1816,7 @@ static inline bool octacollide(physent *d, const vec &dir, float cutoff, const i
 // all collision happens here
 bool collide(physent *d, const vec &dir, float cutoff, bool playercol)
 {
+    if(countingphysics) curphyscounts.collides++;
     collideinside = false;
     collideplayer = NULL;
     collidewall = vec(0, 0, 0);
@@ -1560,7 +2255,7 @@ bool bounce(physent *d, float secs, float elasticity, float waterfric, float gra
         }
         else if(collideplayer) break;
         d->o = old;
-        game::bounced(d, collidewall);
+        bounced(d, collidewall);
         float c = collidewall.dot(d->vel),
               k = 1.0f + (1.0f-elasticity)*c/d->vel.magnitude();
         d->vel.mul(k);
@@ -1739,7 +2434,7 @@ void modifyvelocity(physent *pl, bool local, bool water, bool floating, int curt
             pl->vel.z = max(pl->vel.z, JUMPVEL); // physics impulse upwards
             if(water) { pl->vel.x /= 8.0f; pl->vel.y /= 8.0f; } // dampen velocity change even harder, gives correct water feel
 
-            game::physicstrigger(pl, local, 1, 0);
+            physicstrigger(pl, local, 1, 0);
         }
     }
     if(!floating && pl->physstate == PHYS_FALL) pl->timeinair += curtime;
@@ -1849,7 +2544,7 @@ bool moveplayer(physent *pl, int moveres, bool local, int curtime)
         loopi(moveres) if(!move(pl, d) && ++collisions<5) i--; // discrete steps collision detection & sliding
         if(timeinair > 800 && !pl->timeinair && !water) // if we land after long time must have been a high jump, make thud sound
         {
-            game::physicstrigger(pl, local, -1, 0);
+            physicstrigger(pl, local, -1, 0);
         }
     }
 
@@ -1867,11 +2562,11 @@ bool moveplayer(physent *pl, int moveres, bool local, int curtime)
         material = lookupmaterial(vec(pl->o.x, pl->o.y, pl->o.z + (pl->aboveeye - pl->eyeheight)/2));
         water = isliquid(material&MATF_VOLUME);
     }
-    if(!pl->inwater && water) game::physicstrigger(pl, local, 0, -1, material&MATF_VOLUME);
-    else if(pl->inwater && !water) game::physicstrigger(pl, local, 0, 1, pl->inwater);
+    if(!pl->inwater && water) physicstrigger(pl, local, 0, -1, material&MATF_VOLUME);
+    else if(pl->inwater && !water) physicstrigger(pl, local, 0, 1, pl->inwater);
     pl->inwater = water ? material&MATF_VOLUME : MAT_AIR;
 
-    if(pl->state==CS_ALIVE && (pl->o.z < 0 || material&MAT_DEATH)) game::suicide(pl);
+    if(pl->state==CS_ALIVE && (pl->o.z < 0 || material&MAT_DEATH)) suicide(pl);
 
     return true;
 }
@@ -1888,7 +2583,7 @@ void physicsframe()          // optimally schedule physics frames inside the gra
         physsteps = (diff + physframetime - 1)/physframetime;
         lastphysframe += physsteps * physframetime;
     }
-    cleardynentcache();
+    syncdynentcache();
 }
 
 VAR(physinterp, 0, 1, 1);
@@ -1947,6 +2642,75 @@ bool bounce(physent *d, float elasticity, float waterfric, float grav)
     return hitplayer;
 }
 
+VARP(physthreads, 0, 1, 1);
+VAR(physbatch, 1, 16, 1024);
+
+struct physjob
+{
+    physstepfunc step;
+    void *data;
+    int start, end;
+    vector<physevent> events;
+};
+
+static vector<physjob *> physjobs;
+
+static void runphysjob(void *data)
+{
+    physjob &j = *(physjob *)data;
+    jobevents = &j.events;
+    for(int i = j.start; i < j.end; i++) j.step(j.data, i);
+    jobevents = NULL;
+}
+
+// finishes any lazy loading of collision models up front so jobs only ever read them,
+// only walking the entities again after they or the map models changed
+static void preparecollidemodels()
+{
+    if(!collidemodelsdirty) return;
+    collidemodelsdirty = false;
+    const vector<extentity *> &ents = entities::getents();
+    loopv(ents)
+    {
+        extentity &e = *ents[i];
+        if(e.type != ET_MAPMODEL || e.flags&EF_NOCOLLIDE || !mapmodels.inrange(e.attr1)) continue;
+        mapmodelinfo &mmi = mapmodels[e.attr1];
+        model *m = loadcollidemodel(e, mmi);
+        if(!m || !mmi.m->collide) continue;
+        vec center, radius;
+        m->collisionbox(center, radius);
+        if((mmi.m->collide == COLLIDE_TRI || testtricol) && !m->bih) m->setBIH();
+    }
+}
+
+// steps entities that do not collide with each other, such as bouncers and ragdolls, across the job
+// threads. Each job owns a contiguous range and its game callbacks are replayed in order afterwards,
+// once every entity has finished its step (see flushphysevents).
+void parallelphysics(int num, physstepfunc step, void *data)
+{
+    int numjobs = physthreads && ismainthread() ? min(num/physbatch, numcpus) : 0;
+    if(numjobs < 2)
+    {
+        loopi(num) step(data, i);
+        return;
+    }
+    if(!dyngrid.valid) builddynentcache();
+    preparecollidemodels();
+    while(physjobs.length() < numjobs) physjobs.add(new physjob);
+    jobgroup group;
+    loopi(numjobs)
+    {
+        physjob &j = *physjobs[i];
+        j.step = step;
+        j.data = data;
+        j.start = i*num/numjobs;
+        j.end = (i+1)*num/numjobs;
+        addjob(runphysjob, NULL, &j, &group, true);
+    }
+    waitjobs(&group);
+    loopi(numjobs) flushphysevents(physjobs[i]->events);
+}
+
 void updatephysstate(physent *d)
 {
     if(d->physstate == PHYS_FALL) return;
@@ -1,5 +1,10 @@
 #include "engine.h"
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PVSSSE
+#endif
+
 enum
 {
     PVS_HIDE_GEOM = 1<<0,
@@ -113,11 +118,7 @@ struct shaftplane
 
 struct shaftbb
 {
-    union
-    {
-        ushort v[6];
-        struct { usvec min, max; };
-    };
+    ivec min, max;
 
     shaftbb() {}
     shaftbb(const ivec &o, int size)
@@ -139,8 +140,8 @@ struct shaftbb
         max.z = o.z + (size*(edges.z>>4))/8;
     }
 
-    ushort &operator[](int i) { return v[i]; }
-    ushort operator[](int i) const { return v[i]; }
+    int &operator[](int i) { return i < 3 ? min[i] : max[i-3]; }
+    int operator[](int i) const { return i < 3 ? min[i] : max[i-3]; }
 
     bool contains(const shaftbb &o) const
     {
@@ -172,6 +173,10 @@ struct shaft
     shaftbb bounds;
     shaftplane planes[8];
     int numplanes;
+#ifdef PVSSSE
+    // the planes again with their normals split by axis, padded to groups of four with lanes that never pass
+    float planenorms[3][8], planeoffsets[8];
+#endif
 
     shaft(const shaftbb &from, const shaftbb &to)
     {
@@ -187,7 +192,7 @@ struct shaft
             else if(to.min[i] > from.min[i]) bounds.min[i] = to.min[i]+1;
             else { match |= 1<<i; bounds.min[i] = to.min[i]; }
 
-            if(to.max[i] > from.max[i]) { color |= 8<<i; bounds.max[i] = USHRT_MAX; }
+            if(to.max[i] > from.max[i]) { color |= 8<<i; bounds.max[i] = INT_MAX; }
             else if(to.max[i] < from.max[i]) bounds.max[i] = to.max[i]-1;
             else { match |= 8<<i; bounds.max[i] = to.max[i]; }
         }
@@ -210,8 +215,50 @@ struct shaft
             p.rfar = p.r < 0 ? r : 3+r;
             p.cfar = p.c < 0 ? c : 3+c;
         }
+#ifdef PVSSSE
+        loopi((numplanes+3)&~3)
+        {
+            loopk(3) planenorms[k][i] = 0;
+            if(i >= numplanes) { planeoffsets[i] = -1; continue; }
+            const shaftplane &p = planes[i];
+            planenorms[p.rnear%3][i] = p.r;
+            planenorms[p.cnear%3][i] = p.c;
+            planeoffsets[i] = p.offset;
+        }
+#endif
+    }
+
+#ifdef PVSSSE
+    // whether any plane has the corner picked from lo along non-negative normal axes, or from hi otherwise,
+    // in front of it; the zero axis of each plane adds nothing, so this matches the scalar sums exactly
+    bool abovecorner(const ivec &lo, const ivec &hi) const
+    {
+        const __m128 zero = _mm_setzero_ps(),
+                     lox = _mm_set1_ps(lo.x), loy = _mm_set1_ps(lo.y), loz = _mm_set1_ps(lo.z),
+                     hix = _mm_set1_ps(hi.x), hiy = _mm_set1_ps(hi.y), hiz = _mm_set1_ps(hi.z);
+        for(int i = 0; i < numplanes; i += 4)
+        {
+            __m128 nx = _mm_loadu_ps(&planenorms[0][i]), ny = _mm_loadu_ps(&planenorms[1][i]), nz = _mm_loadu_ps(&planenorms[2][i]),
+                   sx = _mm_cmpge_ps(nx, zero), sy = _mm_cmpge_ps(ny, zero), sz = _mm_cmpge_ps(nz, zero),
+                   x = _mm_or_ps(_mm_and_ps(sx, lox), _mm_andnot_ps(sx, hix)),
+                   y = _mm_or_ps(_mm_and_ps(sy, loy), _mm_andnot_ps(sy, hiy)),
+                   z = _mm_or_ps(_mm_and_ps(sz, loz), _mm_andnot_ps(sz, hiz)),
+                   dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, nx), _mm_mul_ps(y, ny)), _mm_mul_ps(z, nz)), _mm_loadu_ps(&planeoffsets[i]));
+            if(_mm_movemask_ps(_mm_cmpgt_ps(dist, zero))) return true;
+        }
+        return false;
+    }
+
+    bool outside(const shaftbb &o) const
+    {
+        return bounds.outside(o) || abovecorner(o.min, o.max);
     }
 
+    bool inside(const shaftbb &o) const
+    {
+        return !bounds.notinside(o) && !abovecorner(o.max, o.min);
+    }
+#else
     bool outside(const shaftbb &o) const
     {
         if(bounds.outside(o)) return true;
@@ -233,6 +280,7 @@ struct shaft
         }
         return true;
     }
+#endif
 };
 
 struct pvsdata
@@ -261,7 +309,118 @@ static SDL_mutex *pvsmutex = NULL;
 static hashtable<pvsdata, int> pvscompress;
 static vector<pvsdata> pvs;
 
-static SDL_mutex *viewcellmutex = NULL;
+static int addpvsdata(const pvsdata &key)
+{
+    int *val = pvscompress.access(key);
+    if(val) pvsbuf.setsize(key.offset);
+    else
+    {
+        val = &pvscompress[key];
+        *val = pvs.length();
+        pvs.add(key);
+    }
+    return *val;
+}
+
+// view cells are stored as [water occlusion bytes][root node offset], and each node as [leafmask][8 leaf
+// values or branch slots][4-byte child offsets for the branches], hash-consed so identical subtrees are shared
+static hashtable<pvsdata, int> pvsnodecompress;
+
+static inline uint getpvsref(const uchar *ref)
+{
+    return ref[0] | (ref[1]<<8) | (ref[2]<<16) | (uint(ref[3])<<24);
+}
+
+static inline void putpvsref(uchar *ref, uint offset)
+{
+    loopi(4) ref[i] = (offset>>(i*8))&0xFF;
+}
+
+static inline const uchar *pvschild(const uchar *base, const uchar *node, int i)
+{
+    return base + getpvsref(&node[9 + 4*node[1+i]]);
+}
+
+static inline uint pvsroot(const vector<uchar> &buf, const pvsdata &d)
+{
+    return getpvsref(&buf[d.offset + d.len - 4]);
+}
+
+static inline int pvswatermask(const vector<uchar> &buf, const pvsdata &d)
+{
+    int mask = 0;
+    loopi(d.len - 4) mask |= buf[d.offset + i] << (i*8);
+    return mask;
+}
+
+static int addpvsnode(vector<uchar> &buf, const uchar *node, int len)
+{
+    int offset = buf.length();
+    buf.put(node, len);
+    if(&buf != &pvsbuf) return offset;
+    pvsdata key(offset, len);
+    int *val = pvsnodecompress.access(key);
+    if(val) { pvsbuf.setsize(offset); return *val; }
+    pvsnodecompress[key] = offset;
+    return offset;
+}
+
+// converts the flat serialized form, whose branches are relative offsets in 9-byte node units, into the node pool
+static int internpvs(vector<uchar> &buf, const uchar *src)
+{
+    uchar node[9 + 4*8];
+    int numbranches = 0;
+    node[0] = src[0];
+    loopi(8)
+    {
+        if(src[0]&(1<<i)) { node[1+i] = src[1+i]; continue; }
+        putpvsref(&node[9 + 4*numbranches], internpvs(buf, src + 9*src[1+i]));
+        node[1+i] = numbranches++;
+    }
+    return addpvsnode(buf, node, 9 + 4*numbranches);
+}
+
+static int copypvsnode(vector<uchar> &buf, const uchar *base, const uchar *src)
+{
+    uchar node[9 + 4*8];
+    int numbranches = 0;
+    node[0] = src[0];
+    loopi(8)
+    {
+        if(src[0]&(1<<i)) { node[1+i] = src[1+i]; continue; }
+        putpvsref(&node[9 + 4*numbranches], copypvsnode(buf, base, pvschild(base, src, i)));
+        node[1+i] = numbranches++;
+    }
+    return addpvsnode(buf, node, 9 + 4*numbranches);
+}
+
+static int addpvscell(int wateroccluded, int waterbytes, uint root)
+{
+    pvsdata key(pvsbuf.length(), waterbytes + 4);
+    loopi(waterbytes) pvsbuf.add((wateroccluded>>(i*8))&0xFF);
+    putpvsref(pvsbuf.pad(4), root);
+    return addpvsdata(key);
+}
+
+// moves the view cell records behind the node pool, so that saving them only needs their lengths
+static void packpvs()
+{
+    vector<uchar> oldbuf;
+    oldbuf.move(pvsbuf);
+    pvsnodecompress.clear();
+    vector<uint> roots;
+    loopv(pvs) roots.add(copypvsnode(pvsbuf, oldbuf.getbuf(), &oldbuf[pvsroot(oldbuf, pvs[i])]));
+    pvsnodecompress.clear();
+    loopv(pvs)
+    {
+        pvsdata &d = pvs[i];
+        int offset = pvsbuf.length();
+        pvsbuf.put(&oldbuf[d.offset], d.len - 4);
+        putpvsref(pvsbuf.pad(4), roots[i]);
+        d.offset = offset;
+    }
+}
+
 struct viewcellrequest
 {
     int *result;
@@ -288,7 +447,7 @@ uint numwaterplanes = 0;
 
 struct pvsworker
 {
-    pvsworker() : thread(NULL), pvsnodes(new pvsnode[origpvsnodes.length()])
+    pvsworker() : thread(NULL), pvsnodes(new pvsnode[origpvsnodes.length()]), taskhead(0), tasktail(0), tasklock(0)
     {
     }
     ~pvsworker()
@@ -299,6 +458,11 @@ struct pvsworker
     SDL_Thread *thread;
     pvsnode *pvsnodes;
 
+    // the range of viewcellrequests this worker still owns, taken from the front by the worker itself
+    // and split off the back by idle workers
+    int taskhead, tasktail;
+    SDL_SpinLock tasklock;
+
     shaftbb viewcellbb;
 
     pvsnode *levels[32];
@@ -570,7 +734,7 @@ struct pvsworker
                 if(bb.min[dim] >= viewcellbb.max[dim] || bb.max[dim] <= viewcellbb.min[dim])
                 {
                     int ddir = bb.min[dim] >= viewcellbb.max[dim] ? 1 : -1,
-                        dval = ddir>0 ? USHRT_MAX-1 : 0,
+                        dval = ddir>0 ? INT_MAX-1 : 0,
                         dlimit = maxpvsblocker,
                         numsides = 0;
                     loopj(4)
@@ -761,52 +925,52 @@ struct pvsworker
         serializepvs(pvsnodes[0]);
     }
 
-    uchar *testviewcell(const ivec &co, int size, int *waterpvs = NULL, int *len = NULL)
-    {
-        calcpvs(co, size);
-
-        uchar *buf = new uchar[outbuf.length()];
-        memcpy(buf, outbuf.getbuf(), outbuf.length());
-        if(waterpvs) *waterpvs = wateroccluded;
-        if(len) *len = outbuf.length();
-        return buf;
-    }
-
     int genviewcell(const ivec &co, int size)
     {
         calcpvs(co, size);
 
         if(pvsmutex) SDL_LockMutex(pvsmutex);
         numviewcells++;
-        pvsdata key(pvsbuf.length(), waterbytes + outbuf.length());
-        loopi(waterbytes) pvsbuf.add((wateroccluded>>(i*8))&0xFF);
-        pvsbuf.put(outbuf.getbuf(), outbuf.length());
-        int *val = pvscompress.access(key);
-        if(val) pvsbuf.setsize(key.offset);
-        else
-        {
-            val = &pvscompress[key];
-            *val = pvs.length();
-            pvs.add(key);
-        }
+        int index = addpvscell(wateroccluded, waterbytes, internpvs(pvsbuf, outbuf.getbuf()));
         if(pvsmutex) SDL_UnlockMutex(pvsmutex);
-        return *val;
+        return index;
     }
 
-    static int run(void *data)
+    int remainingtasks()
     {
-        pvsworker *w = (pvsworker *)data;
-        SDL_LockMutex(viewcellmutex);
-        while(viewcellrequests.length())
-        {
-            viewcellrequest req = viewcellrequests.pop();
-            SDL_UnlockMutex(viewcellmutex);
-            int result = w->genviewcell(req.o, req.size);
-            SDL_LockMutex(viewcellmutex);
-            *req.result = result;
-        }
-        SDL_UnlockMutex(viewcellmutex);
-        return 0;
+        SDL_AtomicLock(&tasklock);
+        int remaining = tasktail - taskhead;
+        SDL_AtomicUnlock(&tasklock);
+        return remaining;
+    }
+
+    bool poptask(int &index)
+    {
+        SDL_AtomicLock(&tasklock);
+        bool found = taskhead < tasktail;
+        if(found) index = taskhead++;
+        SDL_AtomicUnlock(&tasklock);
+        return found;
+    }
+
+    void settasks(int head, int tail)
+    {
+        SDL_AtomicLock(&tasklock);
+        taskhead = head;
+        tasktail = tail;
+        SDL_AtomicUnlock(&tasklock);
+    }
+
+    bool stealtasks(pvsworker &victim)
+    {
+        SDL_AtomicLock(&victim.tasklock);
+        int remaining = victim.tasktail - victim.taskhead, tail = victim.tasktail;
+        if(remaining > 0) victim.tasktail -= (remaining+1)/2;
+        int head = victim.tasktail;
+        SDL_AtomicUnlock(&victim.tasklock);
+        if(remaining <= 0) return false;
+        settasks(head, tail);
+        return true;
     }
 };
 
@@ -832,6 +996,32 @@ struct viewcellnode
 VARP(pvsthreads, 0, 0, 16);
 static vector<pvsworker *> pvsworkers;
 
+// an idle worker takes the back half of whichever worker has the most view cells left, so the cells
+// stay in spatially coherent runs while the load evens out
+static bool stealpvstasks(pvsworker &w)
+{
+    for(;;)
+    {
+        pvsworker *victim = NULL;
+        int most = 0;
+        loopv(pvsworkers) if(pvsworkers[i] != &w)
+        {
+            int remaining = pvsworkers[i]->remainingtasks();
+            if(remaining > most) { victim = pvsworkers[i]; most = remaining; }
+        }
+        if(!victim) return false;
+        if(w.stealtasks(*victim)) return true;
+    }
+}
+
+static void runpvstasks(pvsworker &w, bool mainthread = false);
+
+static int pvsworkerthread(void *data)
+{
+    runpvstasks(*(pvsworker *)data);
+    return 0;
+}
+
 static volatile bool check_genpvs_progress = false;
 
 static Uint32 genpvs_timer(Uint32 interval, void *param)
@@ -854,11 +1044,27 @@ static void show_genpvs_progress(int unique = pvs.length(), int processed = numv
     check_genpvs_progress = false;
 }
 
+static void runpvstasks(pvsworker &w, bool mainthread)
+{
+    for(int index; !genpvs_canceled && (w.poptask(index) || (stealpvstasks(w) && w.poptask(index)));)
+    {
+        viewcellrequest &req = viewcellrequests[index];
+        *req.result = w.genviewcell(req.o, req.size);
+        if(mainthread && check_genpvs_progress)
+        {
+            SDL_LockMutex(pvsmutex);
+            int unique = pvs.length(), processed = numviewcells;
+            SDL_UnlockMutex(pvsmutex);
+            show_genpvs_progress(unique, processed);
+        }
+    }
+}
+
 static shaftbb pvsbounds;
 
 static void calcpvsbounds()
 {
-    loopk(3) pvsbounds.min[k] = USHRT_MAX;
+    loopk(3) pvsbounds.min[k] = INT_MAX;
     loopk(3) pvsbounds.max[k] = 0;
     loopv(valist)
     {
@@ -866,8 +1072,8 @@ static void calcpvsbounds()
         loopk(3)
         {
             if(va->geommin[k]>va->geommax[k]) continue;
-            pvsbounds.min[k] = min(pvsbounds.min[k], (ushort)va->geommin[k]);
-            pvsbounds.max[k] = max(pvsbounds.max[k], (ushort)va->geommax[k]);
+            pvsbounds.min[k] = min(pvsbounds.min[k], va->geommin[k]);
+            pvsbounds.max[k] = max(pvsbounds.max[k], va->geommax[k]);
         }
     }
 }
@@ -906,6 +1112,51 @@ static int countviewcells(cube *c, const ivec &co, int size, int threshold)
     return count;
 }
 
+// updatepvs keeps the view cells of the last PVS that were completely occluded from the edited region,
+// since nothing they could see was changed and no ray leaving them could have passed through it
+static ivec pvsdirtymin(INT_MAX, INT_MAX, INT_MAX), pvsdirtymax(INT_MIN, INT_MIN, INT_MIN);
+static int pvsworldscale = 0, reusedviewcells = 0;
+static viewcellnode *prevviewcells = NULL;
+static vector<pvsdata> prevpvs;
+static vector<uchar> prevpvsbuf;
+
+static inline bool pvsoccluded(const uchar *base, const uchar *buf, const ivec &bbmin, const ivec &bbmax);
+
+static int prevviewcell(const ivec &o, int size)
+{
+    viewcellnode *vc = prevviewcells;
+    for(int scale = worldscale-1; vc && scale>=0; scale--)
+    {
+        int i = octastep(o.x, o.y, o.z, scale);
+        if(vc->leafmask&(1<<i)) return size == 1<<scale ? vc->children[i].pvs : -1;
+        if(size >= 1<<scale) break;
+        vc = vc->children[i].node;
+    }
+    return -1;
+}
+
+static int reuseviewcell(const ivec &o, int size)
+{
+    if(!prevviewcells) return -1;
+    if(o.x <= pvsdirtymax.x && o.y <= pvsdirtymax.y && o.z <= pvsdirtymax.z &&
+       o.x+size > pvsdirtymin.x && o.y+size > pvsdirtymin.y && o.z+size > pvsdirtymin.z)
+        return -1;
+    int index = prevviewcell(o, size);
+    if(index < 0) return -1;
+    const pvsdata &d = prevpvs[index];
+    const uchar *root = &prevpvsbuf[pvsroot(prevpvsbuf, d)];
+    if(!pvsoccluded(prevpvsbuf.getbuf(), root, pvsdirtymin, pvsdirtymax)) return -1;
+    reusedviewcells++;
+    return addpvscell(pvswatermask(prevpvsbuf, d), d.len - 4, copypvsnode(pvsbuf, prevpvsbuf.getbuf(), root));
+}
+
+static void clearprevpvs()
+{
+    DELETEP(prevviewcells);
+    prevpvs.setsize(0);
+    prevpvsbuf.setsize(0);
+}
+
 static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int threshold)
 {
     if(genpvs_canceled) return;
@@ -926,6 +1177,13 @@ static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int
             if(isallclip(h.children)) continue;
         }
         else if(isentirelysolid(h) || (h.material&MATF_CLIP)==MAT_CLIP) continue;
+        int reused = reuseviewcell(o, size);
+        if(reused >= 0)
+        {
+            p.children[i].pvs = reused;
+            numviewcells++;
+            continue;
+        }
         if(pvsworkers.length())
         {
             if(genpvs_canceled) return;
@@ -944,9 +1202,56 @@ static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int
 
 static viewcellnode *viewcells = NULL;
 static int lockedwaterplanes[MAXWATERPVS];
-static uchar *curpvs = NULL, *lockedpvs = NULL;
+static const uchar *curpvs = NULL, *curpvsbase = NULL;
+static vector<uchar> lockedpvsbuf;
+static uint lockedpvsroot = 0;
 static int curwaterpvs = 0, lockedwaterpvs = 0;
 
+// coarse grid decoded from the current view cell's tree, so that most box tests are a few lookups
+#define PVSGRIDBITS 4
+#define PVSGRIDSIZE (1<<PVSGRIDBITS)
+
+enum { PVSGRID_VISIBLE = 0, PVSGRID_HIDDEN, PVSGRID_MIXED };
+
+static uchar pvsgrid[PVSGRIDSIZE*PVSGRIDSIZE*PVSGRIDSIZE];
+static const uchar *pvsgridnode = NULL;
+static int pvsgridshift = 0;
+
+static inline int pvsgridindex(int x, int y, int z) { return (((z<<PVSGRIDBITS)|y)<<PVSGRIDBITS)|x; }
+
+static void fillpvsgrid(const ivec &o, int size, uchar state)
+{
+    ivec g = ivec(o).shr(pvsgridshift);
+    int n = size>>pvsgridshift;
+    loop(z, n) loop(y, n) loop(x, n) pvsgrid[pvsgridindex(g.x+x, g.y+y, g.z+z)] = state;
+}
+
+static void decodepvsgrid(const uchar *base, const uchar *buf, const ivec &co, int size)
+{
+    int cellsize = 1<<pvsgridshift;
+    loopi(8)
+    {
+        ivec o(i, co, size);
+        if(buf[0]&(1<<i))
+        {
+            uchar leafvalues = buf[1+i];
+            if(!leafvalues) fillpvsgrid(o, size, PVSGRID_VISIBLE);
+            else if(leafvalues==0xFF) fillpvsgrid(o, size, PVSGRID_HIDDEN);
+            else if(size > cellsize) loopj(8) fillpvsgrid(ivec(j, o, size>>1), size>>1, leafvalues&(1<<j) ? PVSGRID_HIDDEN : PVSGRID_VISIBLE);
+            else fillpvsgrid(o, size, PVSGRID_MIXED);
+        }
+        else if(size > cellsize) decodepvsgrid(base, pvschild(base, buf, i), o, size>>1);
+        else fillpvsgrid(o, size, PVSGRID_MIXED);
+    }
+}
+
+static void updatepvsgrid()
+{
+    pvsgridshift = worldscale - PVSGRIDBITS;
+    decodepvsgrid(curpvsbase, curpvs, ivec(0, 0, 0), worldsize>>1);
+    pvsgridnode = curpvs;
+}
+
 static inline pvsdata *lookupviewcell(const vec &p)
 {
     uint x = uint(floor(p.x)), y = uint(floor(p.y)), z = uint(floor(p.z));
@@ -966,15 +1271,13 @@ static inline pvsdata *lookupviewcell(const vec &p)
 
 static void lockpvs_(bool lock)
 {
-    if(lockedpvs) DELETEA(lockedpvs);
+    lockedpvsbuf.setsize(0);
+    pvsgridnode = NULL;
     if(!lock) return;
     pvsdata *d = lookupviewcell(camera1->o);
     if(!d) return;
-    int wbytes = d->len%9, len = d->len - wbytes;
-    lockedpvs = new uchar[len];
-    memcpy(lockedpvs, &pvsbuf[d->offset + wbytes], len);
-    lockedwaterpvs = 0;
-    loopi(wbytes) lockedwaterpvs |= pvsbuf[d->offset + i] << (i*8);
+    lockedpvsroot = copypvsnode(lockedpvsbuf, pvsbuf.getbuf(), &pvsbuf[pvsroot(pvsbuf, *d)]);
+    lockedwaterpvs = pvswatermask(pvsbuf, *d);
     loopi(MAXWATERPVS) lockedwaterplanes[i] = waterplanes[i].height;
     conoutf("locked view cell at %.1f, %.1f, %.1f", camera1->o.x, camera1->o.y, camera1->o.z);
 }
@@ -987,20 +1290,18 @@ VARN(waterpvs, usewaterpvs, 0, 1, 1);
 void setviewcell(const vec &p)
 {
     if(!usepvs) curpvs = NULL;
-    else if(lockedpvs)
+    else if(lockedpvsbuf.length())
     {
-        curpvs = lockedpvs;
+        curpvsbase = lockedpvsbuf.getbuf();
+        curpvs = &lockedpvsbuf[lockedpvsroot];
         curwaterpvs = lockedwaterpvs;
     }
     else
     {
         pvsdata *d = lookupviewcell(p);
-        curpvs = d ? &pvsbuf[d->offset] : NULL;
-        curwaterpvs = 0;
-        if(d)
-        {
-            loopi(d->len%9) curwaterpvs |= *curpvs++ << (i*8);
-        }
+        curpvsbase = pvsbuf.getbuf();
+        curpvs = d ? &pvsbuf[pvsroot(pvsbuf, *d)] : NULL;
+        curwaterpvs = d ? pvswatermask(pvsbuf, *d) : 0;
     }
     if(!usepvs || !usewaterpvs) curwaterpvs = 0;
 }
@@ -1011,13 +1312,23 @@ void clearpvs()
     pvs.setsize(0);
     pvsbuf.setsize(0);
     curpvs = NULL;
+    pvsgridnode = NULL;
     numwaterplanes = 0;
     lockpvs = 0;
     lockpvs_(false);
+    pvsdirtymin = ivec(INT_MAX, INT_MAX, INT_MAX);
+    pvsdirtymax = ivec(INT_MIN, INT_MIN, INT_MIN);
 }
 
 COMMAND(clearpvs, "");
 
+void pvschanged(const ivec &bbmin, const ivec &bbmax)
+{
+    if(!viewcells) return;
+    pvsdirtymin.min(ivec(bbmin).max(ivec(0, 0, 0)));
+    pvsdirtymax.max(ivec(bbmax).min(ivec(worldsize, worldsize, worldsize)));
+}
+
 static void findwaterplanes()
 {
     loopi(MAXWATERPVS)
@@ -1080,11 +1391,12 @@ void testpvs(int *vcsize)
 
     ivec o = ivec(camera1->o).mask(~(size-1));
     pvsworker w;
-    int len;
-    lockedpvs = w.testviewcell(o, size, &lockedwaterpvs, &len);
+    w.calcpvs(o, size);
+    lockedpvsroot = internpvs(lockedpvsbuf, w.outbuf.getbuf());
+    lockedwaterpvs = w.wateroccluded;
     loopi(MAXWATERPVS) lockedwaterplanes[i] = waterplanes[i].height;
     lockpvs = 1;
-    conoutf("generated test view cell of size %d at %.1f, %.1f, %.1f (%d B)", size, camera1->o.x, camera1->o.y, camera1->o.z, len);
+    conoutf("generated test view cell of size %d at %.1f, %.1f, %.1f (%d B)", size, camera1->o.x, camera1->o.y, camera1->o.z, lockedpvsbuf.length());
 
     origpvsnodes.setsize(0);
     numwaterplanes = oldnumwaterplanes;
@@ -1093,11 +1405,11 @@ void testpvs(int *vcsize)
 
 COMMAND(testpvs, "i");
 
-void genpvs(int *viewcellsize)
+static void buildpvs(int viewcellsize, bool update)
 {
-    if(worldsize > 1<<15)
+    if(update && viewcells && pvsdirtymin.x > pvsdirtymax.x)
     {
-        conoutf(CON_ERROR, "map is too large for PVS");
+        conoutf("PVS is already up to date");
         return;
     }
 
@@ -1107,75 +1419,133 @@ void genpvs(int *viewcellsize)
 
     renderprogress(0, "finding view cells");
 
+    ivec dirtymin = pvsdirtymin, dirtymax = pvsdirtymax;
+    uint oldnumwaterplanes = numwaterplanes;
+    int oldwaterplanes[MAXWATERPVS];
+    loopi(numwaterplanes) oldwaterplanes[i] = waterplanes[i].height;
+    reusedviewcells = 0;
+    if(update && viewcells && pvsworldscale == worldscale)
+    {
+        prevviewcells = viewcells;
+        viewcells = NULL;
+        prevpvs.move(pvs);
+        prevpvsbuf.move(pvsbuf);
+    }
+
     clearpvs();
     calcpvsbounds();
     findwaterplanes();
 
+    // the water occlusion bits are indexed by plane, so cells can only be kept if the planes are unchanged
+    if(prevviewcells)
+    {
+        if(numwaterplanes != oldnumwaterplanes) clearprevpvs();
+        else loopi(numwaterplanes) if(waterplanes[i].height != oldwaterplanes[i]) { clearprevpvs(); break; }
+    }
+    pvsdirtymin = dirtymin;
+    pvsdirtymax = dirtymax;
+
     pvsnode &root = origpvsnodes.add();
     memset(root.edges.v, 0xFF, 3);
     root.flags = 0;
     root.children = 0;
     genpvsnodes(worldroot);
 
-    totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
+    totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, viewcellsize>0 ? viewcellsize : 32);
     numviewcells = 0;
     genpvs_canceled = false;
     check_genpvs_progress = false;
-    SDL_TimerID timer = 0;
     int numthreads = pvsthreads > 0 ? pvsthreads : numcpus;
-    if(numthreads<=1)
-    {
-        pvsworkers.add(new pvsworker);
-        timer = SDL_AddTimer(500, genpvs_timer, NULL);
-    }
+    if(numthreads<=1) pvsworkers.add(new pvsworker);
+    SDL_TimerID timer = SDL_AddTimer(500, genpvs_timer, NULL);
     viewcells = new viewcellnode;
-    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
-    if(numthreads<=1)
-    {
-        SDL_RemoveTimer(timer);
-    }
-    else
+    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, viewcellsize>0 ? viewcellsize : 32);
+    if(numthreads>1 && viewcellrequests.length())
     {
+        // the requests are in octree order, so handing each worker an even slice gives it whole subtrees,
+        // and the main thread works its own slice between progress updates
         renderprogress(0, "creating threads");
         if(!pvsmutex) pvsmutex = SDL_CreateMutex();
-        if(!viewcellmutex) viewcellmutex = SDL_CreateMutex();
+        int numrequests = viewcellrequests.length();
         loopi(numthreads)
         {
             pvsworker *w = pvsworkers.add(new pvsworker);
-            w->thread = SDL_CreateThread(pvsworker::run, "pvs worker", w);
+            w->settasks((i*numrequests)/numthreads, ((i+1)*numrequests)/numthreads);
         }
+        for(int i = 1; i < numthreads; i++) pvsworkers[i]->thread = SDL_CreateThread(pvsworkerthread, "pvs worker", pvsworkers[i]);
         show_genpvs_progress(0, 0);
-        while(!genpvs_canceled)
-        {
-            SDL_Delay(500);
-            SDL_LockMutex(viewcellmutex);
-            int unique = pvs.length(), processed = numviewcells, remaining = viewcellrequests.length();
-            SDL_UnlockMutex(viewcellmutex);
-            show_genpvs_progress(unique, processed);
-            if(!remaining) break;
-        }
-        SDL_LockMutex(viewcellmutex);
-        viewcellrequests.setsize(0);
-        SDL_UnlockMutex(viewcellmutex);
-        loopv(pvsworkers) SDL_WaitThread(pvsworkers[i]->thread, NULL);
+        runpvstasks(*pvsworkers[0], true);
+        for(int i = 1; i < numthreads; i++) if(pvsworkers[i]->thread) SDL_WaitThread(pvsworkers[i]->thread, NULL);
     }
+    SDL_RemoveTimer(timer);
+    viewcellrequests.setsize(0);
     pvsworkers.deletecontents();
 
     origpvsnodes.setsize(0);
     pvscompress.clear();
+    pvsnodecompress.clear();
+    clearprevpvs();
+    packpvs();
+    pvsdirtymin = ivec(INT_MAX, INT_MAX, INT_MAX);
+    pvsdirtymax = ivec(INT_MIN, INT_MIN, INT_MIN);
+    pvsworldscale = worldscale;
 
     Uint32 end = SDL_GetTicks();
     if(genpvs_canceled)
     {
         clearpvs();
         conoutf("genpvs aborted");
+        return;
     }
-    else conoutf("generated %d unique view cells totaling %.1f kB and averaging %d B (%.1f seconds)",
+    if(update) conoutf("kept %d of %d view cells unaffected by edits", reusedviewcells, totalviewcells);
+    conoutf("generated %d unique view cells totaling %.1f kB and averaging %d B (%.1f seconds)",
             pvs.length(), pvsbuf.length()/1024.0f, pvsbuf.length()/max(pvs.length(), 1), (end - start) / 1000.0f);
 }
 
+void genpvs(int *viewcellsize)
+{
+    buildpvs(*viewcellsize, false);
+}
+
 COMMAND(genpvs, "i");
 
+void updatepvs(int *viewcellsize)
+{
+    buildpvs(*viewcellsize, true);
+}
+
+COMMAND(updatepvs, "i");
+
+// loads each listed map and times a full genpvs on it, so the generator can be compared across builds
+// with e.g. -x"pvsbench [complex dust2] 32; quit"
+void pvsbench(char *maps, int *viewcellsize)
+{
+    vector<char *> names;
+    explodelist(maps, names);
+    double total = 0;
+    int numrun = 0;
+    loopv(names)
+    {
+        if(!load_world(names[i]))
+        {
+            conoutf(CON_ERROR, "pvsbench: could not load map %s", names[i]);
+            continue;
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        buildpvs(*viewcellsize, false);
+        double secs = (SDL_GetPerformanceCounter() - start)/double(SDL_GetPerformanceFrequency());
+        if(genpvs_canceled) break;
+        conoutf("pvsbench: %s: %d view cells, %d unique, %.1f kB, %.2f seconds", names[i], totalviewcells, pvs.length(), pvsbuf.length()/1024.0f, secs);
+        total += secs;
+        numrun++;
+    }
+    int numthreads = pvsthreads > 0 ? pvsthreads : numcpus;
+    if(numrun) conoutf("pvsbench: %d maps in %.2f seconds with %d threads", numrun, total, numthreads);
+    names.deletearrays();
+}
+
+COMMAND(pvsbench, "si");
+
 void pvsstats()
 {
     conoutf("%d unique view cells totaling %.1f kB and averaging %d B",
@@ -1184,7 +1554,7 @@ void pvsstats()
 
 COMMAND(pvsstats, "");
 
-static inline bool pvsoccluded(uchar *buf, const ivec &co, int size, const ivec &bbmin, const ivec &bbmax)
+static inline bool pvsoccluded(const uchar *base, const uchar *buf, const ivec &co, int size, const ivec &bbmin, const ivec &bbmax)
 {
     uchar leafmask = buf[0];
     loopoctabox(co, size, bbmin, bbmax)
@@ -1196,12 +1566,12 @@ static inline bool pvsoccluded(uchar *buf, const ivec &co, int size, const ivec
             if(!leafvalues || (leafvalues!=0xFF && octaboxoverlap(o, size>>1, bbmin, bbmax)&~leafvalues))
                 return false;
         }
-        else if(!pvsoccluded(buf+9*buf[1+i], o, size>>1, bbmin, bbmax)) return false;
+        else if(!pvsoccluded(base, pvschild(base, buf, i), o, size>>1, bbmin, bbmax)) return false;
     }
     return true;
 }
 
-static inline bool pvsoccluded(uchar *buf, const ivec &bbmin, const ivec &bbmax)
+static inline bool pvsoccluded(const uchar *base, const uchar *buf, const ivec &bbmin, const ivec &bbmax)
 {
     int diff = (bbmin.x^bbmax.x) | (bbmin.y^bbmax.y) | (bbmin.z^bbmax.z);
     if(diff&~((1<<worldscale)-1)) return false;
@@ -1216,27 +1586,54 @@ static inline bool pvsoccluded(uchar *buf, const ivec &bbmin, const ivec &bbmax)
             uchar leafvalues = buf[1+i];
             return leafvalues && (leafvalues==0xFF || !(octaboxoverlap(ivec(bbmin).mask(~((2<<scale)-1)), 1<<scale, bbmin, bbmax)&~leafvalues));
         }
-        buf += 9*buf[1+i];
+        buf = pvschild(base, buf, i);
     }
-    return pvsoccluded(buf, ivec(bbmin).mask(~((2<<scale)-1)), 1<<scale, bbmin, bbmax);
+    return pvsoccluded(base, buf, ivec(bbmin).mask(~((2<<scale)-1)), 1<<scale, bbmin, bbmax);
+}
+
+// boxes spanning at most two grid cells per axis are answered from the grid unless one of the cells
+// is only partly hidden, in which case the tree still gives the exact answer
+static inline bool curpvsoccluded(const ivec &bbmin, const ivec &bbmax)
+{
+    if(bbmin.x >= 0 && bbmin.y >= 0 && bbmin.z >= 0 &&
+       bbmax.x < worldsize && bbmax.y < worldsize && bbmax.z < worldsize &&
+       bbmin.x < bbmax.x && bbmin.y < bbmax.y && bbmin.z < bbmax.z)
+    {
+        if(pvsgridnode != curpvs) updatepvsgrid();
+        ivec gmin = ivec(bbmin).shr(pvsgridshift), gmax = ivec(bbmax).sub(1).shr(pvsgridshift);
+        if(gmax.x - gmin.x <= 1 && gmax.y - gmin.y <= 1 && gmax.z - gmin.z <= 1)
+        {
+            bool mixed = false;
+            for(int z = gmin.z; z <= gmax.z; z++) for(int y = gmin.y; y <= gmax.y; y++) for(int x = gmin.x; x <= gmax.x; x++)
+            {
+                switch(pvsgrid[pvsgridindex(x, y, z)])
+                {
+                    case PVSGRID_VISIBLE: return false;
+                    case PVSGRID_MIXED: mixed = true; break;
+                }
+            }
+            if(!mixed) return true;
+        }
+    }
+    return pvsoccluded(curpvsbase, curpvs, bbmin, bbmax);
 }
 
 bool pvsoccluded(const ivec &bbmin, const ivec &bbmax)
 {
-    return curpvs!=NULL && pvsoccluded(curpvs, bbmin, bbmax);
+    return curpvs!=NULL && curpvsoccluded(bbmin, bbmax);
 }
 
 bool pvsoccludedsphere(const vec &center, float radius)
 {
     if(curpvs==NULL) return false;
     ivec bbmin(vec(center).sub(radius)), bbmax(vec(center).add(radius+1));
-    return pvsoccluded(curpvs, bbmin, bbmax);
+    return curpvsoccluded(bbmin, bbmax);
 }
 
 bool waterpvsoccluded(int height)
 {
     if(!curwaterpvs) return false;
-    if(lockedpvs)
+    if(lockedpvsbuf.length())
     {
         loopi(MAXWATERPVS) if(lockedwaterplanes[i]==height) return (curwaterpvs&(1<<i))!=0;
     }
@@ -1296,16 +1693,53 @@ void loadpvs(stream *f, int numpvs)
         numwaterplanes = f->getlil<uint>();
         loopi(numwaterplanes) waterplanes[i].height = f->getlil<int>();
     }
-    int offset = 0;
-    loopi(numpvs)
+    if(mapversion >= 2)
+    {
+        int offset = totallen;
+        loopi(numpvs)
+        {
+            ushort len = f->getlil<ushort>();
+            pvs.add(pvsdata(0, len));
+            offset -= len;
+        }
+        loopv(pvs)
+        {
+            pvs[i].offset = offset;
+            offset += pvs[i].len;
+        }
+        f->read(pvsbuf.reserve(totallen).buf, totallen);
+        pvsbuf.advance(totallen);
+    }
+    else
     {
-        ushort len = f->getlil<ushort>();
-        pvs.add(pvsdata(offset, len));
-        offset += len;
+        // maps before version 2 stored each view cell as a flat serialized tree, so intern them into the shared node pool
+        vector<uchar> buf;
+        int offset = 0;
+        loopi(numpvs)
+        {
+            ushort len = f->getlil<ushort>();
+            pvs.add(pvsdata(offset, len));
+            offset += len;
+        }
+        f->read(buf.reserve(totallen).buf, totallen);
+        buf.advance(totallen);
+        vector<uint> roots;
+        loopv(pvs) roots.add(internpvs(pvsbuf, &buf[pvs[i].offset + pvs[i].len%9]));
+        pvsnodecompress.clear();
+        loopv(pvs)
+        {
+            pvsdata &d = pvs[i];
+            int wbytes = d.len%9;
+            offset = pvsbuf.length();
+            pvsbuf.put(&buf[d.offset], wbytes);
+            putpvsref(pvsbuf.pad(4), roots[i]);
+            d.offset = offset;
+            d.len = wbytes + 4;
+        }
     }
-    f->read(pvsbuf.reserve(totallen).buf, totallen);
-    pvsbuf.advance(totallen);
+    pvsgridnode = NULL;
     viewcells = loadviewcells(f);
+    pvsworldscale = worldscale;
 }
 
 int getnumviewcells() { return pvs.length(); }
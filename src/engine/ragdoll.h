@@ -1,3 +1,8 @@
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define RAGDOLLSSE
+#endif
+
 struct ragdollskel
 {
     struct vert
@@ -33,7 +38,6 @@ struct ragdollskel
     struct rotfriction
     {
         int tri[2];
-        matrix3 middle;
     };
 
     struct joint
@@ -48,6 +52,13 @@ struct ragdollskel
         int bone, parent;
     };
 
+    // distance limits repacked four at a time for the vectorized solver, unused lanes can never trigger
+    struct distgroup
+    {
+        int vert1[4], vert2[4];
+        float mindist[4], maxdist[4];
+    };
+
     bool loaded, animjoints;
     int eye;
     vector<vert> verts;
@@ -57,6 +68,7 @@ struct ragdollskel
     vector<rotfriction> rotfrictions;
     vector<joint> joints;
     vector<reljoint> reljoints;
+    vector<distgroup> distgroups;
 
     ragdollskel() : loaded(false), animjoints(false), eye(-1) {}
 
@@ -103,10 +115,37 @@ struct ragdollskel
         }
     }
 
+    void setupdistgroups()
+    {
+        distgroups.shrink(0);
+        for(int i = 0; i < distlimits.length(); i += 4)
+        {
+            distgroup &g = distgroups.add();
+            loopk(4)
+            {
+                if(i+k < distlimits.length())
+                {
+                    const distlimit &d = distlimits[i+k];
+                    g.vert1[k] = d.vert[0];
+                    g.vert2[k] = d.vert[1];
+                    g.mindist[k] = d.mindist;
+                    g.maxdist[k] = d.maxdist;
+                }
+                else
+                {
+                    g.vert1[k] = g.vert2[k] = 0;
+                    g.mindist[k] = -1;
+                    g.maxdist[k] = 1e16f;
+                }
+            }
+        }
+    }
+
     void setup()
     {
         setupjoints();
         setuprotfrictions();
+        setupdistgroups();
 
         loaded = true;
     }
@@ -121,21 +160,15 @@ struct ragdollskel
 
 struct ragdolldata
 {
-    struct vert
-    {
-        vec oldpos, pos, newpos, undo;
-        float weight;
-        bool collided, stuck;
-
-        vert() : oldpos(0, 0, 0), pos(0, 0, 0), newpos(0, 0, 0), undo(0, 0, 0), weight(0), collided(false), stuck(true) {}
-    };
-
     ragdollskel *skel;
     int millis, collidemillis, collisions, floating, lastmove, unsticks;
     vec offset, center;
     float radius, timestep, scale;
-    vert *verts;
-    matrix3 *tris;
+    // vertex state is split into one array per field, so each solver pass only streams what it touches
+    vec *pos, *oldpos, *newpos, *undo;
+    float *weights;
+    bool *collided, *stuck;
+    matrix3 *tris, *rotfrictions;
     matrix4x3 *animjoints;
     dualquat *reljoints;
 
@@ -150,17 +183,38 @@ struct ragdolldata
           radius(0),
           timestep(0),
           scale(scale),
-          verts(new vert[skel->verts.length()]),
+          pos(new vec[skel->verts.length()]),
+          oldpos(new vec[skel->verts.length()]),
+          newpos(new vec[skel->verts.length()]),
+          undo(new vec[skel->verts.length()]),
+          weights(new float[skel->verts.length()]),
+          collided(new bool[skel->verts.length()]),
+          stuck(new bool[skel->verts.length()]),
           tris(new matrix3[skel->tris.length()]),
+          rotfrictions(skel->rotfrictions.empty() ? NULL : new matrix3[skel->rotfrictions.length()]),
           animjoints(!skel->animjoints || skel->joints.empty() ? NULL : new matrix4x3[skel->joints.length()]),
           reljoints(skel->reljoints.empty() ? NULL : new dualquat[skel->reljoints.length()])
     {
+        loopv(skel->verts)
+        {
+            pos[i] = oldpos[i] = newpos[i] = undo[i] = vec(0, 0, 0);
+            weights[i] = 0;
+            collided[i] = false;
+            stuck[i] = true;
+        }
     }
 
     ~ragdolldata()
     {
-        delete[] verts;
+        delete[] pos;
+        delete[] oldpos;
+        delete[] newpos;
+        delete[] undo;
+        delete[] weights;
+        delete[] collided;
+        delete[] stuck;
         delete[] tris;
+        if(rotfrictions) delete[] rotfrictions;
         if(animjoints) delete[] animjoints;
         if(reljoints) delete[] reljoints;
     }
@@ -169,19 +223,19 @@ struct ragdolldata
     {
         if(!animjoints) return;
         ragdollskel::joint &j = skel->joints[i];
-        vec pos(0, 0, 0);
-        loopk(3) if(j.vert[k]>=0) pos.add(verts[j.vert[k]].pos);
-        pos.mul(j.weight);
+        vec jointpos(0, 0, 0);
+        loopk(3) if(j.vert[k]>=0) jointpos.add(pos[j.vert[k]]);
+        jointpos.mul(j.weight);
 
         ragdollskel::tri &t = skel->tris[j.tri];
         matrix4x3 m;
-        const vec &v1 = verts[t.vert[0]].pos,
-                  &v2 = verts[t.vert[1]].pos,
-                  &v3 = verts[t.vert[2]].pos;
+        const vec &v1 = pos[t.vert[0]],
+                  &v2 = pos[t.vert[1]],
+                  &v3 = pos[t.vert[2]];
         m.a = vec(v2).sub(v1).normalize();
         m.c.cross(m.a, vec(v3).sub(v1)).normalize();
         m.b.cross(m.c, m.a);
-        m.d = pos;
+        m.d = jointpos;
         animjoints[i].transposemul(m, anim);
     }
 
@@ -191,9 +245,9 @@ struct ragdolldata
         {
             ragdollskel::tri &t = skel->tris[i];
             matrix3 &m = tris[i];
-            const vec &v1 = verts[t.vert[0]].pos,
-                      &v2 = verts[t.vert[1]].pos,
-                      &v3 = verts[t.vert[2]].pos;
+            const vec &v1 = pos[t.vert[0]],
+                      &v2 = pos[t.vert[1]],
+                      &v3 = pos[t.vert[2]];
             m.a = vec(v2).sub(v1).normalize();
             m.c.cross(m.a, vec(v3).sub(v1)).normalize();
             m.b.cross(m.c, m.a);
@@ -203,29 +257,31 @@ struct ragdolldata
     void calcboundsphere()
     {
         center = vec(0, 0, 0);
-        loopv(skel->verts) center.add(verts[i].pos);
+        loopv(skel->verts) center.add(pos[i]);
         center.div(skel->verts.length());
         radius = 0;
-        loopv(skel->verts) radius = max(radius, verts[i].pos.dist(center));
+        loopv(skel->verts) radius = max(radius, pos[i].dist(center));
     }
 
     void init(dynent *d)
     {
         extern int ragdolltimestepmin;
         float ts = ragdolltimestepmin/1000.0f;
-        loopv(skel->verts) (verts[i].oldpos = verts[i].pos).sub(vec(d->vel).add(d->falling).mul(ts));
+        loopv(skel->verts) (oldpos[i] = pos[i]).sub(vec(d->vel).add(d->falling).mul(ts));
         timestep = ts;
 
         calctris();
         calcboundsphere();
         offset = d->o;
-        offset.sub(skel->eye >= 0 ? verts[skel->eye].pos : center);
+        offset.sub(skel->eye >= 0 ? pos[skel->eye] : center);
         offset.z += (d->eyeheight + d->aboveeye)/2;
     }
 
     void move(dynent *pl, float ts);
-    void constrain();
+    void constrain(int iterations);
     void constraindist();
+    void applyconstraint(int v1, int v2, const vec &dir);
+    void applyconstraints();
     void applyrotlimit(ragdollskel::tri &t1, ragdollskel::tri &t2, float angle, const vec &axis);
     void constrainrot();
     void calcrotfriction();
@@ -234,7 +290,7 @@ struct ragdolldata
 
     static inline bool collidevert(const vec &pos, const vec &dir, float radius)
     {
-        static struct vertent : physent
+        static thread_local struct vertent : physent
         {
             vertent()
             {
@@ -254,57 +310,105 @@ struct ragdolldata
     parented transform = parent{invert(curtri) * origtrig} * (invert(parent{base2anim}) * base2anim)
 */
 
+inline void ragdolldata::applyconstraint(int v1, int v2, const vec &dir)
+{
+    vec center = vec(pos[v1]).add(pos[v2]).mul(0.5f);
+    newpos[v1].add(vec(center).sub(dir));
+    weights[v1]++;
+    newpos[v2].add(vec(center).add(dir));
+    weights[v2]++;
+}
+
+// the vectorized pass only finds the violated limits of each group and their correction scale, the
+// corrections are then accumulated lane by lane in the same order as the scalar loop
 void ragdolldata::constraindist()
 {
     float invscale = 1.0f/scale;
+#ifdef RAGDOLLSSE
+    const __m128 half = _mm_set1_ps(0.5f), vinvscale = _mm_set1_ps(invscale);
+    loopv(skel->distgroups)
+    {
+        const ragdollskel::distgroup &g = skel->distgroups[i];
+        const vec &a0 = pos[g.vert1[0]], &a1 = pos[g.vert1[1]], &a2 = pos[g.vert1[2]], &a3 = pos[g.vert1[3]],
+                  &b0 = pos[g.vert2[0]], &b1 = pos[g.vert2[1]], &b2 = pos[g.vert2[2]], &b3 = pos[g.vert2[3]];
+        __m128 dx = _mm_sub_ps(_mm_setr_ps(b0.x, b1.x, b2.x, b3.x), _mm_setr_ps(a0.x, a1.x, a2.x, a3.x)),
+               dy = _mm_sub_ps(_mm_setr_ps(b0.y, b1.y, b2.y, b3.y), _mm_setr_ps(a0.y, a1.y, a2.y, a3.y)),
+               dz = _mm_sub_ps(_mm_setr_ps(b0.z, b1.z, b2.z, b3.z), _mm_setr_ps(a0.z, a1.z, a2.z, a3.z)),
+               dist = _mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz))), vinvscale),
+               mindist = _mm_loadu_ps(g.mindist), maxdist = _mm_loadu_ps(g.maxdist),
+               below = _mm_cmplt_ps(dist, mindist), above = _mm_cmpgt_ps(dist, maxdist);
+        int mask = _mm_movemask_ps(_mm_or_ps(below, above));
+        if(!mask) continue;
+        __m128 cdist = _mm_or_ps(_mm_and_ps(below, mindist), _mm_andnot_ps(below, maxdist));
+        float x[4], y[4], z[4], d[4], c[4], k[4];
+        _mm_storeu_ps(x, dx);
+        _mm_storeu_ps(y, dy);
+        _mm_storeu_ps(z, dz);
+        _mm_storeu_ps(d, dist);
+        _mm_storeu_ps(c, cdist);
+        _mm_storeu_ps(k, _mm_div_ps(_mm_mul_ps(cdist, half), dist));
+        loopj(4) if(mask&(1<<j))
+        {
+            vec dir = d[j] > 1e-4f ? vec(x[j], y[j], z[j]).mul(k[j]) : vec(0, 0, c[j]*0.5f/invscale);
+            applyconstraint(g.vert1[j], g.vert2[j], dir);
+        }
+    }
+#else
     loopv(skel->distlimits)
     {
         ragdollskel::distlimit &d = skel->distlimits[i];
-        vert &v1 = verts[d.vert[0]], &v2 = verts[d.vert[1]];
-        vec dir = vec(v2.pos).sub(v1.pos);
+        vec dir = vec(pos[d.vert[1]]).sub(pos[d.vert[0]]);
         float dist = dir.magnitude()*invscale, cdist;
         if(dist < d.mindist) cdist = d.mindist;
         else if(dist > d.maxdist) cdist = d.maxdist;
         else continue;
         if(dist > 1e-4f) dir.mul(cdist*0.5f/dist);
         else dir = vec(0, 0, cdist*0.5f/invscale);
-        vec center = vec(v1.pos).add(v2.pos).mul(0.5f);
-        v1.newpos.add(vec(center).sub(dir));
-        v1.weight++;
-        v2.newpos.add(vec(center).add(dir));
-        v2.weight++;
+        applyconstraint(d.vert[0], d.vert[1], dir);
+    }
+#endif
+}
+
+// moves each vertex to the average of the positions its constraints asked for
+void ragdolldata::applyconstraints()
+{
+    loopv(skel->verts) if(weights[i])
+    {
+        pos[i] = newpos[i].div(weights[i]);
+        newpos[i] = vec(0, 0, 0);
+        weights[i] = 0;
     }
 }
 
 inline void ragdolldata::applyrotlimit(ragdollskel::tri &t1, ragdollskel::tri &t2, float angle, const vec &axis)
 {
-    vert &v1a = verts[t1.vert[0]], &v1b = verts[t1.vert[1]], &v1c = verts[t1.vert[2]],
-         &v2a = verts[t2.vert[0]], &v2b = verts[t2.vert[1]], &v2c = verts[t2.vert[2]];
-    vec m1 = vec(v1a.pos).add(v1b.pos).add(v1c.pos).div(3),
-        m2 = vec(v2a.pos).add(v2b.pos).add(v2c.pos).div(3),
+    int v1a = t1.vert[0], v1b = t1.vert[1], v1c = t1.vert[2],
+        v2a = t2.vert[0], v2b = t2.vert[1], v2c = t2.vert[2];
+    vec m1 = vec(pos[v1a]).add(pos[v1b]).add(pos[v1c]).div(3),
+        m2 = vec(pos[v2a]).add(pos[v2b]).add(pos[v2c]).div(3),
         q1a, q1b, q1c, q2a, q2b, q2c;
-    float w1 = q1a.cross(axis, vec(v1a.pos).sub(m1)).magnitude() +
-               q1b.cross(axis, vec(v1b.pos).sub(m1)).magnitude() +
-               q1c.cross(axis, vec(v1c.pos).sub(m1)).magnitude(),
-          w2 = q2a.cross(axis, vec(v2a.pos).sub(m2)).magnitude() +
-               q2b.cross(axis, vec(v2b.pos).sub(m2)).magnitude() +
-               q2c.cross(axis, vec(v2c.pos).sub(m2)).magnitude();
+    float w1 = q1a.cross(axis, vec(pos[v1a]).sub(m1)).magnitude() +
+               q1b.cross(axis, vec(pos[v1b]).sub(m1)).magnitude() +
+               q1c.cross(axis, vec(pos[v1c]).sub(m1)).magnitude(),
+          w2 = q2a.cross(axis, vec(pos[v2a]).sub(m2)).magnitude() +
+               q2b.cross(axis, vec(pos[v2b]).sub(m2)).magnitude() +
+               q2c.cross(axis, vec(pos[v2c]).sub(m2)).magnitude();
     angle /= w1 + w2 + 1e-9f;
     float a1 = angle*w2, a2 = -angle*w1,
           s1 = sinf(a1), s2 = sinf(a2);
     vec c1 = vec(axis).mul(1 - cosf(a1)), c2 = vec(axis).mul(1 - cosf(a2));
-    v1a.newpos.add(vec().cross(c1, q1a).madd(q1a, s1).add(v1a.pos));
-    v1a.weight++;
-    v1b.newpos.add(vec().cross(c1, q1b).madd(q1b, s1).add(v1b.pos));
-    v1b.weight++;
-    v1c.newpos.add(vec().cross(c1, q1c).madd(q1c, s1).add(v1c.pos));
-    v1c.weight++;
-    v2a.newpos.add(vec().cross(c2, q2a).madd(q2a, s2).add(v2a.pos));
-    v2a.weight++;
-    v2b.newpos.add(vec().cross(c2, q2b).madd(q2b, s2).add(v2b.pos));
-    v2b.weight++;
-    v2c.newpos.add(vec().cross(c2, q2c).madd(q2c, s2).add(v2c.pos));
-    v2c.weight++;
+    newpos[v1a].add(vec().cross(c1, q1a).madd(q1a, s1).add(pos[v1a]));
+    weights[v1a]++;
+    newpos[v1b].add(vec().cross(c1, q1b).madd(q1b, s1).add(pos[v1b]));
+    weights[v1b]++;
+    newpos[v1c].add(vec().cross(c1, q1c).madd(q1c, s1).add(pos[v1c]));
+    weights[v1c]++;
+    newpos[v2a].add(vec().cross(c2, q2a).madd(q2a, s2).add(pos[v2a]));
+    weights[v2a]++;
+    newpos[v2b].add(vec().cross(c2, q2b).madd(q2b, s2).add(pos[v2b]));
+    weights[v2b]++;
+    newpos[v2c].add(vec().cross(c2, q2c).madd(q2c, s2).add(pos[v2c]));
+    weights[v2c]++;
 }
 
 void ragdolldata::constrainrot()
@@ -336,7 +440,7 @@ void ragdolldata::calcrotfriction()
     loopv(skel->rotfrictions)
     {
         ragdollskel::rotfriction &r = skel->rotfrictions[i];
-        r.middle.transposemul(tris[r.tri[0]], tris[r.tri[1]]);
+        rotfrictions[i].transposemul(tris[r.tri[0]], tris[r.tri[1]]);
     }
 }
 
@@ -348,7 +452,7 @@ void ragdolldata::applyrotfriction(float ts)
     {
         ragdollskel::rotfriction &r = skel->rotfrictions[i];
         matrix3 rot;
-        rot.mul(tris[r.tri[0]], r.middle);
+        rot.mul(tris[r.tri[0]], rotfrictions[i]);
         rot.multranspose(tris[r.tri[1]]);
 
         vec axis;
@@ -358,81 +462,53 @@ void ragdolldata::applyrotfriction(float ts)
         angle *= -(fabs(angle) >= stopangle ? rotfric : 1.0f);
         applyrotlimit(skel->tris[r.tri[0]], skel->tris[r.tri[1]], angle, axis);
     }
-    loopv(skel->verts)
-    {
-        vert &v = verts[i];
-        if(!v.weight) continue;
-        v.pos = v.newpos.div(v.weight);
-        v.newpos = vec(0, 0, 0);
-        v.weight = 0;
-    }
+    applyconstraints();
 }
 
 void ragdolldata::tryunstick(float speed)
 {
     vec unstuck(0, 0, 0);
-    int stuck = 0;
+    int numstuck = 0;
     loopv(skel->verts)
     {
-        vert &v = verts[i];
-        if(v.stuck)
+        if(stuck[i])
         {
-            if(collidevert(v.pos, vec(0, 0, 0), skel->verts[i].radius)) { stuck++; continue; }
-            v.stuck = false;
+            if(collidevert(pos[i], vec(0, 0, 0), skel->verts[i].radius)) { numstuck++; continue; }
+            stuck[i] = false;
         }
-        unstuck.add(v.pos);
+        unstuck.add(pos[i]);
     }
     unsticks = 0;
-    if(!stuck || stuck >= skel->verts.length()) return;
-    unstuck.div(skel->verts.length() - stuck);
-    loopv(skel->verts)
+    if(!numstuck || numstuck >= skel->verts.length()) return;
+    unstuck.div(skel->verts.length() - numstuck);
+    loopv(skel->verts) if(stuck[i])
     {
-        vert &v = verts[i];
-        if(v.stuck)
-        {
-            v.pos.add(vec(unstuck).sub(v.pos).rescale(speed));
-            unsticks++;
-        }
+        pos[i].add(vec(unstuck).sub(pos[i]).rescale(speed));
+        unsticks++;
     }
 }
 
 VAR(ragdollconstrain, 1, 7, 100);
+VARP(ragdolllod, 0, 0, 10000);
+VARP(ragdolllodconstrain, 1, 3, 100);
 
-void ragdolldata::constrain()
+void ragdolldata::constrain(int iterations)
 {
-    loopi(ragdollconstrain)
+    loopi(iterations)
     {
         constraindist();
-        loopvj(skel->verts)
-        {
-            vert &v = verts[j];
-            v.undo = v.pos;
-            if(v.weight)
-            {
-                v.pos = v.newpos.div(v.weight);
-                v.newpos = vec(0, 0, 0);
-                v.weight = 0;
-            }
-        }
+        memcpy(undo, pos, skel->verts.length()*sizeof(vec));
+        applyconstraints();
 
         constrainrot();
-        loopvj(skel->verts)
+        applyconstraints();
+        loopvj(skel->verts) if(pos[j] != undo[j] && collidevert(pos[j], vec(pos[j]).sub(undo[j]), skel->verts[j].radius))
         {
-            vert &v = verts[j];
-            if(v.weight)
-            {
-                v.pos = v.newpos.div(v.weight);
-                v.newpos = vec(0, 0, 0);
-                v.weight = 0;
-            }
-            if(v.pos != v.undo && collidevert(v.pos, vec(v.pos).sub(v.undo), skel->verts[j].radius))
-            {
-                vec dir = vec(v.pos).sub(v.oldpos);
-                float facing = dir.dot(collidewall);
-                if(facing < 0) v.oldpos = vec(v.undo).sub(dir.msub(collidewall, 2*facing));
-                v.pos = v.undo;
-                v.collided = true;
-            }
+            vec dir = vec(pos[j]).sub(oldpos[j]);
+            float facing = dir.dot(collidewall);
+            if(facing < 0) oldpos[j] = vec(undo[j]).sub(dir.msub(collidewall, 2*facing));
+            pos[j] = undo[j];
+            collided[j] = true;
         }
     }
 }
@@ -453,12 +529,12 @@ void ragdolldata::move(dynent *pl, float ts)
 
     int material = lookupmaterial(vec(center.x, center.y, center.z + radius/2));
     bool water = isliquid(material&MATF_VOLUME);
-    if(!pl->inwater && water) game::physicstrigger(pl, true, 0, -1, material&MATF_VOLUME);
+    if(!pl->inwater && water) physicstrigger(pl, true, 0, -1, material&MATF_VOLUME);
     else if(pl->inwater && !water)
     {
         material = lookupmaterial(center);
         water = isliquid(material&MATF_VOLUME);
-        if(!water) game::physicstrigger(pl, true, 0, 1, pl->inwater);
+        if(!water) physicstrigger(pl, true, 0, 1, pl->inwater);
     }
     pl->inwater = water ? material&MATF_VOLUME : MAT_AIR;
 
@@ -468,25 +544,23 @@ void ragdolldata::move(dynent *pl, float ts)
     collisions = 0;
     loopv(skel->verts)
     {
-        vert &v = verts[i];
-        vec dpos = vec(v.pos).sub(v.oldpos);
+        vec dpos = vec(pos[i]).sub(oldpos[i]);
         dpos.z -= GRAVITY*ts*ts;
         if(water) dpos.z += 0.25f*sinf(detrnd(size_t(this)+i, 360)*RAD + lastmillis/10000.0f*M_PI)*ts;
-        dpos.mul(pow((water ? ragdollwaterfric : 1.0f) * (v.collided ? ragdollgroundfric : airfric), ts*1000.0f/ragdolltimestepmin)*tsfric);
-        v.oldpos = v.pos;
-        v.pos.add(dpos);
+        dpos.mul(pow((water ? ragdollwaterfric : 1.0f) * (collided[i] ? ragdollgroundfric : airfric), ts*1000.0f/ragdolltimestepmin)*tsfric);
+        oldpos[i] = pos[i];
+        pos[i].add(dpos);
     }
     applyrotfriction(ts);
     loopv(skel->verts)
     {
-        vert &v = verts[i];
-        if(v.pos.z < 0) { v.pos.z = 0; v.oldpos = v.pos; collisions++; }
-        vec dir = vec(v.pos).sub(v.oldpos);
-        v.collided = collidevert(v.pos, dir, skel->verts[i].radius);
-        if(v.collided)
+        if(pos[i].z < 0) { pos[i].z = 0; oldpos[i] = pos[i]; collisions++; }
+        vec dir = vec(pos[i]).sub(oldpos[i]);
+        collided[i] = collidevert(pos[i], dir, skel->verts[i].radius);
+        if(collided[i])
         {
-            v.pos = v.oldpos;
-            v.oldpos.sub(dir.reflect(collidewall));
+            pos[i] = oldpos[i];
+            oldpos[i].sub(dir.reflect(collidewall));
             collisions++;
         }
     }
@@ -501,7 +575,8 @@ void ragdolldata::move(dynent *pl, float ts)
     }
     else if(++floating > 1 && lastmillis < collidemillis) collidemillis = 0;
 
-    constrain();
+    // distant ragdolls can settle with fewer solver iterations
+    constrain(ragdolllod && camera1->o.squaredist(center) > ragdolllod*ragdolllod ? min(ragdolllodconstrain, ragdollconstrain) : ragdollconstrain);
     calctris();
     calcboundsphere();
 }
@@ -524,7 +599,7 @@ void moveragdoll(dynent *d)
         }
     }
 
-    vec eye = d->ragdoll->skel->eye >= 0 ? d->ragdoll->verts[d->ragdoll->skel->eye].pos : d->ragdoll->center;
+    vec eye = d->ragdoll->skel->eye >= 0 ? d->ragdoll->pos[d->ragdoll->skel->eye] : d->ragdoll->center;
     eye.add(d->ragdoll->offset);
     float k = pow(ragdolleyesmooth, float(curtime)/ragdolleyesmoothmillis);
     d->o.lerp(eye, 1-k);
@@ -303,6 +303,44 @@ void rdanimjoints(int *on)
 }
 COMMAND(rdanimjoints, "i");
 
+// a stiff box standing in for a model ragdoll, so benchmarks can drop ragdolls without an animated model
+static ragdollskel *boxragdoll = NULL;
+
+void initboxragdoll(dynent *d)
+{
+    if(!boxragdoll)
+    {
+        boxragdoll = new ragdollskel;
+        loopi(8)
+        {
+            ragdollskel::vert &v = boxragdoll->verts.add();
+            v.pos = vec(i&1 ? 2 : -2, i&2 ? 2 : -2, i&4 ? 12 : 0);
+            v.radius = 1.5f;
+        }
+        static const int boxtris[4][3] = { { 0, 1, 3 }, { 0, 3, 2 }, { 4, 5, 7 }, { 4, 7, 6 } };
+        loopi(4)
+        {
+            ragdollskel::tri &t = boxragdoll->tris.add();
+            loopk(3) t.vert[k] = boxtris[i][k];
+        }
+        loopi(8) for(int j = i+1; j < 8; j++)
+        {
+            ragdollskel::distlimit &l = boxragdoll->distlimits.add();
+            l.vert[0] = i;
+            l.vert[1] = j;
+            float dist = boxragdoll->verts[i].pos.dist(boxragdoll->verts[j].pos);
+            l.mindist = dist*0.9f;
+            l.maxdist = dist*1.1f;
+        }
+        boxragdoll->setup();
+    }
+    DELETEP(d->ragdoll);
+    d->ragdoll = new ragdolldata(boxragdoll);
+    vec base(d->o.x, d->o.y, d->o.z - d->eyeheight);
+    loopv(boxragdoll->verts) d->ragdoll->pos[i] = vec(boxragdoll->verts[i].pos).add(base);
+    d->ragdoll->init(d);
+}
+
 // mapmodels
 
 vector<mapmodelinfo> mapmodels;
@@ -315,12 +353,14 @@ void mapmodel(char *name)
     if(name[0]) formatstring(mmi.name, "%s%s", mmprefix, name);
     else mmi.name[0] = '\0';
     mmi.m = mmi.collide = NULL;
+    resetcollidemodels();
 }
 
 void mapmodelreset(int *n)
 {
     if(!(identflags&IDF_OVERRIDDEN) && !game::allowedittoggle()) return;
     mapmodels.shrink(clamp(*n, 0, mapmodels.length()));
+    resetcollidemodels();
 }
 
 const char *mapmodelname(int i) { return mapmodels.inrange(i) ? mapmodels[i].name : NULL; }
@@ -464,6 +504,7 @@ void clearmodel(char *name)
     models.remove(name);
     m->cleanup();
     delete m;
+    resetcollidemodels();
     conoutf("cleared model %s", name);
 }
 
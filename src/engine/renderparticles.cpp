@@ -192,7 +192,7 @@ struct partrenderer
 
     virtual void preload()
     {
-        if(texname && !tex) tex = textureload(texname, texclamp);
+        if(texname && !tex) tex = preloadtexture(texname, texclamp);
     }
 
     //blend = 0 => remove it
@@ -891,8 +891,7 @@ struct skelmodel : animmodel
                 loopk(3) if(j.vert[k] >= 0)
                 {
                     ragdollskel::vert &v = ragdoll->verts[j.vert[k]];
-                    ragdolldata::vert &dv = d.verts[j.vert[k]];
-                    dv.pos.add(q.transform(v.pos).mul(v.weight));
+                    d.pos[j.vert[k]].add(q.transform(v.pos).mul(v.weight));
                 }
             }
             if(ragdoll->animjoints) loopv(ragdoll->joints)
@@ -902,11 +901,7 @@ struct skelmodel : animmodel
                 const dualquat &q = bdata[b.interpindex];
                 d.calcanimjoint(i, matrix4x3(q));
             }
-            loopv(ragdoll->verts)
-            {
-                ragdolldata::vert &dv = d.verts[i];
-                matrixstack[matrixpos].transform(vec(dv.pos).mul(p->model->scale), dv.pos);
-            }
+            loopv(ragdoll->verts) matrixstack[matrixpos].transform(vec(d.pos[i]).mul(p->model->scale), d.pos[i]);
             loopv(ragdoll->reljoints)
             {
                 const ragdollskel::reljoint &r = ragdoll->reljoints[i];
@@ -926,7 +921,7 @@ struct skelmodel : animmodel
                 const ragdollskel::joint &j = ragdoll->joints[i];
                 const boneinfo &b = bones[j.bone];
                 vec pos(0, 0, 0);
-                loopk(3) if(j.vert[k]>=0) pos.add(d.verts[j.vert[k]].pos);
+                loopk(3) if(j.vert[k]>=0) pos.add(d.pos[j.vert[k]]);
                 pos.mul(j.weight/p->model->scale).sub(trans);
                 matrix4x3 m;
                 m.mul(d.tris[j.tri], pos, d.animjoints ? d.animjoints[i] : j.orient);
@@ -16,8 +16,9 @@ struct soundsample
 {
     char *name;
     Mix_Chunk *chunk;
+    bool loading;
 
-    soundsample() : name(NULL), chunk(NULL) {}
+    soundsample() : name(NULL), chunk(NULL), loading(false) {}
     ~soundsample() { DELETEA(name); }
 
     void cleanup() { if(chunk) { Mix_FreeChunk(chunk); chunk = NULL; } }
@@ -249,11 +250,8 @@ static Mix_Chunk *loadwav(const char *name)
     return c;
 }
 
-bool soundsample::load(const char *dir, bool msg)
+static Mix_Chunk *loadsample(const char *dir, const char *name, bool msg)
 {
-    if(chunk) return true;
-    if(!name[0]) return false;
-
     static const char * const exts[] = { "", ".wav", ".ogg" };
     string filename;
     loopi(sizeof(exts)/sizeof(exts[0]))
@@ -261,12 +259,49 @@ bool soundsample::load(const char *dir, bool msg)
         formatstring(filename, "media/sound/%s%s%s", dir, name, exts[i]);
         if(msg && !i) renderprogress(0, filename);
         path(filename);
-        chunk = loadwav(filename);
-        if(chunk) return true;
+        Mix_Chunk *chunk = loadwav(filename);
+        if(chunk) return chunk;
     }
 
     conoutf(CON_ERROR, "failed to load sample: media/sound/%s%s", dir, name);
-    return false;
+    return NULL;
+}
+
+bool soundsample::load(const char *dir, bool msg)
+{
+    if(chunk) return true;
+    if(!name[0]) return false;
+    chunk = loadsample(dir, name, msg);
+    return chunk != NULL;
+}
+
+// samples are decoded on job workers and only handed to the mixer back on the main thread
+struct soundjob
+{
+    hashnameset<soundsample> *samples;
+    string dir, name;
+    Mix_Chunk *chunk;
+};
+
+static jobgroup soundjobs;
+
+static void loadsoundjob(void *data)
+{
+    soundjob *j = (soundjob *)data;
+    j->chunk = loadsample(j->dir, j->name, false);
+}
+
+static void finishsoundjob(void *data)
+{
+    soundjob *j = (soundjob *)data;
+    soundsample *s = j->samples->access(j->name);
+    if(s)
+    {
+        s->loading = false;
+        if(!s->chunk) { s->chunk = j->chunk; j->chunk = NULL; }
+    }
+    if(j->chunk) Mix_FreeChunk(j->chunk);
+    delete j;
 }
 
 static struct soundtype
@@ -370,7 +405,18 @@ static struct soundtype
     {
         if(nosound || !configs.inrange(n)) return;
         soundconfig &config = configs[n];
-        loopk(config.numslots) slots[config.slots+k].sample->load(dir, true);
+        loopk(config.numslots)
+        {
+            soundsample *s = slots[config.slots+k].sample;
+            if(s->chunk || s->loading || !s->name[0]) continue;
+            s->loading = true;
+            soundjob *j = new soundjob;
+            j->samples = &samples;
+            copystring(j->dir, dir);
+            copystring(j->name, s->name);
+            j->chunk = NULL;
+            addjob(loadsoundjob, finishsoundjob, j, &soundjobs);
+        }
     }
 
     bool playing(const soundchannel &chan, const soundconfig &config) const
@@ -413,6 +459,7 @@ void clear_sound()
 {
     closemumble();
     if(nosound) return;
+    waitjobs(&soundjobs);
     stopmusic();
 
     gamesounds.cleanup();
@@ -615,6 +662,7 @@ int playsound(int n, const vec *loc, extentity *ent, int flags, int loops, int f
     if(fade < 0) return -1;
 
     soundslot &slot = sounds.slots[config.chooseslot()];
+    if(slot.sample->loading) waitjobs(&soundjobs);
     if(!slot.sample->chunk && !slot.sample->load(sounds.dir)) return -1;
 
     if(dbgsound) conoutf("sound: %s%s", sounds.dir, slot.sample->name);
@@ -675,6 +723,7 @@ void resetsound()
     clearchanges(CHANGE_SOUND);
     if(!nosound)
     {
+        waitjobs(&soundjobs);
         gamesounds.cleanupsamples();
         mapsounds.cleanupsamples();
         if(music)
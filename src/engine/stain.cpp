@@ -212,7 +212,7 @@ struct stainrenderer
 
     void preload()
     {
-        tex = textureload(texname, 3);
+        tex = preloadtexture(texname, 3);
     }
 
     int totalstains()
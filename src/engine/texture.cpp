@@ -1512,6 +1512,222 @@ static bool texturedata(ImageData &d, const char *tname, bool msg = true, int *c
     return true;
 }
 
+// on-disk cache of decoded and processed images, keyed by the texture description and a crc of its source files
+VARP(texcache, 0, 1, 2);
+
+struct texcacheentry
+{
+    string desc;
+    uint crc, size;
+    bool valid, gpu;
+
+    texcacheentry() : crc(0), size(0), valid(false), gpu(false) { desc[0] = '\0'; }
+};
+
+static bool texcachesource(const char *tname, const char *tdir, uint &crc, uint &size)
+{
+    const char *cmds = NULL, *file = tname;
+    if(tname[0]=='<')
+    {
+        cmds = tname;
+        file = strrchr(tname, '>');
+        if(!file) return false;
+        file++;
+    }
+    string pname;
+    if(tdir)
+    {
+        formatstring(pname, "%s/%s", tdir, file);
+        file = path(pname);
+    }
+    int flen = strlen(file);
+    if(flen >= 4 && !strcasecmp(file + flen - 4, ".dds")) return false;
+    for(const char *pcmds = cmds; pcmds;)
+    {
+        PARSETEXCOMMANDS(pcmds);
+        if(matchstring(cmd, len, "dds") || matchstring(cmd, len, "stub")) return false;
+        else if(matchstring(cmd, len, "blend"))
+        {
+            string srcname, maskname;
+            COPYTEXARG(srcname, arg[0]);
+            COPYTEXARG(maskname, arg[1]);
+            if((srcname[0] && !texcachesource(srcname, tdir, crc, size)) || (maskname[0] && !texcachesource(maskname, tdir, crc, size))) return false;
+        }
+    }
+    stream *f = openfile(file, "rb");
+    if(!f) return false;
+    uchar buf[4096];
+    for(;;)
+    {
+        size_t len = f->read(buf, sizeof(buf));
+        if(!len) break;
+        crc = crc32(crc, buf, len);
+        size += len;
+    }
+    delete f;
+    return true;
+}
+
+static bool opentexcache(texcacheentry &e, const char *key, const char *tdir, const char *tname, int ttype, const char *cname = NULL, int ctype = -1)
+{
+    e.valid = false;
+    if(!texcache) return false;
+    formatstring(e.desc, "%s|%s|%d|%d", key, tdir ? tdir : "", ttype, ctype);
+    if(strlen(e.desc) >= sizeof(e.desc)-1) return false;
+    e.crc = crc32(0, NULL, 0);
+    e.size = 0;
+    if(!texcachesource(tname, tdir, e.crc, e.size) || (cname && !texcachesource(cname, tdir, e.crc, e.size))) return false;
+    e.valid = true;
+    return true;
+}
+
+static const char *texcachename(const texcacheentry &e, bool gpu)
+{
+    static thread_local string name;
+    uint dcrc = crc32(0, (const Bytef *)e.desc, strlen(e.desc));
+    if(gpu) formatstring(name, "cache/texture/%08x%08x%08x-c%d-%d.tex", dcrc, e.crc, e.size, usetexcompress, texcompress);
+    else formatstring(name, "cache/texture/%08x%08x%08x.tex", dcrc, e.crc, e.size);
+    return name;
+}
+
+#define TEXCACHEVERSION 1
+#define TEXCACHEMAXSIZE (1<<12)
+
+static bool readtexcache(const texcacheentry &e, bool gpu, ImageData &d, int &compress, int &wrap)
+{
+    stream *f = opengzfile(texcachename(e, gpu), "rb");
+    if(!f) return false;
+    char magic[4], desc[MAXSTRLEN];
+    bool valid = false;
+    if(f->read(magic, 4) == 4 && !memcmp(magic, "TCCH", 4) && f->getlil<int>() == TEXCACHEVERSION)
+    {
+        int desclen = f->getlil<int>();
+        if(desclen > 0 && desclen < MAXSTRLEN && f->read(desc, desclen) == size_t(desclen))
+        {
+            desc[desclen] = '\0';
+            uint crc = f->getlil<uint>(), size = f->getlil<uint>();
+            int w = f->getlil<int>(), h = f->getlil<int>(), bpp = f->getlil<int>(), levels = f->getlil<int>(), align = f->getlil<int>();
+            GLenum format = f->getlil<uint>();
+            int ccompress = f->getlil<int>(), cwrap = f->getlil<int>();
+            if(!strcmp(desc, e.desc) && crc == e.crc && size == e.size && w > 0 && h > 0 && w <= TEXCACHEMAXSIZE && h <= TEXCACHEMAXSIZE && bpp > 0 && bpp <= 16 && levels > 0 && (!align) == (!format))
+            {
+                ImageData c(w, h, bpp, levels, align, format);
+                size_t datasize = c.calcsize();
+                if(f->read(c.data, datasize) == datasize)
+                {
+                    d.replace(c);
+                    compress = ccompress;
+                    wrap |= cwrap;
+                    valid = true;
+                }
+            }
+        }
+    }
+    delete f;
+    return valid;
+}
+
+static bool loadtexcache(texcacheentry &e, ImageData &d, int &compress, int &wrap)
+{
+    if(!e.valid) return false;
+    e.gpu = texcache >= 2 && usetexcompress > 1 && readtexcache(e, true, d, compress, wrap);
+    return e.gpu || readtexcache(e, false, d, compress, wrap);
+}
+
+static void writetexcache(const texcacheentry &e, bool gpu, ImageData &d, int compress, int wrap)
+{
+    // textures too large to be read back are not worth writing
+    if(d.w > TEXCACHEMAXSIZE || d.h > TEXCACHEMAXSIZE) return;
+    // write under a temporary name and rename it into place, like the BIH cache, so a texture
+    // loaded while its cache file is being written never sees a partial file
+    string tmpname, cachename;
+    copystring(cachename, texcachename(e, gpu));
+    formatstring(tmpname, "%s.%lu.tmp", cachename, (unsigned long)SDL_ThreadID());
+    stream *f = opengzfile(tmpname, "wb", NULL, Z_BEST_SPEED);
+    if(!f) return;
+    int desclen = strlen(e.desc);
+    bool ok = f->write("TCCH", 4) == 4;
+    ok &= f->putlil<int>(TEXCACHEVERSION);
+    ok &= f->putlil<int>(desclen);
+    ok &= f->write(e.desc, desclen) == size_t(desclen);
+    ok &= f->putlil<uint>(e.crc);
+    ok &= f->putlil<uint>(e.size);
+    ok &= f->putlil<int>(d.w);
+    ok &= f->putlil<int>(d.h);
+    ok &= f->putlil<int>(d.bpp);
+    ok &= f->putlil<int>(d.levels);
+    ok &= f->putlil<int>(d.align);
+    ok &= f->putlil<uint>(d.compressed);
+    ok &= f->putlil<int>(compress);
+    ok &= f->putlil<int>(wrap&(0x300|0x10000));
+    if(d.pitch == d.w*d.bpp || d.compressed) ok &= f->write(d.data, d.calcsize()) == size_t(d.calcsize());
+    else loopi(d.h) ok &= f->write(&d.data[i*d.pitch], d.w*d.bpp) == size_t(d.w*d.bpp);
+    delete f;
+    string tmpfile;
+    copystring(tmpfile, findfile(tmpname, "wb"));
+    if(ok)
+    {
+        const char *cachefile = findfile(cachename, "wb");
+        remove(cachefile);
+        if(!rename(tmpfile, cachefile)) return;
+    }
+    remove(tmpfile);
+}
+
+static void savetexcache(const texcacheentry &e, ImageData &d, int compress, int wrap)
+{
+    if(e.valid && !d.compressed) writetexcache(e, false, d, compress, wrap);
+}
+
+static bool cachedtexturedata(texcacheentry &e, ImageData &d, const char *tname, bool msg, int &compress, int &wrap)
+{
+    if(opentexcache(e, tname, NULL, tname, TEX_DIFFUSE) && loadtexcache(e, d, compress, wrap)) return true;
+    if(!texturedata(d, tname, msg, &compress, &wrap)) return false;
+    savetexcache(e, d, compress, wrap);
+    return true;
+}
+
+// reads back the mip chain the driver compressed on upload, so later loads can skip compression as well
+static void cachecompressedtexture(Texture *t, const texcacheentry &e, int compress, int wrap)
+{
+    if(texcache < 2 || usetexcompress <= 1 || !e.valid || e.gpu || !t->mipmap || t->type&(Texture::COMPRESSED|Texture::STUB) || t->w != t->xs || t->h != t->ys) return;
+    glBindTexture(GL_TEXTURE_2D, t->id);
+    GLint compressed = 0, format = 0;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+    if(!compressed) return;
+    int bpp = 0;
+    switch(format)
+    {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_LUMINANCE_LATC1_EXT:
+        case GL_COMPRESSED_RED_RGTC1: bpp = 8; break;
+        case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_LUMINANCE_ALPHA_LATC2_EXT:
+        case GL_COMPRESSED_RG_RGTC2: bpp = 16; break;
+        default: return;
+    }
+    int levels = 1;
+    for(int lw = t->w, lh = t->h; max(lw, lh) > 1; levels++)
+    {
+        if(lw > 1) lw /= 2;
+        if(lh > 1) lh /= 2;
+    }
+    ImageData d(t->w, t->h, bpp, levels, 4, format);
+    uchar *dst = d.data;
+    loopi(levels)
+    {
+        GLint size = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, i, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+        if(size != d.calclevelsize(i)) return;
+        glGetCompressedTexImage_(GL_TEXTURE_2D, i, dst);
+        dst += size;
+    }
+    writetexcache(e, true, d, compress, wrap);
+}
+
 static inline bool texturedata(ImageData &d, Slot &slot, Slot::Tex &tex, bool msg = true, int *compress = NULL, int *wrap = NULL)
 {
     return texturedata(d, tex.name, msg, compress, wrap, slot.texturedir(), tex.type);
@@ -1548,8 +1764,78 @@ Texture *textureload(const char *name, int clamp, bool mipit, bool msg)
     if(t) return t;
     int compress = 0;
     ImageData s;
-    if(texturedata(s, tname, msg, &compress, &clamp)) return newtexture(NULL, tname, s, clamp, mipit, false, false, compress);
-    return notexture;
+    texcacheentry cache;
+    if(!cachedtexturedata(cache, s, tname, msg, compress, clamp)) return notexture;
+    t = newtexture(NULL, tname, s, clamp, mipit, false, false, compress);
+    cachecompressedtexture(t, cache, compress, clamp);
+    return t;
+}
+
+// SDL_image sets up its loaders on first use, which must not race between job workers
+static void initimageloaders()
+{
+    static bool inited = false;
+    if(inited) return;
+    IMG_Init(IMG_INIT_JPG|IMG_INIT_PNG);
+    inited = true;
+}
+
+struct texturejob
+{
+    string name;
+    int clamp, compress;
+    bool loaded;
+    ImageData s;
+    texcacheentry cache;
+};
+
+static void loadtexturejob(void *data)
+{
+    texturejob *j = (texturejob *)data;
+    j->loaded = cachedtexturedata(j->cache, j->s, j->name, true, j->compress, j->clamp);
+}
+
+static void finishtexturejob(void *data)
+{
+    texturejob *j = (texturejob *)data;
+    Texture *t = textures.access(j->name);
+    // a GL reset may have cleared the placeholder's notexture id, the decoded image still replaces it
+    if(t && t->type&Texture::PLACEHOLDER && (!t->id || t->id == notexture->id) && j->loaded)
+    {
+        t->id = 0;
+        newtexture(t, NULL, j->s, j->clamp, t->mipmap, false, false, j->compress);
+        cachecompressedtexture(t, j->cache, j->compress, j->clamp);
+    }
+    delete j;
+}
+
+// decodes the image on a job worker and returns a texture that shows notexture until it is ready
+Texture *preloadtexture(const char *name, int clamp, bool mipit)
+{
+    string tname;
+    copystring(tname, name);
+    Texture *t = textures.access(path(tname));
+    if(t) return t;
+    char *key = newstring(tname);
+    t = &textures[key];
+    t->name = key;
+    t->type = Texture::IMAGE | Texture::PLACEHOLDER;
+    t->clamp = clamp;
+    t->mipmap = mipit;
+    t->canreduce = false;
+    t->w = t->xs = notexture->w;
+    t->h = t->ys = notexture->h;
+    t->bpp = notexture->bpp;
+    t->id = notexture->id;
+
+    initimageloaders();
+    texturejob *j = new texturejob;
+    copystring(j->name, tname);
+    j->clamp = clamp;
+    j->compress = 0;
+    j->loaded = false;
+    addjob(loadtexturejob, finishtexturejob, j);
+    return t;
 }
 
 bool settexture(const char *name, int clamp)
@@ -1677,6 +1963,7 @@ void compactvslots(cube *c, int n)
 
 int compactvslots(bool cull)
 {
+    clearremipchanges();
     defslot = NULL;
     clonedvslots = 0;
     markingvslots = cull;
@@ -2401,28 +2688,29 @@ static void addname(vector<char> &key, Slot &slot, Slot::Tex &t, bool combined =
     for(const char *s = path(tname); *s; key.add(*s++));
 }
 
-void Slot::load(int index, Slot::Tex &t)
+static Slot::Tex *slottexkey(vector<char> &key, Slot &slot, int index)
 {
-    vector<char> key;
-    addname(key, *this, t);
+    addname(key, slot, slot.sts[index]);
     Slot::Tex *combine = NULL;
-    loopv(sts)
+    loopv(slot.sts)
     {
-        Slot::Tex &c = sts[i];
+        Slot::Tex &c = slot.sts[i];
         if(c.combined == index)
         {
             combine = &c;
-            addname(key, *this, c, true);
+            addname(key, slot, c, true);
             break;
         }
     }
     key.add('\0');
-    t.t = textures.access(key.getbuf());
-    if(t.t) return;
-    int compress = 0, wrap = 0;
-    ImageData ts;
-    if(!texturedata(ts, *this, t, true, &compress, &wrap)) { t.t = notexture; return; }
-    if(!ts.compressed) switch(t.type)
+    return combine;
+}
+
+static bool slottexturedata(texcacheentry &cache, const char *key, ImageData &ts, const char *tdir, const char *tname, int ttype, const char *cname, int ctype, bool msg, int &compress, int &wrap)
+{
+    if(opentexcache(cache, key, tdir, tname, ttype, cname, ctype) && loadtexcache(cache, ts, compress, wrap)) return true;
+    if(!texturedata(ts, tname, msg, &compress, &wrap, tdir, ttype)) return false;
+    if(!ts.compressed) switch(ttype)
     {
         case TEX_SPEC:
             if(ts.bpp > 1) collapsespec(ts);
@@ -2430,13 +2718,13 @@ void Slot::load(int index, Slot::Tex &t)
         case TEX_GLOW:
         case TEX_DIFFUSE:
         case TEX_NORMAL:
-            if(combine)
+            if(cname)
             {
                 ImageData cs;
-                if(texturedata(cs, *this, *combine))
+                if(texturedata(cs, cname, msg, NULL, NULL, tdir, ctype))
                 {
                     if(cs.w!=ts.w || cs.h!=ts.h) scaleimage(cs, ts.w, ts.h);
-                    switch(combine->type)
+                    switch(ctype)
                     {
                         case TEX_SPEC: mergespec(ts, cs); break;
                         case TEX_DEPTH: mergedepth(ts, cs); break;
@@ -2446,23 +2734,117 @@ void Slot::load(int index, Slot::Tex &t)
             if(ts.bpp < 3) swizzleimage(ts);
             break;
     }
+    savetexcache(cache, ts, compress, wrap);
+    return true;
+}
+
+struct slottexjob
+{
+    char *key;
+    string tdir, tname, cname;
+    int ttype, ctype, compress, wrap;
+    bool combined, loaded;
+    ImageData ts;
+    texcacheentry cache;
+};
+
+static jobgroup slottexjobs;
+static hashtable<const char *, slottexjob *> pendingslottexs;
+
+static void loadslottexjob(void *data)
+{
+    slottexjob *j = (slottexjob *)data;
+    j->loaded = slottexturedata(j->cache, j->key, j->ts, j->tdir, j->tname, j->ttype, j->combined ? j->cname : NULL, j->ctype, false, j->compress, j->wrap);
+}
+
+static void finishslottexjob(void *data)
+{
+    slottexjob *j = (slottexjob *)data;
+    pendingslottexs.remove(j->key);
+    if(j->loaded && !textures.access(j->key))
+    {
+        Texture *t = newtexture(NULL, j->key, j->ts, j->wrap, true, true, true, j->compress);
+        cachecompressedtexture(t, j->cache, j->compress, j->wrap);
+    }
+    delete[] j->key;
+    delete j;
+}
+
+void waitslotpreloads()
+{
+    waitjobs(&slottexjobs, "loading textures...");
+}
+
+void Slot::load(int index, Slot::Tex &t)
+{
+    vector<char> key;
+    Slot::Tex *combine = slottexkey(key, *this, index);
+    if(pendingslottexs.access(key.getbuf())) waitjobs(&slottexjobs);
+    t.t = textures.access(key.getbuf());
+    if(t.t) return;
+    int compress = 0, wrap = 0;
+    ImageData ts;
+    texcacheentry cache;
+    if(!slottexturedata(cache, key.getbuf(), ts, texturedir(), t.name, t.type, combine ? combine->name : NULL, combine ? combine->type : -1, true, compress, wrap)) { t.t = notexture; return; }
     t.t = newtexture(NULL, key.getbuf(), ts, wrap, true, true, true, compress);
+    cachecompressedtexture(t.t, cache, compress, wrap);
 }
 
-void Slot::load()
+static void combineslottexs(Slot &s)
 {
-    linkslotshader(*this);
-    loopv(sts)
+    loopv(s.sts)
     {
-        Slot::Tex &t = sts[i];
+        Slot::Tex &t = s.sts[i];
         if(t.combined >= 0) continue;
-        int combine = cancombine(t.type);
-        if(combine >= 0 && (combine = findtextype(1<<combine)) >= 0)
+        int combine = s.cancombine(t.type);
+        if(combine >= 0 && (combine = s.findtextype(1<<combine)) >= 0)
         {
-            Slot::Tex &c = sts[combine];
+            Slot::Tex &c = s.sts[combine];
             c.combined = i;
         }
     }
+}
+
+// queues the image decoding of the slot's textures on job workers, so a later load() only has to upload them
+void Slot::preload()
+{
+    if(loaded) return;
+    combineslottexs(*this);
+    loopv(sts)
+    {
+        Slot::Tex &t = sts[i];
+        if(t.combined >= 0 || t.type == TEX_ENVMAP) continue;
+        vector<char> key;
+        Slot::Tex *combine = slottexkey(key, *this, i);
+        if(textures.access(key.getbuf()) || pendingslottexs.access(key.getbuf())) continue;
+        initimageloaders();
+        slottexjob *j = new slottexjob;
+        j->key = newstring(key.getbuf());
+        copystring(j->tdir, texturedir());
+        copystring(j->tname, t.name);
+        j->ttype = t.type;
+        j->combined = combine != NULL;
+        if(combine)
+        {
+            copystring(j->cname, combine->name);
+            j->ctype = combine->type;
+        }
+        else
+        {
+            j->cname[0] = '\0';
+            j->ctype = -1;
+        }
+        j->compress = j->wrap = 0;
+        j->loaded = false;
+        pendingslottexs[j->key] = j;
+        addjob(loadslottexjob, finishslottexjob, j, &slottexjobs);
+    }
+}
+
+void Slot::load()
+{
+    linkslotshader(*this);
+    combineslottexs(*this);
     loopv(sts)
     {
         Slot::Tex &t = sts[i];
@@ -3003,7 +3385,11 @@ GLuint lookupenvmap(ushort emid)
 void cleanuptexture(Texture *t)
 {
     DELETEA(t->alphamask);
-    if(t->id) { glDeleteTextures(1, &t->id); t->id = 0; }
+    if(t->id)
+    {
+        if(!(t->type&Texture::PLACEHOLDER)) glDeleteTextures(1, &t->id);
+        t->id = 0;
+    }
     if(t->type&Texture::TRANSIENT) textures.remove(t->name);
 }
 
@@ -572,6 +572,7 @@ struct Texture
         COMPRESSED = 1<<10,
         ALPHA      = 1<<11,
         MIRROR     = 1<<12,
+        PLACEHOLDER = 1<<13,
         FLAGS      = 0xFF00
     };
 
@@ -603,22 +604,6 @@ enum
     TEX_DETAIL = TEX_SPEC
 };
 
-enum
-{
-    VSLOT_SHPARAM = 0,
-    VSLOT_SCALE,
-    VSLOT_ROTATION,
-    VSLOT_OFFSET,
-    VSLOT_SCROLL,
-    VSLOT_LAYER,
-    VSLOT_ALPHA,
-    VSLOT_COLOR,
-    VSLOT_RESERVED, // used by RE
-    VSLOT_REFRACT,
-    VSLOT_DETAIL,
-    VSLOT_NUM
-};
-
 struct VSlot
 {
     Slot *slot;
@@ -709,6 +694,7 @@ struct Slot
 
     void load(int index, Slot::Tex &t);
     void load();
+    void preload();
 
     Texture *loadthumbnail();
 
@@ -847,6 +833,7 @@ extern bool loadimage(const char *filename, ImageData &image);
 extern MatSlot &lookupmaterialslot(int slot, bool load = true);
 extern Slot &lookupslot(int slot, bool load = true);
 extern VSlot &lookupvslot(int slot, bool load = true);
+extern void waitslotpreloads();
 extern DecalSlot &lookupdecalslot(int slot, bool load = true);
 extern VSlot *findvslot(Slot &slot, const VSlot &src, const VSlot &delta);
 extern VSlot *editvslot(const VSlot &src, const VSlot &delta);
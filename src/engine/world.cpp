@@ -227,6 +227,7 @@ static bool modifyoctaent(int flags, int id, extentity &e)
     e.flags ^= EF_OCTA;
     switch(e.type)
     {
+        case ET_MAPMODEL: resetcollidemodels(); break;
         case ET_LIGHT: clearlightcache(id); if(e.attr5&L_VOLUMETRIC) { if(flags&MODOE_ADD) volumetriclights++; else --volumetriclights; } break;
         case ET_SPOTLIGHT: if(!(flags&MODOE_ADD ? spotlights++ : --spotlights)) { cleardeferredlightshaders(); cleanupvolumetric(); } break;
         case ET_PARTICLES: clearparticleemitters(); break;
@@ -1374,6 +1375,7 @@ void resetmap()
     resetblendmap();
     clearlights();
     clearpvs();
+    clearremipchanges();
     clearslots();
     clearparticles();
     clearstains();
@@ -1408,6 +1410,7 @@ bool emptymap(int scale, bool force, const char *mname, bool usecfg)    // main
     setvar("emptymap", 1, true, false);
 
     texmru.shrink(0);
+    clearmaterialgrid();
     freeocta(worldroot);
     worldroot = newcubes(F_EMPTY);
     loopi(4) solidfaces(worldroot[i]);
@@ -1451,6 +1454,7 @@ bool enlargemap(bool force)
 
     if(worldsize > 0x1000) splitocta(worldroot, worldsize>>1);
 
+    clearremipchanges();
     enlargeblendmap();
 
     allchanged();
@@ -1493,6 +1497,7 @@ void shrinkmap()
     vector<extentity *> &ents = entities::getents();
     loopv(ents) ents[i]->o.sub(vec(offset));
 
+    clearremipchanges();
     shrinkblendmap(octant);
 
     allchanged();
@@ -22,7 +22,7 @@ struct octaheader
     int numvslots;
 };
 
-#define MAPVERSION 1            // bump if map format changes, see worldio.cpp
+#define MAPVERSION 2            // bump if map format changes, see worldio.cpp
 
 struct mapheader
 {
@@ -37,6 +37,34 @@ struct mapheader
     int numvslots;
 };
 
+enum { OCTSAV_CHILDREN = 0, OCTSAV_EMPTY, OCTSAV_SOLID, OCTSAV_NORMAL };
+
+#define LM_PACKW 512
+#define LM_PACKH 512
+#define LAYER_DUP (1<<7)
+
+struct polysurfacecompat
+{
+    uchar lmid[2];
+    uchar verts, numverts;
+};
+
+enum
+{
+    VSLOT_SHPARAM = 0,
+    VSLOT_SCALE,
+    VSLOT_ROTATION,
+    VSLOT_OFFSET,
+    VSLOT_SCROLL,
+    VSLOT_LAYER,
+    VSLOT_ALPHA,
+    VSLOT_COLOR,
+    VSLOT_RESERVED, // used by RE
+    VSLOT_REFRACT,
+    VSLOT_DETAIL,
+    VSLOT_NUM
+};
+
 #define WATER_AMPLITUDE 0.4f
 #define WATER_OFFSET 1.1f
 
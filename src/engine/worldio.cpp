@@ -2,47 +2,6 @@
 
 #include "engine.h"
 
-static void fixent(entity &e, int version)
-{
-    if(version <= 0)
-    {
-        if(e.type >= ET_DECAL) e.type++;
-    }
-}
-
-static bool loadmapheader(stream *f, const char *ogzname, mapheader &hdr, octaheader &ohdr)
-{
-    if(f->read(&hdr, 3*sizeof(int)) != 3*sizeof(int)) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
-    lilswap(&hdr.version, 2);
-
-    if(!memcmp(hdr.magic, "TMAP", 4))
-    {
-        if(hdr.version>MAPVERSION) { conoutf(CON_ERROR, "map %s requires a newer version of Tesseract", ogzname); return false; }
-        if(f->read(&hdr.worldsize, 6*sizeof(int)) != 6*sizeof(int)) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
-        lilswap(&hdr.worldsize, 6);
-        if(hdr.worldsize <= 0|| hdr.numents < 0) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
-    }
-    else if(!memcmp(hdr.magic, "OCTA", 4))
-    {
-        if(hdr.version!=OCTAVERSION) { conoutf(CON_ERROR, "map %s uses an unsupported map format version", ogzname); return false; }
-        if(f->read(&ohdr.worldsize, 7*sizeof(int)) != 7*sizeof(int)) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
-        lilswap(&ohdr.worldsize, 7);
-        if(ohdr.worldsize <= 0|| ohdr.numents < 0) { conoutf(CON_ERROR, "map %s has malformatted header", ogzname); return false; }
-        memcpy(hdr.magic, "TMAP", 4);
-        hdr.version = 0;
-        hdr.headersize = sizeof(hdr);
-        hdr.worldsize = ohdr.worldsize;
-        hdr.numents = ohdr.numents;
-        hdr.numpvs = ohdr.numpvs;
-        hdr.blendmap = ohdr.blendmap;
-        hdr.numvars = ohdr.numvars;
-        hdr.numvslots = ohdr.numvslots;
-    }
-    else { conoutf(CON_ERROR, "map %s uses an unsupported map type", ogzname); return false; }
-
-    return true;
-}
-
 bool loadents(const char *fname, vector<entity> &ents, uint *crc)
 {
     defformatstring(ogzname, "media/map/%s.ogz", fname);
@@ -159,260 +118,6 @@ void backup(const char *name, const char *backupname)
     rename(findfile(name, "wb"), backupfile);
 }
 
-enum { OCTSAV_CHILDREN = 0, OCTSAV_EMPTY, OCTSAV_SOLID, OCTSAV_NORMAL };
-
-#define LM_PACKW 512
-#define LM_PACKH 512
-#define LAYER_DUP (1<<7)
-
-struct polysurfacecompat
-{
-    uchar lmid[2];
-    uchar verts, numverts;
-};
-
-static int savemapprogress = 0;
-
-void savec(cube *c, const ivec &o, int size, stream *f, bool nolms)
-{
-    if((savemapprogress++&0xFFF)==0) renderprogress(float(savemapprogress)/allocnodes, "saving octree...");
-
-    loopi(8)
-    {
-        ivec co(i, o, size);
-        if(c[i].children)
-        {
-            f->putchar(OCTSAV_CHILDREN);
-            savec(c[i].children, co, size>>1, f, nolms);
-        }
-        else
-        {
-            int oflags = 0, surfmask = 0, totalverts = 0;
-            if(c[i].material!=MAT_AIR) oflags |= 0x40;
-            if(isempty(c[i])) f->putchar(oflags | OCTSAV_EMPTY);
-            else
-            {
-                if(!nolms)
-                {
-                    if(c[i].merged) oflags |= 0x80;
-                    if(c[i].ext) loopj(6)
-                    {
-                        const surfaceinfo &surf = c[i].ext->surfaces[j];
-                        if(!surf.used()) continue;
-                        oflags |= 0x20;
-                        surfmask |= 1<<j;
-                        totalverts += surf.totalverts();
-                    }
-                }
-
-                if(isentirelysolid(c[i])) f->putchar(oflags | OCTSAV_SOLID);
-                else
-                {
-                    f->putchar(oflags | OCTSAV_NORMAL);
-                    f->write(c[i].edges, 12);
-                }
-            }
-
-            loopj(6) f->putlil<ushort>(c[i].texture[j]);
-
-            if(oflags&0x40) f->putlil<ushort>(c[i].material);
-            if(oflags&0x80) f->putchar(c[i].merged);
-            if(oflags&0x20)
-            {
-                f->putchar(surfmask);
-                f->putchar(totalverts);
-                loopj(6) if(surfmask&(1<<j))
-                {
-                    surfaceinfo surf = c[i].ext->surfaces[j];
-                    vertinfo *verts = c[i].ext->verts() + surf.verts;
-                    int layerverts = surf.numverts&MAXFACEVERTS, numverts = surf.totalverts(),
-                        vertmask = 0, vertorder = 0,
-                        dim = dimension(j), vc = C[dim], vr = R[dim];
-                    if(numverts)
-                    {
-                        if(c[i].merged&(1<<j))
-                        {
-                            vertmask |= 0x04;
-                            if(layerverts == 4)
-                            {
-                                ivec v[4] = { verts[0].getxyz(), verts[1].getxyz(), verts[2].getxyz(), verts[3].getxyz() };
-                                loopk(4)
-                                {
-                                    const ivec &v0 = v[k], &v1 = v[(k+1)&3], &v2 = v[(k+2)&3], &v3 = v[(k+3)&3];
-                                    if(v1[vc] == v0[vc] && v1[vr] == v2[vr] && v3[vc] == v2[vc] && v3[vr] == v0[vr])
-                                    {
-                                        vertmask |= 0x01;
-                                        vertorder = k;
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                        else
-                        {
-                            int vis = visibletris(c[i], j, co, size);
-                            if(vis&4 || faceconvexity(c[i], j) < 0) vertmask |= 0x01;
-                            if(layerverts < 4 && vis&2) vertmask |= 0x02;
-                        }
-                        bool matchnorm = true;
-                        loopk(numverts)
-                        {
-                            const vertinfo &v = verts[k];
-                            if(v.norm) { vertmask |= 0x80; if(v.norm != verts[0].norm) matchnorm = false; }
-                        }
-                        if(matchnorm) vertmask |= 0x08;
-                    }
-                    surf.verts = vertmask;
-                    f->write(&surf, sizeof(surf));
-                    bool hasxyz = (vertmask&0x04)!=0, hasnorm = (vertmask&0x80)!=0;
-                    if(layerverts == 4)
-                    {
-                        if(hasxyz && vertmask&0x01)
-                        {
-                            ivec v0 = verts[vertorder].getxyz(), v2 = verts[(vertorder+2)&3].getxyz();
-                            f->putlil<ushort>(v0[vc]); f->putlil<ushort>(v0[vr]);
-                            f->putlil<ushort>(v2[vc]); f->putlil<ushort>(v2[vr]);
-                            hasxyz = false;
-                        }
-                    }
-                    if(hasnorm && vertmask&0x08) { f->putlil<ushort>(verts[0].norm); hasnorm = false; }
-                    if(hasxyz || hasnorm) loopk(layerverts)
-                    {
-                        const vertinfo &v = verts[(k+vertorder)%layerverts];
-                        if(hasxyz)
-                        {
-                            ivec xyz = v.getxyz();
-                            f->putlil<ushort>(xyz[vc]); f->putlil<ushort>(xyz[vr]);
-                        }
-                        if(hasnorm) f->putlil<ushort>(v.norm);
-                    }
-                }
-            }
-        }
-    }
-}
-
-cube *loadchildren(stream *f, const ivec &co, int size, bool &failed);
-
-void loadc(stream *f, cube &c, const ivec &co, int size, bool &failed)
-{
-    int octsav = f->getchar();
-    switch(octsav&0x7)
-    {
-        case OCTSAV_CHILDREN:
-            c.children = loadchildren(f, co, size>>1, failed);
-            return;
-
-        case OCTSAV_EMPTY:  emptyfaces(c);        break;
-        case OCTSAV_SOLID:  solidfaces(c);        break;
-        case OCTSAV_NORMAL: f->read(c.edges, 12); break;
-        default: failed = true; return;
-    }
-    loopi(6) c.texture[i] = f->getlil<ushort>();
-    if(octsav&0x40) c.material = f->getlil<ushort>();
-    if(octsav&0x80) c.merged = f->getchar();
-    if(octsav&0x20)
-    {
-        int surfmask, totalverts;
-        surfmask = f->getchar();
-        totalverts = f->getchar();
-        newcubeext(c, totalverts, false);
-        memset(c.ext->surfaces, 0, sizeof(c.ext->surfaces));
-        memset(c.ext->verts(), 0, totalverts*sizeof(vertinfo));
-        int offset = 0;
-        loopi(6) if(surfmask&(1<<i))
-        {
-            surfaceinfo &surf = c.ext->surfaces[i];
-            if(mapversion <= 0)
-            {
-                polysurfacecompat psurf;
-                f->read(&psurf, sizeof(polysurfacecompat));
-                surf.verts = psurf.verts;
-                surf.numverts = psurf.numverts;
-            }
-            else f->read(&surf, sizeof(surf));
-            int vertmask = surf.verts, numverts = surf.totalverts();
-            if(!numverts) { surf.verts = 0; continue; }
-            surf.verts = offset;
-            vertinfo *verts = c.ext->verts() + offset;
-            offset += numverts;
-            ivec v[4], n, vo = ivec(co).mask(0xFFF).shl(3);
-            int layerverts = surf.numverts&MAXFACEVERTS, dim = dimension(i), vc = C[dim], vr = R[dim], bias = 0;
-            genfaceverts(c, i, v);
-            bool hasxyz = (vertmask&0x04)!=0, hasuv = mapversion <= 0 && (vertmask&0x40)!=0, hasnorm = (vertmask&0x80)!=0;
-            if(hasxyz)
-            {
-                ivec e1, e2, e3;
-                n.cross((e1 = v[1]).sub(v[0]), (e2 = v[2]).sub(v[0]));
-                if(n.iszero()) n.cross(e2, (e3 = v[3]).sub(v[0]));
-                bias = -n.dot(ivec(v[0]).mul(size).add(vo));
-            }
-            else
-            {
-                int vis = layerverts < 4 ? (vertmask&0x02 ? 2 : 1) : 3, order = vertmask&0x01 ? 1 : 0, k = 0;
-                verts[k++].setxyz(v[order].mul(size).add(vo));
-                if(vis&1) verts[k++].setxyz(v[order+1].mul(size).add(vo));
-                verts[k++].setxyz(v[order+2].mul(size).add(vo));
-                if(vis&2) verts[k++].setxyz(v[(order+3)&3].mul(size).add(vo));
-            }
-            if(layerverts == 4)
-            {
-                if(hasxyz && vertmask&0x01)
-                {
-                    ushort c1 = f->getlil<ushort>(), r1 = f->getlil<ushort>(), c2 = f->getlil<ushort>(), r2 = f->getlil<ushort>();
-                    ivec xyz;
-                    xyz[vc] = c1; xyz[vr] = r1; xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
-                    verts[0].setxyz(xyz);
-                    xyz[vc] = c1; xyz[vr] = r2; xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
-                    verts[1].setxyz(xyz);
-                    xyz[vc] = c2; xyz[vr] = r2; xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
-                    verts[2].setxyz(xyz);
-                    xyz[vc] = c2; xyz[vr] = r1; xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
-                    verts[3].setxyz(xyz);
-                    hasxyz = false;
-                }
-                if(hasuv && vertmask&0x02)
-                {
-                    loopk(4) f->getlil<ushort>();
-                    if(surf.numverts&LAYER_DUP) loopk(4) f->getlil<ushort>();
-                    hasuv = false;
-                }
-            }
-            if(hasnorm && vertmask&0x08)
-            {
-                ushort norm = f->getlil<ushort>();
-                loopk(layerverts) verts[k].norm = norm;
-                hasnorm = false;
-            }
-            if(hasxyz || hasuv || hasnorm) loopk(layerverts)
-            {
-                vertinfo &v = verts[k];
-                if(hasxyz)
-                {
-                    ivec xyz;
-                    xyz[vc] = f->getlil<ushort>(); xyz[vr] = f->getlil<ushort>();
-                    xyz[dim] = n[dim] ? -(bias + n[vc]*xyz[vc] + n[vr]*xyz[vr])/n[dim] : vo[dim];
-                    v.setxyz(xyz);
-                }
-                if(hasuv) { f->getlil<ushort>(); f->getlil<ushort>(); }
-                if(hasnorm) v.norm = f->getlil<ushort>();
-            }
-            if(hasuv && surf.numverts&LAYER_DUP) loopk(layerverts) { f->getlil<ushort>(); f->getlil<ushort>(); }
-        }
-    }
-}
-
-cube *loadchildren(stream *f, const ivec &co, int size, bool &failed)
-{
-    cube *c = newcubes();
-    loopi(8)
-    {
-        loadc(f, c[i], ivec(i, co, size), size, failed);
-        if(failed) break;
-    }
-    return c;
-}
-
 VAR(dbgvars, 0, 0, 1);
 
 void savevslot(stream *f, VSlot &vs, int prev)
@@ -573,7 +278,6 @@ bool save_world(const char *mname, bool nolms)
         allchanged();
     }
 
-    savemapprogress = 0;
     renderprogress(0, "saving map...");
 
     mapheader hdr;
@@ -651,7 +355,7 @@ bool save_world(const char *mname, bool nolms)
     savevslots(f, numvslots);
 
     renderprogress(0, "saving octree...");
-    savec(worldroot, ivec(0, 0, 0), worldsize>>1, f, nolms);
+    saveoctree(f, nolms);
 
     if(!nolms)
     {
@@ -669,6 +373,117 @@ static uint mapcrc = 0;
 uint getmapcrc() { return mapcrc; }
 void clearmapcrc() { mapcrc = 0; }
 
+struct loadphase
+{
+    const char *name;
+    ullong ticks;
+    stream::offset rawbytes, bytes;
+    uint allocs;
+    size_t allocbytes;
+};
+
+static vector<loadphase> loadphases;
+static string loadphasemap = "";
+static bool loadphasing = false, loadphaseopen = false;
+static stream *loadphasestream = NULL;
+static stream::offset loadphaseraw = 0, loadphasebytes = 0;
+static ullong loadphasestart = 0;
+static uint loadphaseallocs = 0;
+static size_t loadphaseallocbytes = 0;
+
+VAR(dbgloadphases, 0, 0, 1);
+SVARP(loadphaselog, "");
+
+static void endloadphase()
+{
+    if(!loadphaseopen) return;
+    loadphaseopen = false;
+    loadphase &p = loadphases.last();
+    p.ticks = SDL_GetPerformanceCounter() - loadphasestart;
+    if(loadphasestream)
+    {
+        p.rawbytes = loadphasestream->rawtell() - loadphaseraw;
+        p.bytes = loadphasestream->tell() - loadphasebytes;
+        loadphasestream = NULL;
+    }
+    countallocs(p.allocs, p.allocbytes);
+    p.allocs -= loadphaseallocs;
+    p.allocbytes -= loadphaseallocbytes;
+}
+
+void startloadphase(const char *name, stream *f)
+{
+    if(!loadphasing) return;
+    endloadphase();
+    loadphase &p = loadphases.add();
+    p.name = name;
+    p.ticks = 0;
+    p.rawbytes = p.bytes = 0;
+    p.allocs = 0;
+    p.allocbytes = 0;
+    loadphasestream = f;
+    if(f)
+    {
+        loadphaseraw = f->rawtell();
+        loadphasebytes = f->tell();
+    }
+    countallocs(loadphaseallocs, loadphaseallocbytes);
+    loadphaseopen = true;
+    loadphasestart = SDL_GetPerformanceCounter();
+}
+
+static void beginloadphases(const char *mname)
+{
+    loadphases.setsize(0);
+    copystring(loadphasemap, mname);
+    loadphasing = true;
+}
+
+static inline float loadphasemillis(ullong ticks) { return ticks*1000.0/SDL_GetPerformanceFrequency(); }
+
+static void writeloadphases(stream *f)
+{
+    ullong total = 0;
+    loopv(loadphases) total += loadphases[i].ticks;
+    f->printf("# map %s crc %u build %s %s total %.2f ms\n", loadphasemap, mapcrc, __DATE__, __TIME__, loadphasemillis(total));
+    f->printf("# phase\tms\trawbytes\tbytes\tallocs\tallocbytes\n");
+    loopv(loadphases)
+    {
+        loadphase &p = loadphases[i];
+        f->printf("%s\t%.2f\t%lld\t%lld\t%u\t%llu\n", p.name, loadphasemillis(p.ticks), llong(p.rawbytes), llong(p.bytes), p.allocs, ullong(p.allocbytes));
+    }
+    f->printf("\n");
+}
+
+static void finishloadphases()
+{
+    endloadphase();
+    loadphasing = false;
+    if(dbgloadphases) loopv(loadphases)
+    {
+        loadphase &p = loadphases[i];
+        conoutf(CON_DEBUG, "%s: %.2f ms, %lld bytes (%lld raw), %u allocs (%llu bytes)", p.name, loadphasemillis(p.ticks), llong(p.bytes), llong(p.rawbytes), p.allocs, ullong(p.allocbytes));
+    }
+    if(loadphaselog[0])
+    {
+        stream *f = openutf8file(path(loadphaselog, true), "a");
+        if(!f) { conoutf(CON_ERROR, "could not write load phases to %s", loadphaselog); return; }
+        writeloadphases(f);
+        delete f;
+    }
+}
+
+void dumploadphases(const char *name)
+{
+    if(loadphases.empty()) { conoutf(CON_ERROR, "no map load has been recorded"); return; }
+    stream *f = openutf8file(path(name, true), "w");
+    if(!f) { conoutf(CON_ERROR, "could not write load phases to %s", name); return; }
+    writeloadphases(f);
+    delete f;
+    conoutf("wrote load phases to %s", name);
+}
+COMMAND(dumploadphases, "s");
+
 bool load_world(const char *mname, const char *cname)        // still supports all map formats that have existed since the earliest cube betas!
 {
     int loadingstart = SDL_GetTicks();
@@ -681,6 +496,9 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     memset(&ohdr, 0, sizeof(ohdr));
     if(!loadmapheader(f, ogzname, hdr, ohdr)) { delete f; return false; }
 
+    beginloadphases(mname);
+    startloadphase("clearing world");
+
     resetmap();
 
     Texture *mapshot = textureload(picname, 3, true, false);
@@ -690,6 +508,7 @@ bool load_world(const char *mname, const char *cname)        // still supports a
 
     renderprogress(0, "clearing world...");
 
+    clearmaterialgrid();
     freeocta(worldroot);
     worldroot = NULL;
 
@@ -699,6 +518,7 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     setvar("mapscale", worldscale, true, false);
 
     renderprogress(0, "loading vars...");
+    startloadphase("loading vars", f);
 
     loopi(hdr.numvars)
     {
@@ -776,6 +596,7 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     loopi(nummru) texmru.add(f->getlil<ushort>());
 
     renderprogress(0, "loading entities...");
+    startloadphase("loading entities", f);
 
     vector<extentity *> &ents = entities::getents();
     int einfosize = entities::extraentinfosize();
@@ -819,34 +640,35 @@ bool load_world(const char *mname, const char *cname)        // still supports a
     }
 
     renderprogress(0, "loading slots...");
+    startloadphase("loading slots", f);
     loadvslots(f, hdr.numvslots);
 
     renderprogress(0, "loading octree...");
+    startloadphase("loading octree", f);
     bool failed = false;
-    worldroot = loadchildren(f, ivec(0, 0, 0), hdr.worldsize>>1, failed);
+    worldroot = loadoctree(f, hdr.worldsize, failed);
     if(failed) conoutf(CON_ERROR, "garbage in map");
 
     renderprogress(0, "validating...");
+    startloadphase("validating");
     validatec(worldroot, hdr.worldsize>>1);
 
     if(!failed)
     {
-        if(mapversion <= 0) loopi(ohdr.lightmaps)
+        if(mapversion <= 0) skiplightmaps(f, ohdr.lightmaps);
+
+        if(hdr.numpvs > 0)
         {
-            int type = f->getchar();
-            if(type&0x80)
-            {
-                f->getlil<ushort>();
-                f->getlil<ushort>();
-            }
-            int bpp = 3;
-            if(type&(1<<4) && (type&0x0F)!=2) bpp = 4;
-            f->seek(bpp*LM_PACKW*LM_PACKH, SEEK_CUR);
+            startloadphase("loading pvs", f);
+            loadpvs(f, hdr.numpvs);
+        }
+        if(hdr.blendmap)
+        {
+            startloadphase("loading blendmap", f);
+            loadblendmap(f, hdr.blendmap);
         }
-
-        if(hdr.numpvs > 0) loadpvs(f, hdr.numpvs);
-        if(hdr.blendmap) loadblendmap(f, hdr.blendmap);
     }
+    endloadphase();
 
     mapcrc = f->getcrc();
     delete f;
@@ -855,29 +677,38 @@ bool load_world(const char *mname, const char *cname)        // still supports a
 
     clearmainmenu();
 
+    startloadphase("executing map config");
     identflags |= IDF_OVERRIDDEN;
     execfile("config/default_map_settings.cfg", false);
     execfile(cfgname, false);
     identflags &= ~IDF_OVERRIDDEN;
 
+    startloadphase("preloading mapmodels");
     preloadusedmapmodels(true);
 
+    startloadphase("preloading models");
     game::preload();
     flushpreloadedmodels();
 
+    startloadphase("preloading sounds");
     preloadmapsounds();
 
+    startloadphase("attaching entities");
     entitiesinoctanodes();
     attachentities();
+    startloadphase("initializing lights");
     initlights();
     allchanged(true);
 
+    startloadphase("starting map");
     renderbackground("loading...", mapshot, mname, game::getmapinfo());
 
     if(maptitle[0] && strcmp(maptitle, "Untitled Map by Unknown")) conoutf(CON_ECHO, "%s", maptitle);
 
     startmap(cname ? cname : mname);
 
+    finishloadphases();
+
     return true;
 }
 
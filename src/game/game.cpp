@@ -192,8 +192,8 @@ namespace game
             gameent *d = players[i];
             if(d == player1 || d->ai) continue;
 
-            if(d->state==CS_DEAD && d->ragdoll) moveragdoll(d);
-            else if(!intermission)
+            if(d->state==CS_DEAD && d->ragdoll) continue; // stepped with the other ragdolls in moveragdolls()
+            if(!intermission)
             {
                 if(lastmillis - d->lastaction >= d->gunwait) d->gunwait = 0;
             }
@@ -251,6 +251,184 @@ namespace game
         if(player1->clientnum>=0) c2sinfo();   // do this last, to reduce the effective frame lag
     }
 
+    // physbench: steps scripted players, bots, bouncers and ragdolls on the current map for a number of
+    // simulated seconds and reports the time spent in each physics function along with the collision
+    // queries it made. Game callbacks are muted while it runs and the results are reproducible: the random
+    // generator is reseeded for the run and restored afterwards.
+    struct physbenchent
+    {
+        gameent *d;
+        int nextinput;
+        vec target;
+    };
+
+    struct physbenchtimer
+    {
+        const char *name;
+        int num, steps;
+        uint64_t ticks;
+        physcounts counts;
+
+        physbenchtimer(const char *name, int num) : name(name), num(num), steps(0), ticks(0) { memset(&counts, 0, sizeof(counts)); }
+
+        void start() { startphyscounts(); ticks -= SDL_GetPerformanceCounter(); }
+        void stop()
+        {
+            ticks += SDL_GetPerformanceCounter();
+            physcounts c;
+            stopphyscounts(c);
+            counts.collides += c.collides;
+            counts.cubes += c.cubes;
+            counts.mapmodels += c.mapmodels;
+            counts.dynents += c.dynents;
+            counts.rays += c.rays;
+            counts.events += c.events;
+        }
+
+        void report()
+        {
+            if(!num) return;
+            double ms = ticks*1000.0/SDL_GetPerformanceFrequency();
+            conoutf("%-9s %4d: %8.2f ms, %6.2f us/step, %d collides, %d cubes, %d mapmodels, %d dynents, %d rays, %d callbacks",
+                name, num, ms, steps ? ms*1000/steps : 0.0, counts.collides, counts.cubes, counts.mapmodels, counts.dynents, counts.rays, counts.events);
+        }
+    };
+
+    static void spawnbenchent(physbenchent &e)
+    {
+        findplayerspawn(e.d, -1, 0);
+        e.d->vel = e.d->falling = vec(0, 0, 0);
+        e.d->move = e.d->strafe = 0;
+        e.d->jumping = false;
+        e.nextinput = 0;
+        e.target = e.d->o;
+    }
+
+    static void steerbenchent(physbenchent &e, bool bot)
+    {
+        gameent *d = e.d;
+        if(lastmillis < e.nextinput) return;
+        if(bot)
+        {
+            // bots head for entities around the map and jump whenever they stall
+            const vector<extentity *> &ents = entities::getents();
+            if(ents.length() && (d->o.dist(e.target) < 16 || !rnd(20))) e.target = ents[rnd(ents.length())]->o;
+            vec dir = vec(e.target).sub(d->o);
+            vectoyawpitch(dir, d->yaw, d->pitch);
+            d->move = 1;
+            d->strafe = 0;
+            d->jumping = d->vel.squaredlen() < 100 && d->physstate >= PHYS_SLOPE;
+            e.nextinput = lastmillis + 250;
+        }
+        else
+        {
+            d->move = rnd(3) - 1;
+            d->strafe = rnd(3) - 1;
+            d->yaw = fmod(d->yaw + rnd(91) - 45 + 360, 360);
+            d->jumping = !rnd(4);
+            d->crouching = !rnd(8) ? -1 : abs(d->crouching);
+            e.nextinput = lastmillis + 500;
+        }
+    }
+
+    static void launchbenchbouncer(physent &b)
+    {
+        dynent spawn;
+        findplayerspawn(&spawn, -1, 0);
+        b.o = vec(spawn.o).addz(8);
+        b.vel = vec(rndscale(2) - 1, rndscale(2) - 1, rndscale(1)).normalize().mul(100 + rnd(100));
+        b.physstate = PHYS_FALL;
+    }
+
+    void physbench(int *seconds, int *numplayers, int *numbots, int *numbouncers, int *numragdolls)
+    {
+        if(*seconds <= 0) return;
+        const int frametime = 16, steptime = 8;
+        int oldlastmillis = lastmillis, oldcurtime = curtime;
+        pushMT(1);
+
+        vector<physbenchent> benchplayers, bots, ragdolls;
+        vector<physent *> bouncers;
+        loopi(max(*numplayers, 0)) { physbenchent &e = benchplayers.add(); e.d = new gameent; spawnbenchent(e); updatedynentcache(e.d); }
+        loopi(max(*numbots, 0)) { physbenchent &e = bots.add(); e.d = new gameent; spawnbenchent(e); updatedynentcache(e.d); }
+        loopi(max(*numbouncers, 0))
+        {
+            physent *b = bouncers.add(new physent);
+            b->type = ENT_BOUNCE;
+            b->radius = b->xradius = b->yradius = b->eyeheight = b->aboveeye = 1.5f;
+            launchbenchbouncer(*b);
+        }
+        loopi(max(*numragdolls, 0))
+        {
+            physbenchent &e = ragdolls.add();
+            e.d = new gameent;
+            spawnbenchent(e);
+            e.d->state = CS_DEAD;
+            e.d->o.z += 16;
+            initboxragdoll(e.d);
+        }
+
+        physbenchtimer playertime("players", benchplayers.length()), bottime("bots", bots.length()),
+                       bouncetime("bouncers", bouncers.length()), ragdolltime("ragdolls", ragdolls.length());
+        for(int elapsed = 0; elapsed < *seconds*1000; elapsed += frametime)
+        {
+            curtime = frametime;
+            lastmillis += frametime;
+            loopk(2)
+            {
+                vector<physbenchent> &ents = k ? bots : benchplayers;
+                physbenchtimer &timer = k ? bottime : playertime;
+                loopv(ents) steerbenchent(ents[i], k!=0);
+                timer.start();
+                loopv(ents)
+                {
+                    gameent *d = ents[i].d;
+                    crouchplayer(d, 10, true);
+                    for(int t = 0; t < frametime; t += steptime) moveplayer(d, 10, true, steptime);
+                    updatedynentcache(d);
+                }
+                timer.stop();
+                timer.steps += ents.length()*(frametime/steptime);
+            }
+            bouncetime.start();
+            loopv(bouncers) if(bounce(bouncers[i], frametime/1000.0f, 0.6f, 0.5f, 1)) launchbenchbouncer(*bouncers[i]);
+            bouncetime.stop();
+            bouncetime.steps += bouncers.length();
+            ragdolltime.start();
+            loopv(ragdolls) moveragdoll(ragdolls[i].d);
+            ragdolltime.stop();
+            ragdolltime.steps += ragdolls.length();
+            // settled ragdolls stop simulating, so each is dropped again every few seconds to keep the load steady
+            loopv(ragdolls)
+            {
+                gameent *d = ragdolls[i].d;
+                if((elapsed + i*97) % 4000 < frametime)
+                {
+                    spawnbenchent(ragdolls[i]);
+                    d->state = CS_DEAD;
+                    d->o.z += 16;
+                    initboxragdoll(d);
+                }
+            }
+        }
+
+        conoutf("physbench: %d simulated seconds", *seconds);
+        playertime.report();
+        bottime.report();
+        bouncetime.report();
+        ragdolltime.report();
+
+        loopv(benchplayers) delete benchplayers[i].d;
+        loopv(bots) delete bots[i].d;
+        loopv(ragdolls) delete ragdolls[i].d;
+        bouncers.deletecontents();
+        cleardynentcache();
+        lastmillis = oldlastmillis;
+        curtime = oldcurtime;
+        popMT();
+    }
+    COMMAND(physbench, "iiiii");
+
     void spawnplayer(gameent *d)   // place at random spawn
     {
         if(cmode) cmode->pickspawn(d);
@@ -32,18 +32,29 @@ namespace game
         ragdolls.deletecontents();
     }
 
+    static vector<gameent *> movingragdolls;
+
+    static void stepragdoll(void *data, int i)
+    {
+        moveragdoll(movingragdolls[i]);
+    }
+
+    // steps the corpses along with the ragdolls of every dead player other than our own
     void moveragdolls()
     {
         loopv(ragdolls)
         {
             gameent *d = ragdolls[i];
-            if(lastmillis > d->lastupdate + ragdollmillis)
-            {
-                delete ragdolls.remove(i--);
-                continue;
-            }
-            moveragdoll(d);
+            if(lastmillis > d->lastupdate + ragdollmillis) delete ragdolls.remove(i--);
+        }
+        movingragdolls.setsize(0);
+        movingragdolls.put(ragdolls.getbuf(), ragdolls.length());
+        loopv(players)
+        {
+            gameent *d = players[i];
+            if(d != player1 && d->state == CS_DEAD && d->ragdoll) movingragdolls.add(d);
         }
+        parallelphysics(movingragdolls.length(), stepragdoll);
     }
 
     static const int playercolors[] =
@@ -114,21 +114,28 @@ namespace game
         playsound(S_NOAMMO);
     });
 
-    void offsetray(const vec &from, const vec &to, int spread, float range, vec &dest)
+    vec offsetdir(const vec &from, const vec &to, int spread)
     {
         vec offset;
         do offset = vec(rndscale(1), rndscale(1), rndscale(1)).sub(0.5f);
         while(offset.squaredlen() > 0.5f*0.5f);
         offset.mul((to.dist(from)/1024)*spread);
         offset.z /= 2;
-        dest = vec(offset).add(to);
-        vec dir = vec(dest).sub(from).normalize();
+        return offset.add(to).sub(from).normalize();
+    }
+
+    void offsetray(const vec &from, const vec &to, int spread, float range, vec &dest)
+    {
+        vec dir = offsetdir(from, to, spread);
         raycubepos(from, dir, dest, range, RAY_CLIPMAT|RAY_ALPHAPOLY);
     }
 
     void createrays(int atk, const vec &from, const vec &to)             // create random spread of rays
     {
-        loopi(attacks[atk].rays) offsetray(from, to, attacks[atk].spread, attacks[atk].range, rays[i]);
+        vec dirs[MAXRAYS];
+        float dists[MAXRAYS];
+        loopi(attacks[atk].rays) dirs[i] = offsetdir(from, to, attacks[atk].spread);
+        raycubes(from, dirs, attacks[atk].rays, dists, attacks[atk].range, RAY_CLIPMAT|RAY_ALPHAPOLY, rays);
     }
 
     enum { BNC_GIBS, BNC_DEBRIS };
@@ -137,14 +144,14 @@ namespace game
     {
         int lifetime, bounces;
         float lastyaw, roll;
-        bool local;
+        bool local, stopped;
         gameent *owner;
         int bouncetype, variant;
         vec offset;
         int offsetmillis;
         int id;
 
-        bouncer() : bounces(0), roll(0), variant(0)
+        bouncer() : bounces(0), roll(0), stopped(false), variant(0)
         {
             type = ENT_BOUNCE;
         }
@@ -194,30 +201,26 @@ namespace game
         addstain(STAIN_BLOOD, vec(b->o).sub(vec(surface).mul(b->radius)), surface, 2.96f/b->bounces, bvec(0x60, 0xFF, 0xFF), rnd(4));
     }
 
-    void updatebouncers(int time)
+    static void stepbouncer(void *data, int i)
     {
-        loopv(bouncers)
+        int time = *(int *)data;
+        bouncer &bnc = *bouncers[i];
+        vec old(bnc.o);
+        // cheaper variable rate physics for debris, gibs, etc.
+        for(int rtime = time; rtime > 0;)
         {
-            bouncer &bnc = *bouncers[i];
-            vec old(bnc.o);
-            bool stopped = false;
-            // cheaper variable rate physics for debris, gibs, etc.
-            for(int rtime = time; rtime > 0;)
-            {
-                int qtime = min(30, rtime);
-                rtime -= qtime;
-                if((bnc.lifetime -= qtime)<0 || bounce(&bnc, qtime/1000.0f, 0.6f, 0.5f, 1)) { stopped = true; break; }
-            }
-            if(stopped)
-            {
-                delete bouncers.remove(i--);
-            }
-            else
-            {
-                bnc.roll += old.sub(bnc.o).magnitude()/(4*RAD);
-                bnc.offsetmillis = max(bnc.offsetmillis-time, 0);
-            }
+            int qtime = min(30, rtime);
+            rtime -= qtime;
+            if((bnc.lifetime -= qtime)<0 || bounce(&bnc, qtime/1000.0f, 0.6f, 0.5f, 1)) { bnc.stopped = true; return; }
         }
+        bnc.roll += old.sub(bnc.o).magnitude()/(4*RAD);
+        bnc.offsetmillis = max(bnc.offsetmillis-time, 0);
+    }
+
+    void updatebouncers(int time)
+    {
+        parallelphysics(bouncers.length(), stepbouncer, &time);
+        loopv(bouncers) if(bouncers[i]->stopped) delete bouncers.remove(i--);
     }
 
     void removebouncers(gameent *owner)
@@ -381,11 +384,11 @@ namespace game
         }
 #endif
         if(!local) return;
-        int numdyn = numdynents();
-        loopi(numdyn)
+        const vector<physent *> &near = finddynents(v, attacks[atk].exprad);
+        loopv(near)
         {
-            dynent *o = iterdynents(i);
-            if(o->o.reject(v, o->radius + attacks[atk].exprad) || o==safe) continue;
+            dynent *o = (dynent *)near[i];
+            if(o==safe) continue;
             radialeffect(o, v, vel, damage, owner, atk);
         }
     }
@@ -457,10 +460,11 @@ namespace game
             {
                 vec halfdv = vec(dv).mul(0.5f), bo = vec(p.o).add(halfdv);
                 float br = max(fabs(halfdv.x), fabs(halfdv.y)) + 1 + attacks[p.atk].margin;
-                loopj(numdynents())
+                const vector<physent *> &near = finddynents(bo, br);
+                loopvj(near)
                 {
-                    dynent *o = iterdynents(j);
-                    if(p.owner==o || o->o.reject(bo, o->radius + br)) continue;
+                    dynent *o = (dynent *)near[j];
+                    if(p.owner==o) continue;
                     if(projdamage(o, p, v)) { exploded = true; break; }
                 }
             }
@@ -578,9 +582,10 @@ namespace game
     {
         dynent *best = NULL;
         bestdist = 1e16f;
-        loopi(numdynents())
+        const vector<physent *> &near = raydynents(from, to, margin);
+        loopv(near)
         {
-            dynent *o = iterdynents(i);
+            dynent *o = (dynent *)near[i];
             if(o==at || o->state!=CS_ALIVE) continue;
             float dist;
             if(!intersect(o, from, to, margin, dist)) continue;
@@ -49,6 +49,8 @@ extern float raycube   (const vec &o, const vec &ray,     float radius = 0, int
 extern float raycubepos(const vec &o, const vec &ray, vec &hit, float radius = 0, int mode = RAY_CLIPMAT, int size = 0);
 extern float rayfloor  (const vec &o, vec &floor, int mode = 0, float radius = 0);
 extern bool  raycubelos(const vec &o, const vec &dest, vec &hitpos);
+extern void  raycubes  (const vec &o, const vec *rays, int numrays, float *dists, float radius = 0, int mode = RAY_CLIPMAT, vec *hitpos = NULL);
+extern void  raycubes  (const vec *o, const vec *rays, int numrays, float *dists, float radius = 0, int mode = RAY_CLIPMAT, vec *hitpos = NULL);
 
 extern int thirdperson;
 extern bool isthirdperson();
@@ -376,9 +378,9 @@ extern void clearmapcrc();
 extern bool loadents(const char *fname, vector<entity> &ents, uint *crc = NULL);
 
 // physics
-extern vec collidewall;
-extern bool collideinside;
-extern physent *collideplayer;
+extern thread_local vec collidewall;
+extern thread_local bool collideinside;
+extern thread_local physent *collideplayer;
 
 extern void moveplayer(physent *pl, int moveres, bool local);
 extern bool moveplayer(physent *pl, int moveres, bool local, int curtime);
@@ -392,12 +394,24 @@ extern bool movecamera(physent *pl, const vec &dir, float dist, float stepdist);
 extern void physicsframe();
 extern void dropenttofloor(entity *e);
 extern bool droptofloor(vec &o, float radius, float height);
+typedef void (*physstepfunc)(void *data, int i);
+extern void parallelphysics(int num, physstepfunc step, void *data = NULL);
+
+struct physcounts
+{
+    int collides, cubes, mapmodels, dynents, rays, events;
+};
+
+extern void startphyscounts();
+extern void stopphyscounts(physcounts &counts);
 
 extern void vecfromyawpitch(float yaw, float pitch, int move, int strafe, vec &m);
 extern void vectoyawpitch(const vec &v, float &yaw, float &pitch);
 extern void updatephysstate(physent *d);
 extern void cleardynentcache();
 extern void updatedynentcache(physent *d);
+extern const vector<physent *> &finddynents(const vec &o, float radius);
+extern const vector<physent *> &raydynents(const vec &from, const vec &to, float margin);
 extern bool entinmap(dynent *d, bool avoidplayers = false);
 extern void findplayerspawn(dynent *d, int forceent = -1, int tag = 0);
 
@@ -458,6 +472,7 @@ namespace UI
 
 extern void moveragdoll(dynent *d);
 extern void cleanragdoll(dynent *d);
+extern void initboxragdoll(dynent *d);
 
 // server
 #define MAXCLIENTS 128                 // DO NOT set this any higher
@@ -123,17 +123,69 @@ extern const uchar cubeupperchars[256] =
     240, 241, 242, 243, 244, 245, 246, 247, 248, 249, 250, 251, 252, 253, 254, 255
 };
 
-size_t decodeutf8(uchar *dstbuf, size_t dstlen, const uchar *srcbuf, size_t srclen, size_t *carry)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTF8SSE2
+#endif
+
+// length of the leading run of 7-bit bytes, which decode to themselves
+static inline size_t asciispan(const uchar *src, size_t len)
+{
+    size_t n = 0;
+#ifdef UTF8SSE2
+    for(; n + 16 <= len; n += 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)&src[n]));
+        if(mask) return n + bitscan(mask);
+    }
+#else
+    for(; n + 4 <= len; n += 4) if(*(const int *)&src[n] & 0x80808080) break;
+#endif
+    while(n < len && src[n] < 0x80) n++;
+    return n;
+}
+
+static inline bool isplainascii(uchar c) { return (c >= 0x20 && c < 0x7F) || (c >= '\t' && c <= '\r' && c != '\f'); }
+
+// length of the leading run of cube chars that encode to the identical byte
+static inline size_t plainasciispan(const uchar *src, size_t len)
+{
+    size_t n = 0;
+#ifdef UTF8SSE2
+    const __m128i printlo = _mm_set1_epi8(0x1F), printhi = _mm_set1_epi8(0x7F),
+                  spacelo = _mm_set1_epi8('\t'-1), spacehi = _mm_set1_epi8('\r'+1), formfeed = _mm_set1_epi8('\f');
+    for(; n + 16 <= len; n += 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *)&src[n]),
+                print = _mm_and_si128(_mm_cmpgt_epi8(c, printlo), _mm_cmplt_epi8(c, printhi)),
+                space = _mm_andnot_si128(_mm_cmpeq_epi8(c, formfeed), _mm_and_si128(_mm_cmpgt_epi8(c, spacelo), _mm_cmplt_epi8(c, spacehi)));
+        int mask = ~_mm_movemask_epi8(_mm_or_si128(print, space)) & 0xFFFF;
+        if(mask) return n + bitscan(mask);
+    }
+#endif
+    while(n < len && isplainascii(src[n])) n++;
+    return n;
+}
+
+template<bool SPANS>
+static size_t decodeutf8spans(uchar *dstbuf, size_t dstlen, const uchar *srcbuf, size_t srclen, size_t *carry)
 {
     uchar *dst = dstbuf, *dstend = &dstbuf[dstlen];
     const uchar *src = srcbuf, *srcend = &srcbuf[srclen];
     if(dstbuf == srcbuf)
     {
         int len = min(dstlen, srclen);
-        for(const uchar *end4 = &srcbuf[len&~3]; src < end4; src += 4) if(*(const int *)src & 0x80808080) goto decode;
-        for(const uchar *end = &srcbuf[len]; src < end; src++) if(*src & 0x80) goto decode;
-        if(carry) *carry += len;
-        return len;
+        if(SPANS) src += asciispan(src, len);
+        else
+        {
+            for(const uchar *end4 = &srcbuf[len&~3]; src < end4; src += 4) if(*(const int *)src & 0x80808080) goto decode;
+            for(const uchar *end = &srcbuf[len]; src < end; src++) if(*src & 0x80) goto decode;
+        }
+        if(src >= &srcbuf[len])
+        {
+            if(carry) *carry += len;
+            return len;
+        }
     }
 
 decode:
@@ -141,7 +193,15 @@ decode:
     while(src < srcend && dst < dstend)
     {
         int c = *src++;
-        if(c < 0x80) *dst++ = c;
+        if(c < 0x80)
+        {
+            *dst++ = c;
+            if(SPANS)
+            {
+                size_t n = asciispan(src, min(srcend - src, dstend - dst));
+                if(n) { memmove(dst, src, n); dst += n; src += n; }
+            }
+        }
         else if(c >= 0xC0)
         {
             int uni;
@@ -177,7 +237,8 @@ decode:
     return dst - dstbuf;
 }
 
-size_t encodeutf8(uchar *dstbuf, size_t dstlen, const uchar *srcbuf, size_t srclen, size_t *carry)
+template<bool SPANS>
+static size_t encodeutf8spans(uchar *dstbuf, size_t dstlen, const uchar *srcbuf, size_t srclen, size_t *carry)
 {
     uchar *dst = dstbuf, *dstend = &dstbuf[dstlen];
     const uchar *src = srcbuf, *srcend = &srcbuf[srclen];
@@ -197,6 +258,17 @@ size_t encodeutf8(uchar *dstbuf, size_t dstlen, const uchar *srcbuf, size_t srcl
                 }
                 *dst++ = uni;
                 if(++src >= end) goto done;
+                if(SPANS)
+                {
+                    size_t n = plainasciispan(src, end - src);
+                    if(n)
+                    {
+                        memcpy(dst, src, n);
+                        dst += n;
+                        src += n;
+                        if(src >= end) goto done;
+                    }
+                }
                 uni = cube2uni(*src);
             }
             while(uni <= 0x7F);
@@ -221,6 +293,16 @@ done:
     return dst - dstbuf;
 }
 
+size_t decodeutf8(uchar *dstbuf, size_t dstlen, const uchar *srcbuf, size_t srclen, size_t *carry)
+{
+    return decodeutf8spans<true>(dstbuf, dstlen, srcbuf, srclen, carry);
+}
+
+size_t encodeutf8(uchar *dstbuf, size_t dstlen, const uchar *srcbuf, size_t srclen, size_t *carry)
+{
+    return encodeutf8spans<true>(dstbuf, dstlen, srcbuf, srclen, carry);
+}
+
 ///////////////////////// file system ///////////////////////
 
 #ifdef WIN32
@@ -242,7 +324,7 @@ vector<packagedir> packagedirs;
 
 char *makerelpath(const char *dir, const char *file, const char *prefix, const char *cmd)
 {
-    static string tmp;
+    static thread_local string tmp;
     if(prefix) copystring(tmp, prefix);
     else tmp[0] = '\0';
     if(file[0]=='<')
@@ -313,7 +395,7 @@ char *path(char *s)
 
 char *path(const char *s, bool copy)
 {
-    static string tmp;
+    static thread_local string tmp;
     copystring(tmp, s);
     path(tmp);
     return tmp;
@@ -323,7 +405,7 @@ const char *parentdir(const char *directory)
 {
     const char *p = directory + strlen(directory);
     while(p > directory && *p != '/' && *p != '\\') p--;
-    static string parent;
+    static thread_local string parent;
     size_t len = p-directory+1;
     copystring(parent, directory, len);
     return parent;
@@ -346,7 +428,7 @@ bool createdir(const char *path)
     size_t len = strlen(path);
     if(path[len-1]==PATHDIV)
     {
-        static string strip;
+        static thread_local string strip;
         path = copystring(strip, path, len);
     }
 #ifdef WIN32
@@ -422,7 +504,7 @@ const char *addpackagedir(const char *dir)
 
 const char *findfile(const char *filename, const char *mode)
 {
-    static string s;
+    static thread_local string s; // also called from job workers
     if(homedir[0])
     {
         formatstring(s, "%s%s", homedir, filename);
@@ -1233,3 +1315,55 @@ char *loadfile(const char *fn, size_t *size, bool utf8)
     return buf;
 }
 
+#ifndef STANDALONE
+static inline double utf8benchrate(size_t len, int iterations, Uint64 ticks)
+{
+    return ticks ? double(len)*iterations*SDL_GetPerformanceFrequency()/(ticks*1048576.0) : 0;
+}
+
+void utf8bench(const char *dir, int *iterations)
+{
+    vector<char *> files;
+    listfiles(dir, "cfg", files);
+    vector<uchar> src;
+    loopv(files)
+    {
+        defformatstring(name, "%s/%s.cfg", dir, files[i]);
+        size_t len = 0;
+        char *buf = loadfile(path(name), &len, false);
+        if(buf) { src.put((const uchar *)buf, len); delete[] buf; }
+    }
+    int numfiles = files.length();
+    files.deletearrays();
+    if(src.empty()) { conoutf(CON_ERROR, "no config files found in %s", dir); return; }
+
+    int n = max(*iterations, 1), len = src.length();
+    uchar *scalar = new uchar[len], *fast = new uchar[len], *scalarenc = new uchar[4*len], *fastenc = new uchar[4*len];
+    size_t scalarlen = 0, fastlen = 0, scalarenclen = 0, fastenclen = 0;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    loopi(n) { memcpy(scalar, src.getbuf(), len); scalarlen = decodeutf8spans<false>(scalar, len, scalar, len, NULL); }
+    Uint64 scalardecode = SDL_GetPerformanceCounter() - start;
+    start = SDL_GetPerformanceCounter();
+    loopi(n) { memcpy(fast, src.getbuf(), len); fastlen = decodeutf8spans<true>(fast, len, fast, len, NULL); }
+    Uint64 fastdecode = SDL_GetPerformanceCounter() - start;
+
+    start = SDL_GetPerformanceCounter();
+    loopi(n) scalarenclen = encodeutf8spans<false>(scalarenc, 4*len, scalar, scalarlen, NULL);
+    Uint64 scalarencode = SDL_GetPerformanceCounter() - start;
+    start = SDL_GetPerformanceCounter();
+    loopi(n) fastenclen = encodeutf8spans<true>(fastenc, 4*len, fast, fastlen, NULL);
+    Uint64 fastencode = SDL_GetPerformanceCounter() - start;
+
+    bool match = scalarlen == fastlen && !memcmp(scalar, fast, scalarlen) && scalarenclen == fastenclen && !memcmp(scalarenc, fastenc, scalarenclen);
+    conoutf(match ? CON_INFO : CON_ERROR, "utf8bench: %d files, %d bytes, decode %.1f -> %.1f MB/s, encode %.1f -> %.1f MB/s%s",
+        numfiles, len, utf8benchrate(len, n, scalardecode), utf8benchrate(len, n, fastdecode),
+        utf8benchrate(scalarlen, n, scalarencode), utf8benchrate(fastlen, n, fastencode), match ? "" : ", results differ!");
+
+    delete[] scalar;
+    delete[] fast;
+    delete[] scalarenc;
+    delete[] fastenc;
+}
+COMMAND(utf8bench, "si");
+#endif
@@ -2,8 +2,14 @@
 
 #include "cube.h"
 
+// counted per thread so job workers don't race on them, the job system adds up the workers' counts (see countallocs)
+thread_local uint numallocs = 0;
+thread_local size_t numallocbytes = 0;
+
 void *operator new(size_t size)
 {
+    numallocs++;
+    numallocbytes += size;
     void *p = malloc(size);
     if(!p) abort();
     return p;
@@ -11,6 +17,8 @@ void *operator new(size_t size)
 
 void *operator new[](size_t size)
 {
+    numallocs++;
+    numallocbytes += size;
     void *p = malloc(size);
     if(!p) abort();
     return p;
@@ -22,8 +30,8 @@ void operator delete[](void *p) { if(p) free(p); }
 
 ////////////////////////// strings ////////////////////////////////////////
 
-static string tmpstr[4];
-static int tmpidx = 0;
+static thread_local string tmpstr[4];
+static thread_local int tmpidx = 0;
 
 char *tempformatstring(const char *fmt, ...)
 {
@@ -54,6 +62,23 @@ void seedMT(uint seed)
     next = 0;
 }
 
+// reseeds temporarily, keeping one saved copy of the generator so popMT() can hand it back untouched
+static uint savedstate[N];
+static int savednext = N;
+
+void pushMT(uint seed)
+{
+    memcpy(savedstate, state, sizeof(state));
+    savednext = next;
+    seedMT(seed);
+}
+
+void popMT()
+{
+    memcpy(state, savedstate, sizeof(state));
+    next = savednext;
+}
+
 uint randomMT()
 {
     int cur = next;
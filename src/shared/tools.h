@@ -38,6 +38,9 @@ inline void *operator new[](size_t, void *p) { return p; }
 inline void operator delete(void *, void *) {}
 inline void operator delete[](void *, void *) {}
 
+extern thread_local uint numallocs;
+extern thread_local size_t numallocbytes;
+
 #ifdef swap
 #undef swap
 #endif
@@ -1358,6 +1361,8 @@ extern bool listdir(const char *dir, bool rel, const char *ext, vector<char *> &
 extern int listfiles(const char *dir, const char *ext, vector<char *> &files);
 extern int listzipfiles(const char *dir, const char *ext, vector<char *> &files);
 extern void seedMT(uint seed);
+extern void pushMT(uint seed);
+extern void popMT();
 extern uint randomMT();
 
 extern void putint(ucharbuf &p, int n);
@@ -51,6 +51,20 @@ struct zipfile
 
 struct zipstream;
 
+#ifndef STANDALONE
+// streams of an archive share its FILE, so reads that may come from job workers are serialized
+static SDL_mutex *ziplock = NULL;
+
+struct ziplocker
+{
+    ziplocker() { if(ziplock) SDL_LockMutex(ziplock); }
+    ~ziplocker() { if(ziplock) SDL_UnlockMutex(ziplock); }
+};
+#define LOCKZIP ziplocker ziplocked
+#else
+#define LOCKZIP
+#endif
+
 struct ziparchive
 {
     char *name;
@@ -292,6 +306,9 @@ bool addzip(const char *name, const char *mount = NULL, const char *strip = NULL
         return false;
     }
 
+#ifndef STANDALONE
+    if(!ziplock) ziplock = SDL_CreateMutex();
+#endif
     ziparchive *arch = new ziparchive;
     arch->name = newstring(pname);
     arch->data = f;
@@ -356,6 +373,7 @@ struct zipstream : stream
 
     void readbuf(uint size = BUFSIZE)
     {
+        LOCKZIP;
         if(!zfile.avail_in) zfile.next_in = (Bytef *)buf;
         size = min(size, uint(&buf[BUFSIZE] - &zfile.next_in[zfile.avail_in]));
         if(arch->owner != this)
@@ -372,6 +390,7 @@ struct zipstream : stream
 
     bool open(ziparchive *a, zipfile *f)
     {
+        LOCKZIP;
         if(f->offset == ~0U)
         {
             ziplocalfileheader h;
@@ -405,6 +424,7 @@ struct zipstream : stream
     {
         stopreading();
         DELETEA(buf);
+        LOCKZIP;
         if(arch) { arch->owner = NULL; arch->openfiles--; arch = NULL; }
     }
 
@@ -415,6 +435,7 @@ struct zipstream : stream
     bool seek(offset pos, int whence)
     {
         if(reading == ~0U) return false;
+        LOCKZIP;
         if(!info->compressedsize)
         {
             switch(whence)
@@ -488,6 +509,7 @@ struct zipstream : stream
         if(reading == ~0U || !buf || !len) return 0;
         if(!info->compressedsize)
         {
+            LOCKZIP;
             if(arch->owner != this)
             {
                 arch->owner = NULL;